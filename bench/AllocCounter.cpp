@@ -0,0 +1,95 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file AllocCounter.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements the allocation counter by interposing malloc
+ * @version 0.1
+ * @date 2021-03-07
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <atomic>
+#include <cstdlib>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+#include "AllocCounter.hpp"
+
+static std::atomic<size_t> m_allocations(0);
+static std::atomic<size_t> m_bytes(0);
+
+#ifdef __GLIBC__
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void  __libc_free(void *ptr);
+
+// Symbols defined in the executable take precedence over libc ones, for
+// every shared library too
+void *malloc(size_t size) {
+    void *ptr = __libc_malloc(size);
+
+    m_allocations.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(malloc_usable_size(ptr), std::memory_order_relaxed);
+    return ptr;
+}
+
+void *calloc(size_t count, size_t size) {
+    void *ptr = __libc_calloc(count, size);
+
+    m_allocations.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(malloc_usable_size(ptr), std::memory_order_relaxed);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    size_t previous = malloc_usable_size(ptr);
+    void * result   = __libc_realloc(ptr, size);
+
+    m_allocations.fetch_add(1, std::memory_order_relaxed);
+
+    // On failure ptr is left untouched
+    if (result || !size) {
+        m_bytes.fetch_sub(previous, std::memory_order_relaxed);
+        m_bytes.fetch_add(malloc_usable_size(result),
+                          std::memory_order_relaxed);
+    }
+
+    return result;
+}
+
+void free(void *ptr) {
+    m_bytes.fetch_sub(malloc_usable_size(ptr), std::memory_order_relaxed);
+    __libc_free(ptr);
+}
+}
+#endif
+
+size_t MatrixCpp::Bench::allocationCount() {
+    return m_allocations.load(std::memory_order_relaxed);
+}
+
+size_t MatrixCpp::Bench::allocatedBytes() {
+    return m_bytes.load(std::memory_order_relaxed);
+}
+
+size_t MatrixCpp::Bench::peakRss() {
+#ifdef __unix__
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        return usage.ru_maxrss;
+#endif
+
+    return 0;
+}
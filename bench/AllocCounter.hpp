@@ -0,0 +1,43 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file AllocCounter.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Heap allocation counter and memory usage for benchmarks
+ * @version 0.1
+ * @date 2021-03-07
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <cstddef>
+
+namespace MatrixCpp::Bench {
+/**
+ * @brief Total calls to malloc, calloc and realloc since program start. Qt
+   containers allocate through malloc, so they are counted too. Always 0 when
+   not built against glibc
+ *
+ * @return size_t
+ */
+size_t allocationCount();
+
+/**
+ * @brief Bytes currently allocated through malloc, calloc and realloc, as
+   reported by malloc_usable_size(). Always 0 when not built against glibc
+ *
+ * @return size_t
+ */
+size_t allocatedBytes();
+
+/**
+ * @brief Peak resident set size of the process so far, in KiB. Always 0 where
+   getrusage() is not available
+ *
+ * @return size_t
+ */
+size_t peakRss();
+} // namespace MatrixCpp::Bench
@@ -0,0 +1,164 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file MemberBench.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Compares memory used by room members before and after member tables
+ * @version 0.1
+ * @date 2021-03-18
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QLoggingCategory>
+#include <cstdio>
+
+#include <MatrixCpp/Room.hpp>
+
+#include "AllocCounter.hpp"
+
+using namespace MatrixCpp::Bench;
+using namespace MatrixCpp::Types;
+
+/**
+ * @brief Member as stored before member tables: one QObject per user per
+   room, each with its own copy of the profile
+ *
+ */
+class LegacyUser : public QObject {
+  public:
+    LegacyUser(const QString &userId,
+               const QString &displayName,
+               const QString &avatarUrl)
+        : userId(userId), displayName(displayName), avatarUrl(avatarUrl) {
+    }
+
+    QString userId;
+    QString displayName;
+    QString avatarUrl;
+};
+
+// Every call gives new strings, as parsing each room of a sync does
+
+static QString userId(int i) {
+    return QString("@user%1:example.org").arg(i);
+}
+
+static QString displayName(int i) {
+    return QString("User %1").arg(i);
+}
+
+static QString avatarUrl(int i) {
+    return QString("mxc://example.org/avatar%1").arg(i);
+}
+
+/**
+ * @brief Builds the m.room.member event of member i. One in ten is invited
+ *
+ */
+static StateEvent memberEvent(int i) {
+    QJsonObject content{{"membership", i % 10 ? "join" : "invite"},
+                        {"displayname", displayName(i)},
+                        {"avatar_url", avatarUrl(i)}};
+
+    QJsonObject json{{"type", "m.room.member"},
+                     {"event_id", QString("$m%1").arg(i)},
+                     {"sender", userId(i)},
+                     {"origin_server_ts", 1},
+                     {"state_key", userId(i)},
+                     {"content", content}};
+
+    StateEvent event = QJsonValue(json);
+    return event;
+}
+
+static void report(const char *name, qint64 ns, size_t bytes, int members) {
+    printf("%-8s %10.3f ms %12.3f MiB %8.1f bytes/member\n",
+           name,
+           ns / 1e6,
+           bytes / 1048576.0,
+           (double) bytes / members);
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QStringList      args = app.arguments();
+
+    int members = args.size() > 1 ? args[1].toInt() : 100000;
+    int rooms   = args.size() > 2 ? args[2].toInt() : 1;
+
+    if (members <= 0 || rooms <= 0) {
+        fprintf(stderr, "Usage: %s [members] [rooms]\n", argv[0]);
+        return 1;
+    }
+
+    // Room logs every member it adds
+    QLoggingCategory::setFilterRules("*.debug=false");
+
+    printf("%d members in %d rooms\n", members, rooms);
+
+    // Before: a map of QObjects per membership and room
+    {
+        QVector<QMap<QString, LegacyUser *>> joined(rooms), invited(rooms);
+        QElapsedTimer                        timer;
+        size_t                               bytes = allocatedBytes();
+
+        timer.start();
+
+        for (int r = 0; r < rooms; r++)
+            for (int i = 0; i < members; i++) {
+                StateEvent   event = memberEvent(i);
+                EventContent content(event.content);
+
+                QMap<QString, LegacyUser *> &users =
+                    content.membership == EventContent::MEMBERSHIP_JOIN
+                        ? joined[r]
+                        : invited[r];
+
+                users.insert(event.stateKey,
+                             new LegacyUser(event.stateKey,
+                                            content.displayName,
+                                            content.avatarUrl));
+            }
+
+        report("before",
+               timer.nsecsElapsed(),
+               allocatedBytes() - bytes,
+               members * rooms);
+
+        for (int r = 0; r < rooms; r++) {
+            qDeleteAll(joined[r]);
+            qDeleteAll(invited[r]);
+        }
+    }
+
+    // After: a member table per room, profiles shared by the registry
+    {
+        QVector<Room *> tables;
+        QElapsedTimer   timer;
+        size_t          bytes = allocatedBytes();
+
+        timer.start();
+
+        for (int r = 0; r < rooms; r++) {
+            Room *room = new Room(QString("!room%1:example.org").arg(r));
+
+            for (int i = 0; i < members; i++)
+                room->onRoomMemberEvent(memberEvent(i));
+
+            tables.append(room);
+        }
+
+        report("after",
+               timer.nsecsElapsed(),
+               allocatedBytes() - bytes,
+               members * rooms);
+
+        qDeleteAll(tables);
+    }
+
+    return 0;
+}
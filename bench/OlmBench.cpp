@@ -0,0 +1,767 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file OlmBench.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Measures Olm account and session operations against local peers
+ * @version 0.1
+ * @date 2021-03-24
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <QRandomGenerator>
+#include <QTemporaryDir>
+#include <QUuid>
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <numeric>
+
+#include "AllocCounter.hpp"
+#include "src/Utils.hpp"
+#include "src/olm/Olm.hpp"
+#include "support/MockTransport.hpp"
+
+using namespace MatrixCpp;
+using namespace MatrixCpp::Bench;
+using namespace MatrixCpp::Crypto;
+
+/// Of the bench user, also the key its sessions are pickled with
+static const QString ACCESS_TOKEN = "bench_token";
+
+/**
+ * @brief Summarizes the durations of single operations
+ *
+ * @param samples Nanoseconds of each operation
+ */
+static QJsonObject latency(QVector<qint64> samples) {
+    if (samples.isEmpty())
+        return {{"count", 0}};
+
+    qint64 total = 0;
+
+    for (qint64 sample : samples)
+        total += sample;
+
+    std::sort(samples.begin(), samples.end());
+
+    auto percentile = [&](double p) {
+        return samples[qMin(samples.size() - 1, int(p * samples.size()))] /
+               1e3;
+    };
+
+    return {{"count", samples.size()},
+            {"per_sec", total ? samples.size() * 1e9 / total : 0.0},
+            {"mean_us", total / 1e3 / samples.size()},
+            {"p50_us", percentile(0.5)},
+            {"p99_us", percentile(0.99)},
+            {"max_us", samples.last() / 1e3}};
+}
+
+// Plain libolm helpers, standing for the other side of every session
+
+static OlmAccount *newAccount() {
+    OlmAccount *account    = olm_account(malloc(olm_account_size()));
+    size_t      randomSize = olm_create_account_random_length(account);
+    uint8_t *   random     = Utils::randomBytes(randomSize);
+
+    size_t result = olm_create_account(account, random, randomSize);
+    free(random);
+
+    if (result == olm_error())
+        throw std::runtime_error(
+            std::string("BENCH could not create account: ") +
+            olm_account_last_error(account));
+
+    return account;
+}
+
+static void freeAccount(OlmAccount *account) {
+    olm_clear_account(account);
+    free(account);
+}
+
+static QString identityKey(OlmAccount *account) {
+    QByteArray keys(olm_account_identity_keys_length(account), 0);
+
+    olm_account_identity_keys(account, keys.data(), keys.size());
+
+    return QJsonDocument::fromJson(keys)
+        .object()
+        .value("curve25519")
+        .toString();
+}
+
+/**
+ * @brief Generates count one time keys on account and returns them
+ *
+ */
+static QStringList oneTimeKeys(OlmAccount *account, int count) {
+    size_t randomSize =
+        olm_account_generate_one_time_keys_random_length(account, count);
+    uint8_t *random = Utils::randomBytes(randomSize);
+
+    olm_account_generate_one_time_keys(account, count, random, randomSize);
+    free(random);
+
+    QByteArray keys(olm_account_one_time_keys_length(account), 0);
+    olm_account_one_time_keys(account, keys.data(), keys.size());
+    olm_account_mark_keys_as_published(account);
+
+    QStringList list;
+
+    for (const QJsonValue &key : QJsonDocument::fromJson(keys)
+                                     .object()
+                                     .value("curve25519")
+                                     .toObject())
+        list.append(key.toString());
+
+    return list;
+}
+
+static OlmSession *outboundSession(OlmAccount *   account,
+                                   const QString &identityKey,
+                                   const QString &oneTimeKey) {
+    OlmSession *session    = olm_session(malloc(olm_session_size()));
+    QByteArray  identity   = identityKey.toUtf8();
+    QByteArray  oneTime    = oneTimeKey.toUtf8();
+    size_t      randomSize = olm_create_outbound_session_random_length(session);
+    uint8_t *   random     = Utils::randomBytes(randomSize);
+
+    size_t result = olm_create_outbound_session(session,
+                                                account,
+                                                identity.constData(),
+                                                identity.size(),
+                                                oneTime.constData(),
+                                                oneTime.size(),
+                                                random,
+                                                randomSize);
+    free(random);
+
+    if (result == olm_error())
+        throw std::runtime_error(
+            std::string("BENCH could not create outbound session: ") +
+            olm_session_last_error(session));
+
+    return session;
+}
+
+static QString sessionId(OlmSession *session) {
+    QByteArray id(olm_session_id_length(session), 0);
+
+    olm_session_id(session, id.data(), id.size());
+    return id;
+}
+
+static QByteArray encrypt(OlmSession *session, const QByteArray &plain) {
+    size_t     randomSize = olm_encrypt_random_length(session);
+    uint8_t *  random     = Utils::randomBytes(randomSize);
+    QByteArray message(olm_encrypt_message_length(session, plain.size()), 0);
+
+    olm_encrypt(session,
+                plain.constData(),
+                plain.size(),
+                random,
+                randomSize,
+                message.data(),
+                message.size());
+    free(random);
+
+    return message;
+}
+
+static bool decrypt(OlmSession *session, int type, const QByteArray &message) {
+    // olm_decrypt_max_plaintext_length and olm_decrypt destroy their input
+    QByteArray buffer(message.constData(), message.size());
+    size_t     maxLength = olm_decrypt_max_plaintext_length(
+        session, type, buffer.data(), buffer.size());
+
+    if (maxLength == olm_error())
+        return false;
+
+    QByteArray plain(maxLength, 0);
+
+    buffer = QByteArray(message.constData(), message.size());
+    return olm_decrypt(session,
+                       type,
+                       buffer.data(),
+                       buffer.size(),
+                       plain.data(),
+                       plain.size()) != olm_error();
+}
+
+/**
+ * @brief An m.room_key to-device payload, as most olm messages are
+ *
+ */
+static QByteArray roomKeyPayload(int i) {
+    QJsonObject content{
+        {"algorithm", MEGOLM_ALGORITHM},
+        {"room_id", QString("!room%1:example.org").arg(i)},
+        {"session_id", QString(43, 'S')},
+        {"session_key", QString(308, 'K')}};
+
+    return QJsonDocument(QJsonObject{{"type", "m.room_key"},
+                                     {"sender", "@peer:example.org"},
+                                     {"recipient", "@bench:example.org"},
+                                     {"content", content}})
+        .toJson(QJsonDocument::Compact);
+}
+
+/**
+ * @brief A device key which looks like a curve25519 one, the same for the
+   same i
+ *
+ */
+static QString deviceKey(int i) {
+    return QCryptographicHash::hash(QByteArray::number(i),
+                                    QCryptographicHash::Sha256)
+        .toBase64(QByteArray::OmitTrailingEquals);
+}
+
+/**
+ * @brief A session store record of a device, as SessionStore appends them
+ *
+ */
+static QByteArray storeRecord(const QString &                    deviceKey,
+                              const QMap<QString, OlmSession *> &sessions) {
+    QByteArray  key = ACCESS_TOKEN.toUtf8();
+    QVariantMap pickles;
+
+    for (auto it = sessions.begin(); it != sessions.end(); it++) {
+        QByteArray pickled(olm_pickle_session_length(it.value()), 0);
+
+        olm_pickle_session(it.value(),
+                           key.constData(),
+                           key.size(),
+                           pickled.data(),
+                           pickled.size());
+        pickles.insert(it.key(), QString(pickled));
+    }
+
+    return Utils::canonicalJson({{deviceKey, pickles}});
+}
+
+/**
+ * @brief Runs every measurement on an Olm account of its own, through the
+   entry points the library uses itself. Keys are uploaded to a mock
+   homeserver, and sessions reach SessionStore as records on disk
+ *
+ */
+class OlmBench {
+  public:
+    explicit OlmBench(const QString &dir) : m_dir(dir) {
+        this->m_server = new MockTransport;
+        this->m_client = new Client(QUrl("http://localhost"), false);
+        this->m_client->storeDir    = QDir(dir);
+        this->m_client->persistSync = false;
+        this->m_client->setTransport(this->m_server);
+        this->m_client->restore("@bench:example.org", "BENCH", ACCESS_TOKEN);
+
+        // Parsed once timing is over, so the handler costs nothing
+        this->m_server->route(
+            "/_matrix/client/r0/keys/upload",
+            [=](const QNetworkRequest &, const QByteArray &body) {
+                this->m_uploaded = body;
+                return MockTransport::Reply{200, "{}"};
+            });
+
+        this->m_olm = new Olm(this->m_client);
+        this->m_olm->deviceKeysUploaded = true;
+    }
+
+    ~OlmBench() {
+        delete this->m_client;
+    }
+
+    /**
+     * @brief Olm::decrypt of pre-key messages from new peers, which creates
+       a session each, then of normal messages from one peer
+     *
+     */
+    QJsonObject decrypt(int preKeyMessages, int normalMessages) {
+        QString         ourKey = this->m_olm->curve25519();
+        QVector<qint64> preKey, normal;
+        QStringList     keys;
+        OlmAccount *    peer        = nullptr;
+        OlmSession *    peerSession = nullptr;
+        int             failed      = 0;
+        bool            lastFailed  = false;
+
+        for (int i = 0; i < preKeyMessages; i++) {
+            // Every session uses up one of our one time keys
+            if (keys.isEmpty())
+                keys = this->uploadKeys();
+
+            if (peer) {
+                olm_clear_session(peerSession);
+                free(peerSession);
+                freeAccount(peer);
+            }
+
+            peer        = newAccount();
+            peerSession = outboundSession(peer, ourKey, keys.takeFirst());
+
+            QByteArray message = encrypt(peerSession, roomKeyPayload(i));
+            QString    peerKey = identityKey(peer);
+
+            QElapsedTimer timer;
+            timer.start();
+
+            QByteArray plain = this->m_olm->decrypt(message, peerKey, 0);
+
+            preKey.append(timer.nsecsElapsed());
+            lastFailed = plain.isEmpty();
+            failed += lastFailed;
+        }
+
+        QJsonObject result{{"pre_key", latency(preKey)},
+                           {"pre_key_failed", failed}};
+
+        // Normal messages need a session with the last peer
+        if (!peer || lastFailed) {
+            result.insert("normal", latency(normal));
+            return result;
+        }
+
+        // Peer sends normal messages once it got a reply from us. Olm does
+        // not encrypt, so the reply comes from the stored session, which a
+        // new Olm then loads as after a restart
+        QString peerKey = identityKey(peer);
+
+        {
+            SessionStore                store(this->sessionsPath(),
+                                              nullptr,
+                                              ACCESS_TOKEN);
+            QMap<QString, OlmSession *> ours = store[peerKey];
+
+            if (ours.isEmpty() ||
+                !::decrypt(peerSession, 1, encrypt(ours.first(), "{}")) ||
+                olm_encrypt_message_type(peerSession) != 1)
+                throw std::runtime_error("BENCH peer did not switch to normal "
+                                         "messages");
+
+            store.update(peerKey);
+        }
+
+        delete this->m_olm;
+        this->m_olm = new Olm(this->m_client);
+
+        QList<QByteArray> messages;
+
+        for (int i = 0; i < normalMessages; i++)
+            messages.append(encrypt(peerSession, roomKeyPayload(i)));
+
+        for (const QByteArray &message : messages) {
+            QElapsedTimer timer;
+            timer.start();
+
+            QByteArray plain = this->m_olm->decrypt(message, peerKey, 1);
+
+            normal.append(timer.nsecsElapsed());
+
+            if (plain.isEmpty())
+                throw std::runtime_error("BENCH normal message not decrypted");
+        }
+
+        olm_clear_session(peerSession);
+        free(peerSession);
+        freeAccount(peer);
+
+        result.insert("normal", latency(normal));
+        return result;
+    }
+
+    /**
+     * @brief Olm::sendKeys of a full batch of one time keys, i.e. generating,
+       signing and sending them, and Olm::sign alone
+     *
+     */
+    QJsonObject oneTimeKeys(int iterations) {
+        QVector<qint64> batches, signatures;
+        int             count = 0;
+
+        for (int i = 0; i < iterations; i++) {
+            qint64 elapsed;
+
+            count = this->uploadKeys(&elapsed).size();
+            batches.append(elapsed);
+
+            if (count == 0)
+                throw std::runtime_error("BENCH one time keys missing");
+        }
+
+        QString message = Utils::canonicalJson({{"key", QString(43, 'k')}});
+
+        for (int i = 0; i < iterations * count; i++) {
+            QElapsedTimer timer;
+            timer.start();
+
+            this->m_olm->sign(message);
+
+            signatures.append(timer.nsecsElapsed());
+        }
+
+        QJsonObject batch = latency(batches);
+        batch.insert("keys_per_sec", batch.value("per_sec").toDouble() * count);
+
+        return {{"keys", count},
+                {"send_keys", batch},
+                {"sign", latency(signatures)}};
+    }
+
+    /**
+     * @brief SessionStore::update of a device with count sessions, which
+       pickles and appends them synced to disk, and its first lookup in a
+       new SessionStore, which reads and unpickles them
+     *
+     */
+    QJsonObject pickle(int count, int iterations) {
+        QString path   = this->m_dir + "/pickle.jsonl";
+        QString device = deviceKey(0);
+
+        QMap<QString, OlmSession *> sessions = this->sessions(count);
+        QByteArray record = this->writeStore(path, 1, sessions);
+        QVector<qint64> saved, loaded;
+
+        {
+            SessionStore store(path, nullptr, ACCESS_TOKEN);
+
+            // Not while timing
+            store.compactThreshold = INT_MAX;
+            store[device];
+
+            for (int i = 0; i < iterations; i++) {
+                QElapsedTimer timer;
+                timer.start();
+
+                store.update(device);
+
+                saved.append(timer.nsecsElapsed());
+            }
+        }
+
+        for (int i = 0; i < iterations; i++) {
+            SessionStore  store(path, nullptr, ACCESS_TOKEN);
+            QElapsedTimer timer;
+
+            timer.start();
+
+            QMap<QString, OlmSession *> found = store[device];
+
+            loaded.append(timer.nsecsElapsed());
+
+            if (found.size() != count)
+                throw std::runtime_error("BENCH sessions not unpickled");
+        }
+
+        for (OlmSession *session : sessions) {
+            olm_clear_session(session);
+            free(session);
+        }
+
+        QJsonObject save = latency(saved), load = latency(loaded);
+
+        save.insert("sessions_per_sec",
+                    save.value("per_sec").toDouble() * count);
+        save.insert("mib_per_sec",
+                    save.value("per_sec").toDouble() * record.size() /
+                        1048576);
+        load.insert("sessions_per_sec",
+                    load.value("per_sec").toDouble() * count);
+        load.insert("mib_per_sec",
+                    load.value("per_sec").toDouble() * record.size() /
+                        1048576);
+
+        return {{"sessions", count},
+                {"record_bytes", record.size()},
+                {"save", save},
+                {"load", load}};
+    }
+
+    /**
+     * @brief SessionStore lookups in a store of devices devices, one session
+       each: the first lookup (building the index, then loading it), lookups
+       reading a record, cached ones and ones of unknown devices
+     *
+     */
+    QJsonObject lookup(int devices, int lookups) {
+        QString path =
+            QString("%1/lookup_%2.jsonl").arg(this->m_dir).arg(devices);
+
+        QMap<QString, OlmSession *> sessions = this->sessions(1);
+
+        this->writeStore(path, devices, sessions);
+
+        olm_clear_session(sessions.first());
+        free(sessions.first());
+
+        // Distinct devices, the same ones on every run
+        QRandomGenerator random(devices);
+        QVector<int>     order(devices);
+        QStringList      keys;
+
+        std::iota(order.begin(), order.end(), 0);
+        std::shuffle(order.begin(), order.end(), random);
+
+        for (int i = 0; i < qMin(devices, lookups); i++)
+            keys.append(deviceKey(order[i]));
+
+        QJsonObject result{{"devices", devices}};
+
+        // First with no index file, then with the one it wrote
+        for (const char *name : {"index_build", "index_load"}) {
+            SessionStore  store(path, nullptr, ACCESS_TOKEN);
+            QElapsedTimer timer;
+
+            timer.start();
+            store[deviceKey(devices)]; // Unknown, so only the index is read
+
+            result.insert(QString(name) + "_ms", timer.nsecsElapsed() / 1e6);
+        }
+
+        SessionStore    store(path, nullptr, ACCESS_TOKEN);
+        QVector<qint64> cold, warm, unknown;
+
+        store[deviceKey(devices)];
+
+        for (QVector<qint64> *samples : {&cold, &warm})
+            for (const QString &key : keys) {
+                QElapsedTimer timer;
+                timer.start();
+
+                QMap<QString, OlmSession *> sessions = store[key];
+
+                samples->append(timer.nsecsElapsed());
+
+                if (sessions.isEmpty())
+                    throw std::runtime_error("BENCH device not found");
+            }
+
+        for (int i = 0; i < keys.size(); i++) {
+            QElapsedTimer timer;
+            timer.start();
+
+            store[deviceKey(devices + 1 + i)];
+
+            unknown.append(timer.nsecsElapsed());
+        }
+
+        result.insert("cold", latency(cold));
+        result.insert("cached", latency(warm));
+        result.insert("unknown", latency(unknown));
+
+        return result;
+    }
+
+  private:
+    /**
+     * @brief Has Olm::sendKeys upload a full batch of one time keys, which
+       are then published
+     *
+     * @param elapsed If set, receives the nanoseconds sendKeys took
+     * @return QStringList The uploaded keys
+     */
+    QStringList uploadKeys(qint64 *elapsed = nullptr) {
+        QElapsedTimer timer;
+
+        // As if the server had none left
+        this->m_olm->uploadedOneTimeKeys = 0;
+
+        timer.start();
+        ResponseFuture *future = this->m_olm->sendKeys();
+
+        if (elapsed)
+            *elapsed = timer.nsecsElapsed();
+
+        future->result();
+
+        QStringList keys;
+        QJsonObject uploaded = QJsonDocument::fromJson(this->m_uploaded)
+                                   .object()
+                                   .value("one_time_keys")
+                                   .toObject();
+
+        for (const QJsonValue &key : uploaded)
+            keys.append(key.toObject().value("key").toString());
+
+        return keys;
+    }
+
+    /**
+     * @brief Path of the session store of m_olm
+     *
+     */
+    QString sessionsPath() const {
+        return this->m_client->storeDir.filePath(
+            "sessions_" +
+            QUrl::toPercentEncoding(this->m_client->userId() + "_" +
+                                    this->m_client->deviceId + ".jsonl"));
+    }
+
+    /**
+     * @brief Creates count outbound sessions of a new peer to a new account
+     *
+     */
+    QMap<QString, OlmSession *> sessions(int count) {
+        OlmAccount *                peer   = newAccount();
+        OlmAccount *                target = newAccount();
+        QString                     key    = identityKey(target);
+        QStringList                 keys;
+        QMap<QString, OlmSession *> sessions;
+
+        for (int i = 0; i < count; i++) {
+            if (keys.isEmpty())
+                keys = ::oneTimeKeys(
+                    target, olm_account_max_number_of_one_time_keys(target));
+
+            OlmSession *session = outboundSession(peer, key, keys.takeFirst());
+            sessions.insert(sessionId(session), session);
+        }
+
+        freeAccount(peer);
+        freeAccount(target);
+
+        return sessions;
+    }
+
+    /**
+     * @brief Writes a session store of devices devices, each with sessions,
+       as SessionStore would have appended them
+     *
+     * @return QByteArray The record of a device, newline excluded
+     */
+    QByteArray writeStore(const QString &                    path,
+                          int                                devices,
+                          const QMap<QString, OlmSession *> &sessions) {
+        QFile      file(path);
+        QByteArray record;
+
+        if (!file.open(QFile::WriteOnly | QFile::Truncate))
+            throw std::runtime_error("BENCH could not write session store");
+
+        file.write("{\"\":\"" +
+                   QUuid::createUuid().toByteArray(QUuid::WithoutBraces) +
+                   "\"}\n");
+
+        for (int i = 0; i < devices; i++) {
+            record = storeRecord(deviceKey(i), sessions);
+            file.write(record + "\n");
+        }
+
+        file.close();
+        QFile::remove(path + ".idx");
+
+        return record;
+    }
+
+    QString         m_dir;
+    MockTransport * m_server;
+    Client *        m_client;
+    Olm *           m_olm;
+    QByteArray      m_uploaded; ///< Last /keys/upload body
+};
+
+int main(int argc, char *argv[]) {
+    QCoreApplication   app(argc, argv);
+    QCommandLineParser parser;
+
+    parser.setApplicationDescription(
+        "Times Olm account and session operations against peers created "
+        "locally, and prints the results as JSON.");
+    parser.addHelpOption();
+    parser.addOptions(
+        {{"pre-key", "Pre-key messages to decrypt.", "n", "50"},
+         {"normal", "Normal messages to decrypt.", "n", "1000"},
+         {"iterations",
+          "Timed one time key batches, pickles and unpickles.",
+          "n",
+          "20"},
+         {"sessions", "Sessions of the pickled device.", "n", "100"},
+         {"devices", "Largest session store to look up in.", "n", "10000"},
+         {"lookups", "Lookups per session store size.", "n", "1000"},
+         {"output", "Write the JSON to file rather than stdout.", "file"}});
+    parser.process(app);
+
+    int iterations = parser.value("iterations").toInt();
+    int devices    = parser.value("devices").toInt();
+
+    if (iterations <= 0 || devices <= 0) {
+        fprintf(stderr, "iterations and devices must be positive\n");
+        return 1;
+    }
+
+    // Sessions and keys are logged as they are created
+    QLoggingCategory::setFilterRules("*.debug=false");
+
+    QTemporaryDir dir;
+    QJsonObject   results;
+
+    if (!dir.isValid()) {
+        fprintf(stderr, "Could not create a temporary directory\n");
+        return 1;
+    }
+
+    try {
+        OlmBench   bench(dir.path());
+        QJsonArray lookups;
+
+        results.insert("decrypt",
+                       bench.decrypt(parser.value("pre-key").toInt(),
+                                     parser.value("normal").toInt()));
+        results.insert("one_time_keys", bench.oneTimeKeys(iterations));
+        results.insert(
+            "pickle",
+            bench.pickle(parser.value("sessions").toInt(), iterations));
+
+        // Tenfold steps up to devices
+        for (int size = 10; size < devices; size *= 10)
+            lookups.append(
+                bench.lookup(size, parser.value("lookups").toInt()));
+
+        lookups.append(bench.lookup(devices, parser.value("lookups").toInt()));
+        results.insert("session_lookup", lookups);
+    } catch (const std::runtime_error &error) {
+        fprintf(stderr, "%s\n", error.what());
+        return 1;
+    }
+
+    uint8_t major, minor, patch;
+    olm_get_library_version(&major, &minor, &patch);
+
+    QJsonObject report{
+        {"benchmark", "OlmBench"},
+        {"qt_version", qVersion()},
+        {"olm_version", QString("%1.%2.%3").arg(major).arg(minor).arg(patch)},
+        {"iterations", iterations},
+        {"results", results},
+        {"peak_rss_kib", (qint64) peakRss()}};
+    QByteArray json = QJsonDocument(report).toJson();
+
+    if (!parser.isSet("output")) {
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return 0;
+    }
+
+    QFile output(parser.value("output"));
+
+    if (!output.open(QFile::WriteOnly) || output.write(json) != json.size()) {
+        fprintf(stderr,
+                "Could not write %s: %s\n",
+                qPrintable(output.fileName()),
+                qPrintable(output.errorString()));
+        return 1;
+    }
+
+    return 0;
+}
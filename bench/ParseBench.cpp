@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file ParseBench.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Measures parse time and allocations for a captured /sync response
+ * @version 0.1
+ * @date 2021-03-07
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <cstdio>
+
+#include <MatrixCpp/Responses.hpp>
+
+#include "AllocCounter.hpp"
+
+using namespace MatrixCpp::Bench;
+using namespace MatrixCpp::Responses;
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    QStringList      args = app.arguments();
+
+    if (args.size() < 2) {
+        fprintf(stderr, "Usage: %s <sync.json> [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    QFile capture(args[1]);
+
+    if (!capture.open(QFile::ReadOnly)) {
+        fprintf(stderr,
+                "Could not open %s: %s\n",
+                qPrintable(capture.fileName()),
+                qPrintable(capture.errorString()));
+        return 1;
+    }
+
+    QByteArray body       = capture.readAll();
+    int        iterations = args.size() > 2 ? args[2].toInt() : 10;
+
+    capture.close();
+
+    if (iterations <= 0) {
+        fprintf(stderr, "iterations must be positive\n");
+        return 1;
+    }
+
+    qint64 jsonNs = 0, typedNs = 0;
+    size_t jsonAllocs = 0, typedAllocs = 0;
+
+    for (int i = 0; i < iterations; i++) {
+        QElapsedTimer timer;
+        size_t        allocs = allocationCount();
+
+        // JSON document only
+        timer.start();
+        Response response(body);
+        jsonNs += timer.nsecsElapsed();
+        jsonAllocs += allocationCount() - allocs;
+
+        if (response.isBroken()) {
+            fprintf(stderr, "%s is not valid JSON\n", qPrintable(args[1]));
+            return 1;
+        }
+
+        // Typed objects, built from the already parsed document
+        allocs = allocationCount();
+        timer.restart();
+        SyncResponse sync(response);
+        typedNs += timer.nsecsElapsed();
+        typedAllocs += allocationCount() - allocs;
+    }
+
+    printf("body: %d bytes, %d iterations\n", body.size(), iterations);
+    printf("json parse:  %10.3f ms %12zu allocations\n",
+           jsonNs / 1e6 / iterations,
+           jsonAllocs / iterations);
+    printf("typed parse: %10.3f ms %12zu allocations\n",
+           typedNs / 1e6 / iterations,
+           typedAllocs / iterations);
+
+    return 0;
+}
@@ -0,0 +1,300 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncBench.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Measures each stage of handling generated /sync responses, as JSON
+ * @version 0.1
+ * @date 2021-03-23
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QLoggingCategory>
+#include <cstdio>
+#include <functional>
+
+#include <MatrixCpp/Client.hpp>
+#include <MatrixCpp/Responses.hpp>
+
+#include "AllocCounter.hpp"
+#include "SyncGenerator.hpp"
+
+using namespace MatrixCpp;
+using namespace MatrixCpp::Bench;
+using namespace MatrixCpp::Responses;
+using namespace MatrixCpp::Types;
+
+/**
+ * @brief Gives access to the slots applying a sync response
+ *
+ */
+class BenchClient : public Client {
+  public:
+    using Client::Client;
+    using Client::onRoomJoinUpdate;
+};
+
+/**
+ * @brief Totals of one stage over every iteration
+ *
+ */
+struct Stage {
+    qint64 ns       = 0;  ///< Time spent in the stage
+    qint64 minNs    = -1; ///< Fastest iteration
+    size_t allocs   = 0;  ///< Heap allocations made by the stage
+    qint64 retained = 0;  ///< Bytes still allocated once the stage returned
+
+    /**
+     * @brief Times one iteration of work
+     *
+     */
+    void run(const std::function<void()> &work) {
+        QElapsedTimer timer;
+        size_t        allocs = allocationCount();
+        size_t        bytes  = allocatedBytes();
+
+        timer.start();
+        work();
+
+        qint64 ns = timer.nsecsElapsed();
+
+        this->allocs += allocationCount() - allocs;
+        this->retained += (qint64) allocatedBytes() - (qint64) bytes;
+        this->ns += ns;
+        this->minNs = this->minNs < 0 ? ns : qMin(this->minNs, ns);
+    }
+
+    /**
+     * @brief Get the report of the stage
+     *
+     * @param iterations
+     * @param events Events handled by one iteration
+     */
+    QJsonObject toJson(int iterations, int events) const {
+        return {{"ns_per_iteration", (double) this->ns / iterations},
+                {"min_ns", (double) this->minNs},
+                {"events_per_sec",
+                 this->ns ? events * (double) iterations * 1e9 / this->ns
+                          : 0.0},
+                {"allocations_per_iteration",
+                 (double) this->allocs / iterations},
+                {"allocations_per_event",
+                 events ? (double) this->allocs / iterations / events : 0.0},
+                {"retained_bytes_per_iteration",
+                 (double) this->retained / iterations}};
+    }
+};
+
+/**
+ * @brief Builds the events of every room as Client::applyRoomUpdate would,
+   state first, so that Room::onEvent alone can be timed
+ *
+ */
+static QList<QPair<QString, QList<RoomEvent>>>
+roomEvents(const SyncResponse &sync) {
+    QList<QPair<QString, QList<RoomEvent>>> rooms;
+
+    QMap<QString, RoomUpdate>::const_iterator it = sync.rooms.join.constBegin();
+    for (; it != sync.rooms.join.constEnd(); ++it) {
+        QList<RoomEvent> events;
+
+        for (const StateEvent &event : it.value().state)
+            events.append(event);
+
+        for (const QJsonValue &event :
+             it.value().timeline.value("events").toArray())
+            events.append(RoomEvent(event));
+
+        rooms.append({it.key(), events});
+    }
+
+    return rooms;
+}
+
+/**
+ * @brief Runs every stage on a response of the given shape
+ *
+ * @return QJsonObject The report, null if the generated body did not parse
+ */
+static QJsonObject bench(const SyncShape &shape, int iterations) {
+    SyncCounts counts;
+    QByteArray body = generateSync(shape, &counts);
+
+    Response     response(body);
+    SyncResponse sync(response);
+
+    if (response.isBroken() || sync.isBroken())
+        return {};
+
+    const QJsonValue rawRooms = response.data.toObject().value("rooms");
+
+    const QList<QPair<QString, QList<RoomEvent>>> events = roomEvents(sync);
+
+    Stage decode, syncParse, roomsParse, joinUpdate, onEvent;
+
+    // First iteration is not timed: it fills the registries which every
+    // later response reuses, as a long running client would have them
+    for (int i = -1; i < iterations; i++) {
+        Stage discard;
+
+        // MatrixObj(QByteArray): JSON document only
+        (i < 0 ? discard : decode).run([&]() { Response parsed(body); });
+
+        // SyncResponse::parseData, Rooms::parseData included
+        (i < 0 ? discard : syncParse).run([&]() {
+            SyncResponse typed(response);
+        });
+
+        // Rooms::parseData alone
+        (i < 0 ? discard : roomsParse).run([&]() { Rooms rooms(rawRooms); });
+
+        // Client::onRoomJoinUpdate into a Client without rooms, as an
+        // initial sync. Room::onEvent included
+        {
+            BenchClient client(QUrl("http://localhost"), false);
+            client.persistSync = false;
+
+            (i < 0 ? discard : joinUpdate).run([&]() {
+                client.onRoomJoinUpdate(sync.rooms.join);
+            });
+        }
+
+        // Room::onEvent alone, on already built events
+        {
+            QVector<Room *> rooms;
+
+            for (const QPair<QString, QList<RoomEvent>> &room : events)
+                rooms.append(new Room(room.first));
+
+            (i < 0 ? discard : onEvent).run([&]() {
+                for (int r = 0; r < rooms.size(); r++)
+                    for (const RoomEvent &event : events[r].second)
+                        rooms[r]->onEvent(event);
+            });
+
+            qDeleteAll(rooms);
+        }
+    }
+
+    QJsonObject stages{
+        {"decode", decode.toJson(iterations, counts.total())},
+        {"sync_parse", syncParse.toJson(iterations, counts.total())},
+        {"rooms_parse", roomsParse.toJson(iterations, counts.total())},
+        {"join_update", joinUpdate.toJson(iterations, counts.total())},
+        {"room_on_event", onEvent.toJson(iterations, counts.total())}};
+
+    return {{"shape", shape.toJson()},
+            {"body_bytes", body.size()},
+            {"state_events", counts.stateEvents},
+            {"timeline_events", counts.timelineEvents},
+            {"stages", stages},
+            {"peak_rss_kib", (qint64) peakRss()}};
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication   app(argc, argv);
+    QCommandLineParser parser;
+
+    parser.setApplicationDescription(
+        "Times each stage of handling generated /sync responses and prints "
+        "the results as JSON. Stages: decode (MatrixObj(QByteArray)), "
+        "sync_parse (SyncResponse::parseData, rooms included), rooms_parse "
+        "(Rooms::parseData), join_update (Client::onRoomJoinUpdate, "
+        "Room::onEvent included) and room_on_event (Room::onEvent). "
+        "peak_rss_kib is the peak of the process up to the end of a run, run "
+        "one variant per process to compare them.");
+    parser.addHelpOption();
+    parser.addOptions(
+        {{"rooms", "Joined rooms.", "n", "10"},
+         {"members", "Members of every room.", "n", "100"},
+         {"events", "Timeline events of every room.", "n", "50"},
+         {"event-size", "Body length of messages.", "n", "64"},
+         {"iterations", "Timed iterations of every stage.", "n", "10"},
+         {"variant",
+          "plain-full, plain-lazy, encrypted-full or encrypted-lazy. May be "
+          "repeated, all of them by default.",
+          "name"},
+         {"output", "Write the JSON to file rather than stdout.", "file"}});
+    parser.process(app);
+
+    SyncShape shape;
+    shape.rooms     = parser.value("rooms").toInt();
+    shape.members   = parser.value("members").toInt();
+    shape.events    = parser.value("events").toInt();
+    shape.eventSize = parser.value("event-size").toInt();
+
+    int         iterations = parser.value("iterations").toInt();
+    QStringList variants   = parser.values("variant");
+
+    if (variants.isEmpty())
+        variants = QStringList{
+            "plain-full", "plain-lazy", "encrypted-full", "encrypted-lazy"};
+
+    if (shape.rooms <= 0 || shape.members <= 0 || shape.events < 0 ||
+        iterations <= 0) {
+        fprintf(stderr, "rooms, members and iterations must be positive\n");
+        return 1;
+    }
+
+    // Room logs every member it adds
+    QLoggingCategory::setFilterRules("*.debug=false");
+
+    QJsonArray runs;
+
+    for (const QString &variant : variants) {
+        QStringList parts = variant.split('-');
+
+        if (parts.size() != 2 ||
+            !QStringList{"plain", "encrypted"}.contains(parts[0]) ||
+            !QStringList{"full", "lazy"}.contains(parts[1])) {
+            fprintf(stderr, "Unknown variant %s\n", qPrintable(variant));
+            return 1;
+        }
+
+        shape.encrypted = parts[0] == "encrypted";
+        shape.lazyLoad  = parts[1] == "lazy";
+
+        QJsonObject run = bench(shape, iterations);
+
+        if (run.isEmpty()) {
+            fprintf(stderr,
+                    "Generated %s body does not parse\n",
+                    qPrintable(variant));
+            return 1;
+        }
+
+        run.insert("variant", variant);
+        runs.append(run);
+    }
+
+    QJsonObject report{{"benchmark", "SyncBench"},
+                       {"qt_version", qVersion()},
+                       {"iterations", iterations},
+                       {"runs", runs}};
+    QByteArray  json = QJsonDocument(report).toJson();
+
+    if (!parser.isSet("output")) {
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return 0;
+    }
+
+    QFile output(parser.value("output"));
+
+    if (!output.open(QFile::WriteOnly) || output.write(json) != json.size()) {
+        fprintf(stderr,
+                "Could not write %s: %s\n",
+                qPrintable(output.fileName()),
+                qPrintable(output.errorString()));
+        return 1;
+    }
+
+    return 0;
+}
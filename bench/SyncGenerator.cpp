@@ -0,0 +1,196 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncGenerator.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements the synthetic /sync generator
+ * @version 0.1
+ * @date 2021-03-23
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include "SyncGenerator.hpp"
+
+using namespace MatrixCpp::Bench;
+
+static const QString SERVER = "example.org";
+
+static QString userId(int i) {
+    return QString("@user%1:%2").arg(i).arg(SERVER);
+}
+
+static QJsonObject event(const QString &    type,
+                         const QString &    eventId,
+                         const QString &    sender,
+                         qint64             serverTs,
+                         const QJsonObject &content) {
+    return {{"type", type},
+            {"event_id", eventId},
+            {"sender", sender},
+            {"origin_server_ts", serverTs},
+            {"unsigned", QJsonObject{{"age", 1234}}},
+            {"content", content}};
+}
+
+static QJsonObject stateEvent(const QString &    type,
+                              const QString &    stateKey,
+                              const QString &    eventId,
+                              const QString &    sender,
+                              qint64             serverTs,
+                              const QJsonObject &content) {
+    QJsonObject json = event(type, eventId, sender, serverTs, content);
+
+    json.insert("state_key", stateKey);
+    return json;
+}
+
+/**
+ * @brief Builds the content of a message, encrypted with megolm if asked.
+   Ciphertext has the size a real one would have, its bytes are filler
+ *
+ */
+static QJsonObject messageContent(const SyncShape &shape, int i) {
+    QString body = QString("Message %1 ").arg(i);
+    body += QString(qMax(0, shape.eventSize - body.size()), 'a');
+
+    if (!shape.encrypted)
+        return {{"msgtype", "m.text"}, {"body", body}};
+
+    // Plaintext event, plus base64 and the MAC and signature megolm adds
+    QByteArray plain(body.size() + 128, char('a' + i % 26));
+
+    return {{"algorithm", "m.megolm.v1.aes-sha2"},
+            {"ciphertext",
+             QString(plain.toBase64(QByteArray::OmitTrailingEquals))},
+            {"device_id", "BENCHDEVICE"},
+            {"sender_key", "SmkF0ENXFa6+4k1BsVHKLWe2nCkNjFOcnNkWSq0XhVg"},
+            {"session_id", "/Q1p7KqU1hP7ydsQ4uR8tuTyGPbjVHWYUO9tn4cCz1U"}};
+}
+
+QJsonObject SyncShape::toJson() const {
+    return {{"rooms", this->rooms},
+            {"members", this->members},
+            {"events", this->events},
+            {"event_size", this->eventSize},
+            {"encrypted", this->encrypted},
+            {"lazy_load", this->lazyLoad}};
+}
+
+QByteArray MatrixCpp::Bench::generateSync(const SyncShape &shape,
+                                          SyncCounts *     counts) {
+    SyncCounts  total;
+    QJsonObject join;
+    qint64      serverTs = 1614556800000; // 2021-03-01
+
+    // Lazy loading sends the members which sent a timeline event
+    int stateMembers = shape.lazyLoad ? qMin(shape.members, shape.events)
+                                      : shape.members;
+
+    for (int r = 0; r < shape.rooms; r++) {
+        QString    roomId  = QString("!room%1:%2").arg(r).arg(SERVER);
+        QString    suffix  = QString("_%1:%2").arg(r).arg(SERVER);
+        QString    creator = userId(0);
+        QJsonArray state, timeline;
+
+        state.append(stateEvent("m.room.create",
+                                "",
+                                "$create" + suffix,
+                                creator,
+                                serverTs,
+                                {{"creator", creator}}));
+        state.append(stateEvent("m.room.join_rules",
+                                "",
+                                "$join_rules" + suffix,
+                                creator,
+                                serverTs,
+                                {{"join_rule", "public"}}));
+        state.append(stateEvent(
+            "m.room.power_levels",
+            "",
+            "$power_levels" + suffix,
+            creator,
+            serverTs,
+            {{"users", QJsonObject{{creator, 100}}}, {"users_default", 0}}));
+        state.append(stateEvent("m.room.name",
+                                "",
+                                "$name" + suffix,
+                                creator,
+                                serverTs,
+                                {{"name", QString("Room %1").arg(r)}}));
+
+        if (shape.encrypted)
+            state.append(
+                stateEvent("m.room.encryption",
+                           "",
+                           "$encryption" + suffix,
+                           creator,
+                           serverTs,
+                           {{"algorithm", "m.megolm.v1.aes-sha2"}}));
+
+        for (int m = 0; m < stateMembers; m++) {
+            QString member = userId(m);
+
+            state.append(stateEvent(
+                "m.room.member",
+                member,
+                QString("$member%1").arg(m) + suffix,
+                member,
+                serverTs + m,
+                {{"membership", "join"},
+                 {"displayname", QString("User %1").arg(m)},
+                 {"avatar_url",
+                  QString("mxc://%1/avatar%2").arg(SERVER).arg(m)}}));
+        }
+
+        for (int e = 0; e < shape.events; e++)
+            timeline.append(
+                event(shape.encrypted ? "m.room.encrypted" : "m.room.message",
+                      QString("$event%1").arg(e) + suffix,
+                      userId(e % qMax(1, shape.members)),
+                      serverTs + shape.members + e,
+                      messageContent(shape, e)));
+
+        QJsonObject room{
+            {"state", QJsonObject{{"events", state}}},
+            {"timeline",
+             QJsonObject{{"events", timeline},
+                         {"limited", true},
+                         {"prev_batch", QString("t%1_batch").arg(r)}}},
+            {"unread_notifications",
+             QJsonObject{{"highlight_count", 0},
+                         {"notification_count", shape.events}}}};
+
+        // Lazy loading servers summarize the members they left out
+        if (shape.lazyLoad) {
+            QJsonArray heroes;
+
+            for (int m = 1; m < qMin(shape.members, 6); m++)
+                heroes.append(userId(m));
+
+            room.insert("summary",
+                        QJsonObject{{"m.heroes", heroes},
+                                    {"m.joined_member_count", shape.members},
+                                    {"m.invited_member_count", 0}});
+        }
+
+        join.insert(roomId, room);
+
+        total.stateEvents += state.size();
+        total.timelineEvents += timeline.size();
+    }
+
+    if (counts)
+        *counts = total;
+
+    QJsonObject sync{{"next_batch", "s1_bench"},
+                     {"rooms", QJsonObject{{"join", join}}},
+                     {"device_one_time_keys_count",
+                      QJsonObject{{"signed_curve25519", 50}}}};
+
+    return QJsonDocument(sync).toJson(QJsonDocument::Compact);
+}
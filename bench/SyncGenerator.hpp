@@ -0,0 +1,69 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncGenerator.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Generates synthetic /sync response bodies for benchmarks
+ * @version 0.1
+ * @date 2021-03-23
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QJsonObject>
+
+namespace MatrixCpp::Bench {
+/**
+ * @brief Shape of a generated /sync response
+ *
+ */
+struct SyncShape {
+    int  rooms     = 10;    ///< Joined rooms
+    int  members   = 100;   ///< Members of every room
+    int  events    = 50;    ///< Timeline events of every room
+    int  eventSize = 64;    ///< Body length of messages, before encryption
+    bool encrypted = false; ///< Whether messages are m.room.encrypted
+    /**
+     * @brief Whether the state only has the members which sent a timeline
+       event, as with lazy_load_members, rather than every member
+     *
+     */
+    bool lazyLoad = false;
+
+    /**
+     * @brief Get the shape as JSON, for reports
+     *
+     * @return QJsonObject
+     */
+    QJsonObject toJson() const;
+};
+
+/**
+ * @brief Counts of what a generated response holds
+ *
+ */
+struct SyncCounts {
+    int stateEvents    = 0; ///< State events of every room
+    int timelineEvents = 0; ///< Timeline events of every room
+
+    int total() const {
+        return this->stateEvents + this->timelineEvents;
+    }
+};
+
+/**
+ * @brief Builds the body of an initial /sync response of the given shape.
+   Rooms have a creation, join rules, power levels and name event, plus
+   m.room.encryption if encrypted, then their members. Senders of messages
+   cycle through the members. The same shape always gives the same body
+ *
+ * @param shape
+ * @param counts Set to what the body holds, if not null
+ * @return QByteArray Compact JSON
+ */
+QByteArray generateSync(const SyncShape &shape, SyncCounts *counts = nullptr);
+} // namespace MatrixCpp::Bench
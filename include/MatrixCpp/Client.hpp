@@ -14,11 +14,18 @@
 #pragma once
 
 #include <QDir>
-#include <QNetworkAccessManager>
+#include <QMap>
+#include <QSet>
+#include <QThreadPool>
+#include <QTimer>
 #include <QUrl>
 #include <QUrlQuery>
+#include <QVariantMap>
+#include <QVector>
 
+#include <MatrixCpp/Filter.hpp>
 #include <MatrixCpp/Responses.hpp>
+#include <MatrixCpp/Transport.hpp>
 #include <MatrixCpp/Types.hpp>
 #include <MatrixCpp/export.hpp>
 
@@ -27,6 +34,114 @@ namespace MatrixCpp {
 namespace Crypto {
 class Olm;
 }
+class SyncPipeline;
+class SyncRecorder;
+class RequestMetrics;
+class FilterCache;
+
+// Defined in SyncReplay.hpp, which includes this file
+class PUBLIC SyncReplay;
+
+/**
+ * @brief Time spent by sync responses in each stage of the sync pipeline,
+   summed since the last reset. Times are in microseconds
+ *
+ */
+struct PUBLIC SyncStats {
+    quint64 syncs     = 0; ///< Committed responses
+    qint64  queued    = 0; ///< Waiting for a worker thread
+    qint64  decoded   = 0; ///< Decoding JSON, on a worker thread
+    qint64  parsed    = 0; ///< Building typed objects, on a worker thread
+    qint64  reordered = 0; ///< Waiting for earlier responses to be committed
+    qint64  committed = 0; ///< Applying responses, on the Client thread
+
+    /**
+     * @brief Longest single commit, i.e. longest the Client thread was
+       blocked by a sync response
+     *
+     */
+    qint64 maxCommitted = 0;
+};
+
+/**
+ * @brief Distribution of a request phase duration, in microseconds
+ *
+ */
+struct PUBLIC LatencyHistogram {
+    /**
+     * @brief Samples per bucket: counts[i] holds the samples at most
+       bounds()[i] and above the previous bound, the last one those above
+       every bound
+     *
+     */
+    QVector<quint64> counts;
+
+    quint64 samples = 0; ///< Number of samples
+    qint64  sum     = 0; ///< Sum of the samples
+    qint64  max     = 0; ///< Longest sample
+
+    /**
+     * @brief Adds a sample
+     *
+     * @param us Microseconds
+     */
+    void add(qint64 us);
+
+    /**
+     * @brief Get the upper bounds of the buckets, from 5 ms to 60 s so that
+       long polling /sync requests still fall in one
+     *
+     * @return const QVector<qint64>& Microseconds, ascending
+     */
+    static const QVector<qint64> &bounds();
+};
+
+/**
+ * @brief Requests made to an endpoint by a Client, see
+   Client::requestStats()
+ *
+ */
+struct PUBLIC EndpointStats {
+    QString method; ///< GET or POST
+
+    /**
+     * @brief Path template, in which room, user and event ids and other
+       parameters are written as {name}, e.g.
+       /_matrix/client/r0/rooms/{roomId}/messages
+     *
+     */
+    QString endpoint;
+
+    quint64 requests      = 0; ///< Finished requests, aborted ones included
+    quint64 requestBytes  = 0; ///< Sent in request bodies
+    quint64 responseBytes = 0; ///< Received in response bodies
+
+    /**
+     * @brief Time until the request body was sent, i.e. spent waiting for a
+       connection and uploading. Qt 5 does not report when a request without
+       body leaves its queue, so only requests with one are sampled
+     *
+     */
+    LatencyHistogram queue;
+
+    /**
+     * @brief Time until the first response headers or data, for requests
+       which got any
+     *
+     */
+    LatencyHistogram ttfb;
+
+    LatencyHistogram total; ///< Time until the request finished
+
+    QMap<int, quint64> statuses; ///< HTTP status code to number of responses
+
+    /**
+     * @brief QNetworkReply::NetworkError to number of requests, for requests
+       which got no HTTP status, e.g. unreachable host or aborted
+     *
+     */
+    QMap<int, quint64> networkErrors;
+};
 
 /**
  * @brief A Matrix Client
@@ -61,13 +176,23 @@ class PUBLIC Client : public QObject {
                     QObject *   parent     = nullptr);
 
     /**
-     * @brief (sync) Request for well_known and update the client
+     * @brief Destroy the Client object, writing a pending sync snapshot
+     *
+     */
+    ~Client();
+
+    /**
+     * @brief (sync) Request for well_known and update the client. This spins
+       a nested event loop, so event-driven code should rather use
+       getDiscovery()->then()
      *
      */
     void loadDiscovery();
 
     /**
-     * @brief Load given info to the Client
+     * @brief Load given info to the Client. If persistSync is set and a sync
+       snapshot of this user and device is in storeDir, rooms and the sync
+       position are loaded from it, so the next sync is incremental
      *
      * @param userId *Fully qualified* user id
      * @param deviceId A valid and existing device id
@@ -139,6 +264,163 @@ class PUBLIC Client : public QObject {
                                     Presence       presence  = PRESENCE_ONLINE,
                                     int            timeout   = 0);
 
+    /**
+     * @brief (async) Performs a sync request with a typed filter. The filter
+       is uploaded in the background the first time it is used and passed by
+       ID afterwards, even across restarts. Until the upload is done, it is
+       passed inline
+     *
+     * @param filter
+     * @param since A point in time to continue a sync from
+     * @param fullState Controls whether to include the full state for all rooms
+       the user is a member of
+     * @param presence Desired presence to set on sync request
+     * @param timeout The maximum time to wait, in milliseconds, before
+       returning this request
+     * @return Responses::ResponseFuture
+     */
+    Responses::ResponseFuture *sync(const Filter & filter,
+                                    const QString &since     = "",
+                                    bool           fullState = false,
+                                    Presence       presence  = PRESENCE_ONLINE,
+                                    int            timeout   = 0);
+
+    /**
+     * @brief (async) Uploads a filter. Its ID is cached, see sync()
+     *
+     * @param filter
+     * @return Responses::ResponseFuture
+     */
+    Responses::ResponseFuture *uploadFilter(const Filter &filter);
+
+    /**
+     * @brief (async) Get a page of the events of a room. See
+       Room::paginateBack() for pagination on top of its timeline
+     *
+     * @param roomId
+     * @param from Token to paginate from, e.g. a prev_batch
+     * @param backwards Paginate towards older events, or newer ones
+     * @param limit Maximum number of events to return
+     * @param to Token to stop at, if any
+     * @return Responses::ResponseFuture
+     */
+    Responses::ResponseFuture *getMessages(const QString &roomId,
+                                           const QString &from,
+                                           bool           backwards = true,
+                                           int            limit     = 10,
+                                           const QString &to        = "");
+
+    /**
+     * @brief Starts a continuous sync loop. One long-poll sync request is kept
+       outstanding at all times, and the next one is issued as soon as the
+       next_batch of the previous response is known, before its rooms and
+       events are applied
+     *
+     * @param filter Filter id or plain JSON for the filter
+     * @param presence Desired presence to set on every sync request
+     */
+    void startSync(const QString &filter   = "",
+                   Presence       presence = PRESENCE_ONLINE);
+
+    /**
+     * @brief Same as above, with a typed filter (see sync())
+     *
+     * @param filter
+     * @param presence Desired presence to set on every sync request
+     */
+    void startSync(const Filter &filter, Presence presence = PRESENCE_ONLINE);
+
+    /**
+     * @brief Stops the sync loop and aborts the outstanding sync request, if
+       any
+     *
+     */
+    void stopSync();
+
+    /**
+     * @brief Pauses the sync loop. The outstanding request is still applied
+       when it completes, but no new request is issued until resumeSync()
+     *
+     */
+    void pauseSync();
+
+    /**
+     * @brief Resumes a paused sync loop
+     *
+     */
+    void resumeSync();
+
+    /**
+     * @brief Whether the sync loop is running (paused or not)
+     *
+     * @return true
+     * @return false
+     */
+    bool isSyncing() const;
+
+    /**
+     * @brief Get the stage timings of sync responses parsed by worker threads
+       (see syncThreads)
+     *
+     * @return SyncStats
+     */
+    SyncStats syncStats() const;
+
+    /**
+     * @brief Clears the timings returned by syncStats()
+     *
+     */
+    void resetSyncStats();
+
+    /**
+     * @brief Get what was measured of the requests made so far, per
+       endpoint. Requests are accounted for once finished
+     *
+     * @return QList<EndpointStats> Sorted by endpoint, then method
+     */
+    QList<EndpointStats> requestStats() const;
+
+    /**
+     * @brief Clears the measures returned by requestStats()
+     *
+     */
+    void resetRequestStats();
+
+    /**
+     * @brief Exports requestStats() in the Prometheus text exposition
+       format, to be served on a /metrics endpoint. Durations are in seconds
+     *
+     * @return QByteArray
+     */
+    QByteArray prometheusMetrics() const;
+
+    /**
+     * @brief Writes the raw body of every later /sync response to a capture
+       file at path, compressed and with its next_batch and prev_batch tokens
+       redacted, until stopRecording(). A capture is fed back through the
+       Client by SyncReplay. Everything else, such as messages of
+       unencrypted rooms, is written as received
+     *
+     * @param path Replaced if it exists
+     * @return true
+     * @return false path could not be opened
+     */
+    bool startRecording(const QString &path);
+
+    /**
+     * @brief Stops writing /sync responses and closes the capture file
+     *
+     */
+    void stopRecording();
+
+    /**
+     * @brief Whether /sync responses are being recorded
+     *
+     * @return true
+     * @return false
+     */
+    bool isRecording() const;
+
     /**
      * @brief HTTP get request to specified path on homeserver
      *
@@ -174,13 +456,139 @@ class PUBLIC Client : public QObject {
      */
     QString accessToken() const;
 
+    /**
+     * @brief Gets the next_batch of the last applied sync response
+     *
+     * @return QString
+     */
+    QString nextBatch() const;
+
+    /**
+     * @brief Gets the Transport requests are sent through
+     *
+     * @return Transport*
+     */
+    Transport *transport() const;
+
+    /**
+     * @brief Sends later requests through transport, e.g. a MockTransport.
+       The Client takes ownership of transport if it has no parent, and
+       deletes the previous one if it owned it. Ongoing requests are not
+       affected
+     *
+     * @param transport
+     */
+    void setTransport(Transport *transport);
+
     // Public variables
 
     QUrl homeserverUrl; ///< Current homeserver URL this Client is associated
-    QMap<QString, Types::Room *> rooms;    ///< Rooms this Client is associated
-    QString                      deviceId; ///< Device ID
+    QHash<Types::Identifier, Types::Room *> rooms; ///< Rooms of this Client
+    QString deviceId; ///< Device ID
     QDir storeDir; ///< Store directory for encryption keys
 
+    /**
+     * @brief Long-poll timeout used by the sync loop, in milliseconds
+     *
+     */
+    int syncTimeout = 30000;
+
+    /**
+     * @brief Upper bound for the delay between failed sync loop requests, in
+       milliseconds
+     *
+     */
+    int syncMaxRetryDelay = 60000;
+
+    /**
+     * @brief Parse sync responses while they are downloaded, applying every
+       joined room as soon as it is complete. Keeps peak memory proportional
+       to the largest room instead of the whole response. A sync failing
+       midway may have applied some rooms, but does not advance next_batch,
+       and the events its retry delivers again are skipped. Note that
+       Response objects returned by sync() will then have no joined rooms
+     *
+     */
+    bool streamSync = false;
+
+    /**
+     * @brief Worker threads decoding and parsing sync responses, so that only
+       applying them blocks the Client thread. Responses are still applied in
+       request order. 0 parses them on the Client thread. Not used along with
+       streamSync
+     *
+     */
+    int syncThreads = 2;
+
+    /**
+     * @brief Threads applying the joined rooms of a sync response
+       concurrently, the Client thread included. Events of a room are still
+       applied in order, by one thread. Room::onEvent and EventRegistry
+       handlers then run on worker threads, and Room::changed is emitted once
+       every room is done. 1 or less applies rooms one by one
+     *
+     */
+    int applyThreads = 1;
+
+    /**
+     * @brief Sections and event types to parse from sync responses. Skipped
+       events are never built, nor applied to rooms
+     *
+     */
+    ParseFilter parseFilter;
+
+    /**
+     * @brief Save next_batch and the state of every room to storeDir after
+       sync responses are applied, and load them back on restore()
+     *
+     */
+    bool persistSync = true;
+
+    /**
+     * @brief Delay between an applied sync response and the snapshot being
+       written, in milliseconds. Responses applied meanwhile are written
+       together
+     *
+     */
+    int persistDelay = 1000;
+
+    /**
+     * @brief Timeline events each Room keeps, see Room::timeline(). Applies
+       to rooms created afterwards, see Room::setTimelineLimits()
+     *
+     */
+    int timelineMaxEvents = 500;
+
+    /**
+     * @brief Approximate size in bytes of the timeline each Room keeps.
+       Applies to rooms created afterwards
+     *
+     */
+    qint64 timelineMaxBytes = 1 << 20;
+
+    /**
+     * @brief Approximate size in bytes of the timelines of every Room. Once
+       exceeded after a sync, whole timelines of the least recently used
+       rooms are dropped. 0 does not bound them
+     *
+     */
+    qint64 timelineBudget = 64 << 20;
+
+    /**
+     * @brief Fill the gaps left in timelines by limited sync responses with
+       /messages, up to the events each Room keeps (see Room::fillGaps())
+     *
+     */
+    bool fillTimelineGaps = false;
+
+    /**
+     * @brief How close to the oldest loaded event, in events, a consumer
+       must scroll for the next page to be prefetched. 0 disables prefetch,
+       see Room::scrolledTo()
+     *
+     */
+    int prefetchDistance = 0;
+
   signals:
     /**
      * @brief When fired, will stop all ongoing requests
@@ -188,6 +596,15 @@ class PUBLIC Client : public QObject {
      */
     void abortRequests();
 
+    /**
+     * @brief Emitted for every to-device event received by sync. Olm
+       encrypted events are emitted once decrypted, which may be after later
+       events of other senders
+     *
+     * @param event
+     */
+    void toDeviceEvent(Types::ToDeviceEvent event);
+
   protected slots:
     /**
      * @brief Sets Client properties properly from login response
@@ -217,7 +634,131 @@ class PUBLIC Client : public QObject {
      */
     void onRoomJoinUpdate(const QMap<QString, Types::RoomUpdate> &roomsUpdates);
 
+    /**
+     * @brief Emits plain to-device events and queues encrypted ones for
+       decryption
+     *
+     * @param events
+     */
+    void onToDeviceEvents(const QList<Types::ToDeviceEvent> &events);
+
+    /**
+     * @brief Applies an encrypted event whose room key arrived after it
+     *
+     * @param roomId
+     * @param event
+     */
+    void onRoomEventDecrypted(QString roomId, Types::RoomEvent event);
+
+    /**
+     * @brief Applies the state and timeline of update to room
+     *
+     * @param room
+     * @param update
+     */
+    void applyRoomUpdate(Types::Room *room, const Types::RoomUpdate &update);
+
   private:
+    friend class Types::Room;
+    friend class SyncReplay;
+
+    /**
+     * @brief Sets Client properties properly from sync response
+     *
+     * @param response
+     * @param live false for a replayed response, which only updates next
+       batch and rooms: no request, gap fill, decryption or snapshot follows
+     */
+    void applySyncResponse(const Responses::SyncResponse &response, bool live);
+
+    /**
+     * @brief Updates our rooms based on roomUpdate
+     *
+     * @param roomsUpdates
+     * @param live false for a replayed response, whose gaps are not filled
+     */
+    void
+    applyRoomJoinUpdate(const QMap<QString, Types::RoomUpdate> &roomsUpdates,
+                        bool                                     live);
+
+    /**
+     * @brief Decrypts a timeline event and checks parseFilter against it
+     *
+     * @param room
+     * @param event Decrypted in place
+     * @param held Set to whether event waits for its room key, in which case
+       onRoomEventDecrypted will get it
+     * @return true
+     * @return false event is filtered out or could not be decrypted
+     */
+    bool prepareTimelineEvent(Types::Room *     room,
+                              Types::RoomEvent &event,
+                              bool *            held);
+
+    /**
+     * @brief Builds and sends a sync request, without updating the Client
+       when it completes
+     *
+     * @return Responses::ResponseFuture
+     */
+    Responses::ResponseFuture *syncRequest(const QString &filter,
+                                           const QString &since,
+                                           bool           fullState,
+                                           Presence       presence,
+                                           int            timeout);
+
+    /**
+     * @brief Starts the sync loop with the filter already set
+     *
+     * @param presence
+     */
+    void startSyncLoop(Presence presence);
+
+    /**
+     * @brief Issues the next request of the sync loop
+     *
+     */
+    void syncNext();
+
+    /**
+     * @brief Drops the timelines of the least recently used rooms until they
+       all fit in timelineBudget
+     *
+     */
+    void trimTimelines();
+
+    /**
+     * @brief Writes the sync snapshot now
+     *
+     */
+    void saveSnapshot();
+
+    /**
+     * @brief Path of the sync snapshot of this user and device
+     *
+     * @return QString
+     */
+    QString snapshotPath() const;
+
+    /**
+     * @brief Get the value of the filter query parameter for filter. Uploads
+       filter in background if it was not yet
+     *
+     * @param filter
+     * @return QString Filter ID, or filter JSON
+     */
+    QString filterParam(const Filter &filter);
+
+    /**
+     * @brief Calls callback with the parsed response when future finishes,
+       parsing it on the sync pipeline when enabled
+     *
+     * @param future A sync request
+     * @param callback Called on the Client thread
+     */
+    void applySync(Responses::ResponseFuture *                   future,
+                   std::function<void(Responses::SyncResponse)> callback);
+
     /**
      * @brief HTTP get request to specified URL
      *
@@ -235,12 +776,40 @@ class PUBLIC Client : public QObject {
      */
     Responses::ResponseFuture *send(QUrl url, QVariantMap data) const;
 
-    QNetworkAccessManager *m_nam;
+    Transport *m_transport;
 
     QString      m_userId;
     QString      m_accessToken;
     QString      m_nextBatch;
     bool         m_encryption;
     Crypto::Olm *m_olm = nullptr;
+
+    SyncPipeline *m_syncPipeline;
+    QThreadPool   m_applyPool;
+    QTimer        m_snapshotTimer;
+    SyncRecorder *m_recorder = nullptr;
+
+    RequestMetrics *m_requestMetrics;
+
+    /**
+     * @brief Profiles of the members of every Room, stored once however many
+       rooms a user is in. Shared with the rooms, which may outlive it
+     *
+     */
+    QSharedPointer<Types::UserRegistry> m_userRegistry =
+        QSharedPointer<Types::UserRegistry>::create();
+
+    FilterCache *    m_filterCache = nullptr;
+    QSet<QByteArray> m_uploadingFilters; ///< Hashes of filters being uploaded
+
+    // Sync loop
+    Responses::ResponseFuture *m_syncFuture = nullptr;
+    QString                    m_syncFilter;
+    Filter                     m_syncTypedFilter;
+    bool                       m_syncTyped = false;
+    Presence                   m_syncPresence = PRESENCE_ONLINE;
+    bool                       m_syncing      = false;
+    bool                       m_syncPaused   = false;
+    int                        m_syncFailures = 0;
 };
 } // namespace MatrixCpp
\ No newline at end of file
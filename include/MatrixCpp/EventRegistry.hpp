@@ -0,0 +1,135 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file EventRegistry.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares EventRegistry, which maps event type strings to Event::Type
+ * @version 0.1
+ * @date 2021-03-08
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QDebug>
+#include <QHash>
+#include <QReadWriteLock>
+#include <QVector>
+#include <functional>
+
+#include <MatrixCpp/Types.hpp>
+#include <MatrixCpp/export.hpp>
+
+namespace MatrixCpp::Types {
+/**
+ * @brief Process-wide registry of event types
+ *
+ * Core types are resolved by a compile-time perfect hash. Types registered by
+ * applications get an Event::Type starting at Event::M_CUSTOM and, optionally,
+ * a handler called by Room::onEvent. Events of a core or registered type
+ * share one type string. Core types are resolved without locking.
+ * Thread-safe.
+ */
+class PUBLIC EventRegistry {
+  public:
+    /**
+     * @brief Called by Room::onEvent for events of a registered type
+     *
+     */
+    using Handler = std::function<void(Room *room, const RoomEvent &event)>;
+
+    /**
+     * @brief Get the registry instance
+     *
+     * @return EventRegistry&
+     */
+    static EventRegistry &instance();
+
+    /**
+     * @brief Registers an event type. Registering a core type only sets its
+       handler, which is called after Room's own processing
+     *
+     * @param typeName e.g. com.example.custom
+     * @param handler Called by Room::onEvent for this type, if any
+     * @return Event::Type The type events of typeName will have
+     */
+    Event::Type registerType(const QString &typeName,
+                             Handler        handler = nullptr);
+
+    /**
+     * @brief Registers an event type whose content is parsed as Content
+       before calling handler. Events with broken content are skipped
+     *
+     * @tparam Content A MatrixObj subclass
+     * @param typeName e.g. com.example.custom
+     * @param handler
+     * @return Event::Type The type events of typeName will have
+     */
+    template <class Content>
+    Event::Type registerType(
+        const QString &typeName,
+        std::function<void(Room *, const RoomEvent &, const Content &)>
+            handler);
+
+    /**
+     * @brief Resolves a type string
+     *
+     * @param typeName
+     * @param interned If set, receives the interned copy of typeName, or
+       typeName itself for unknown types, which are not kept
+     * @return Event::Type M_OTHER if the type is unknown
+     */
+    Event::Type lookup(const QString &typeName, QString *interned = nullptr);
+
+    /**
+     * @brief Get the handler for type, if any
+     *
+     * @param type
+     * @return Handler
+     */
+    Handler handler(Event::Type type) const;
+
+  private:
+    EventRegistry() = default;
+
+    /**
+     * @brief Resolves core types without locking
+     *
+     * @param typeName
+     * @param interned If set, receives the static name of a core type
+     * @return Event::Type M_OTHER if not a core type
+     */
+    static Event::Type coreType(const QString &typeName,
+                                QString *      interned = nullptr);
+
+    mutable QReadWriteLock m_lock;
+    QHash<int, Handler>    m_handlers; ///< Handlers by type
+    int                    m_nextType = Event::M_CUSTOM;
+
+    /**
+     * @brief Registered types. Keys are Identifier strings, so lookup()
+       shares them
+     *
+     */
+    QHash<QString, int> m_types;
+};
+
+template <class Content>
+Event::Type EventRegistry::registerType(
+    const QString &                                                 typeName,
+    std::function<void(Room *, const RoomEvent &, const Content &)> handler) {
+    return this->registerType(
+        typeName, [=](Room *room, const RoomEvent &event) {
+            Content content(event.content);
+
+            if (content.isBroken()) {
+                qWarning() << "EVENT broken content for" << event.typeName;
+                return;
+            }
+
+            handler(room, event, content);
+        });
+}
+} // namespace MatrixCpp::Types
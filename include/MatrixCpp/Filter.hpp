@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file Filter.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares sync filter builders and client-side parse filters
+ * @version 0.1
+ * @date 2021-03-17
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QJsonObject>
+#include <QSet>
+#include <QStringList>
+
+#include <MatrixCpp/export.hpp>
+
+namespace MatrixCpp {
+/**
+ * @brief Filters events by type and sender. Empty lists and negative limits
+   are left out of the filter, i.e. they do not restrict anything
+ *
+ */
+class PUBLIC EventFilter {
+  public:
+    /**
+     * @brief Serializes this filter as in the filter API
+     *
+     * @return QJsonObject
+     */
+    QJsonObject toJson() const;
+
+    int limit = -1; ///< Maximum number of events to return
+
+    /**
+     * @brief Event types to include. A '*' can be used as a wildcard
+     *
+     */
+    QStringList types;
+    QStringList notTypes;   ///< Event types to exclude, wins over types
+    QStringList senders;    ///< Senders to include
+    QStringList notSenders; ///< Senders to exclude, wins over senders
+};
+
+/**
+ * @brief Filters room events, which can also be filtered by room
+ *
+ */
+class PUBLIC RoomEventFilter : public EventFilter {
+  public:
+    /**
+     * @brief Serializes this filter as in the filter API
+     *
+     * @return QJsonObject
+     */
+    QJsonObject toJson() const;
+
+    QStringList rooms;    ///< Room IDs to include
+    QStringList notRooms; ///< Room IDs to exclude, wins over rooms
+
+    /**
+     * @brief Only send membership events of senders of returned events
+       (state filter only)
+     *
+     */
+    bool lazyLoadMembers = false;
+
+    /**
+     * @brief With lazyLoadMembers, send membership events even if the server
+       thinks we already have them
+     *
+     */
+    bool includeRedundantMembers = false;
+};
+
+/**
+ * @brief Filters what is returned for rooms
+ *
+ */
+class PUBLIC RoomFilter {
+  public:
+    /**
+     * @brief Serializes this filter as in the filter API
+     *
+     * @return QJsonObject
+     */
+    QJsonObject toJson() const;
+
+    QStringList rooms;    ///< Room IDs to include, for every section
+    QStringList notRooms; ///< Room IDs to exclude, for every section
+    bool includeLeave = false; ///< Include rooms the user has left
+
+    RoomEventFilter timeline;    ///< Events of the timeline
+    RoomEventFilter state;       ///< State events
+    RoomEventFilter ephemeral;   ///< Ephemeral events, e.g. typing
+    RoomEventFilter accountData; ///< Per-room account data
+};
+
+/**
+ * @brief A sync filter
+ *
+ * Can be given to Client::sync() and Client::startSync(), which upload it
+ * once and then only pass its ID.
+ */
+class PUBLIC Filter {
+  public:
+    /**
+     * @brief Serializes this filter as in the filter API. Output is compact
+       and keys are sorted, so equal filters give equal bytes
+     *
+     * @return QByteArray
+     */
+    QByteArray toJson() const;
+
+    /**
+     * @brief Hash of toJson(), which identifies the filter
+     *
+     * @return QByteArray Hex-encoded SHA-256
+     */
+    QByteArray hash() const;
+
+    RoomFilter  room;        ///< What to return for rooms
+    EventFilter presence;    ///< Presence events to return
+    EventFilter accountData; ///< Global account data to return
+
+    bool includePresence    = true; ///< Whether to return presence at all
+    bool includeAccountData = true; ///< Whether to return account data at all
+
+    /**
+     * @brief Fields of events to return, e.g. content.body. Empty returns
+       every field
+     *
+     */
+    QStringList eventFields;
+};
+
+/**
+ * @brief Client-side filter applied while sync responses are parsed
+ *
+ * Events of unwanted sections or types are skipped before any Event is built
+ * for them. m.room.encrypted timeline and to-device events are always kept,
+ * since their type is only known once decrypted; decrypted timeline events
+ * are filtered then.
+ */
+class PUBLIC ParseFilter {
+  public:
+    /**
+     * @brief Sections of a sync response
+     *
+     */
+    enum Section {
+        SECTION_STATE        = 1 << 0, ///< Room state
+        SECTION_TIMELINE     = 1 << 1, ///< Room timeline
+        SECTION_EPHEMERAL    = 1 << 2, ///< Room ephemeral events
+        SECTION_ROOM_ACCOUNT = 1 << 3, ///< Room account data
+        SECTION_PRESENCE     = 1 << 4, ///< Presence
+        SECTION_ACCOUNT_DATA = 1 << 5, ///< Global account data
+        SECTION_TO_DEVICE    = 1 << 6, ///< To-device events
+        SECTION_ALL          = 0x7f
+    };
+
+    /**
+     * @brief Whether events of section are wanted at all
+     *
+     * @param section
+     * @return true
+     * @return false
+     */
+    bool wants(Section section) const;
+
+    /**
+     * @brief Whether an event of type in section is wanted
+     *
+     * @param section
+     * @param type
+     * @return true
+     * @return false
+     */
+    bool accepts(Section section, const QString &type) const;
+
+    /**
+     * @brief Whether a raw event in section is wanted. Only its type is read
+     *
+     * @param section
+     * @param event
+     * @return true
+     * @return false
+     */
+    bool keeps(Section section, const QJsonValue &event) const;
+
+    int sections = SECTION_ALL; ///< Wanted sections, ORed
+
+    /**
+     * @brief Wanted event types, for every section. Empty wants every type
+     *
+     */
+    QSet<QString> types;
+};
+} // namespace MatrixCpp
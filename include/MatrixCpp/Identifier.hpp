@@ -0,0 +1,124 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file Identifier.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares Identifier, an interned matrix ID
+ * @version 0.1
+ * @date 2021-03-19
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QDebug>
+#include <QString>
+
+#include <MatrixCpp/export.hpp>
+
+namespace MatrixCpp::Types {
+// Interned ID, private
+struct IdentifierEntry;
+
+/**
+ * @brief An interned string which recurs across a session, e.g. a user,
+   room or device ID, a device key, or an event type
+ *
+ * Every distinct string is stored once, as UTF-8 and as a QString, in a
+ * process-wide table along with its hash. An Identifier is a single pointer
+ * into that table, so copies are free, equality is a pointer comparison and
+ * hashing reads the precomputed value. Interned strings are never freed, thus
+ * memory is bounded by the distinct strings seen: event IDs, which are new for
+ * every event, and profiles, which change, are kept as plain strings instead
+ * (see UserRegistry). Thread-safe.
+ */
+class PUBLIC Identifier {
+  public:
+    /**
+     * @brief Construct a null Identifier, equal to any empty one
+     *
+     */
+    Identifier(){};
+
+    /**
+     * @brief Construct an Identifier, interning id if it is new
+     *
+     * @param id
+     */
+    Identifier(const QString &id);
+
+    /**
+     * @brief Construct an Identifier from an ID already in UTF-8
+     *
+     * @param utf8
+     * @return Identifier
+     */
+    static Identifier fromUtf8(const QByteArray &utf8);
+
+    /**
+     * @brief Get the ID as a string, sharing the interned copy
+     *
+     * @return QString
+     */
+    QString toString() const;
+
+    /**
+     * @brief Get the interned UTF-8 ID, without copying it
+     *
+     * @return QByteArray
+     */
+    QByteArray toUtf8() const;
+
+    /**
+     * @brief Whether this Identifier is empty
+     *
+     * @return true
+     * @return false
+     */
+    bool isEmpty() const;
+
+    /**
+     * @brief Get the precomputed hash of this ID
+     *
+     * @return uint
+     */
+    uint hash() const;
+
+    /**
+     * @brief Number of distinct IDs interned so far
+     *
+     * @return int
+     */
+    static int internedCount();
+
+    bool operator==(const Identifier &other) const {
+        return this->m_entry == other.m_entry;
+    }
+
+    bool operator!=(const Identifier &other) const {
+        return this->m_entry != other.m_entry;
+    }
+
+    /**
+     * @brief Orders by UTF-8 bytes, so QMap<Identifier, T> is sorted as
+       QMap<QString, T> for ASCII IDs
+     *
+     */
+    bool operator<(const Identifier &other) const;
+
+  private:
+    const IdentifierEntry *m_entry = nullptr; ///< nullptr for empty IDs
+};
+
+inline uint qHash(const Identifier &id, uint seed = 0) {
+    return id.hash() ^ seed;
+}
+
+PUBLIC QDebug       operator<<(QDebug debug, const Identifier &id);
+PUBLIC QDataStream &operator<<(QDataStream &stream, const Identifier &id);
+PUBLIC QDataStream &operator>>(QDataStream &stream, Identifier &id);
+} // namespace MatrixCpp::Types
@@ -14,7 +14,9 @@
 #pragma once
 
 #include <QNetworkReply>
+#include <functional>
 
+#include <MatrixCpp/Filter.hpp>
 #include <MatrixCpp/Types.hpp>
 #include <MatrixCpp/export.hpp>
 
@@ -31,7 +33,7 @@
         if (!this->isError() && !this->isBroken())         \
             this->parseData();                             \
     };                                                     \
-    type(QVariant data) : Response(data) {                 \
+    type(QJsonValue data) : Response(data) {               \
         if (!this->isError() && !this->isBroken())         \
             this->parseData();                             \
     };                                                     \
@@ -41,14 +43,16 @@
     };
 
 /**
- * @brief Checks if data is a Map and create dataMap
+ * @brief Checks if data is an object and create dataObject
  *
  */
-#define CHECK_MAP()                           \
-    QVariantMap dataMap = this->data.toMap(); \
-    BROKEN(dataMap.isEmpty())
+#define CHECK_OBJECT()                                    \
+    const QJsonObject dataObject = this->data.toObject(); \
+    BROKEN(dataObject.isEmpty())
 
 namespace MatrixCpp::Responses {
+// Fast forward private types
+class SyncStreamParser;
 
 /**
  * @brief A matrix server response
@@ -93,6 +97,51 @@ class PUBLIC ResponseFuture : public QObject {
      */
     ResponseFuture(const ResponseFuture &other);
 
+    /**
+     * @brief Destroy the ResponseFuture object
+     *
+     */
+    ~ResponseFuture();
+
+    /**
+     * @brief Parse a /sync response body while it is being downloaded. Every
+       joined room is emitted by roomJoinUpdate as soon as it is complete,
+       so a request failing later may have emitted some already. Bodies of
+       HTTP errors are not streamed. The final Response has an empty
+       rooms.join. Must be called before returning to the event loop
+     *
+     * @param filter Applied while parsing rooms
+     */
+    void streamSync(const ParseFilter &filter = ParseFilter());
+
+    /**
+     * @brief Hands the raw response body to handler instead of parsing it.
+       Nothing is fired until complete() is called. Must be called before
+       returning to the event loop
+     *
+     * @param handler Called on the thread of this object when the request
+       finishes
+     */
+    void deferParse(std::function<void(QByteArray)> handler);
+
+    /**
+     * @brief Hands a copy of the raw response body to handler once the
+       request finishes without error, before it is parsed, whether it is
+       streamed, deferred or neither. Must be called before returning to the
+       event loop
+     *
+     * @param handler Called on the thread of this object
+     */
+    void tapBody(std::function<void(QByteArray)> handler);
+
+    /**
+     * @brief Completes a request whose parsing was deferred, firing
+       responseComplete
+     *
+     * @param response
+     */
+    void complete(Response response);
+
     /**
      * @brief Get the Response object when request finishes. This will delete
        ResponseFuture
@@ -109,6 +158,59 @@ class PUBLIC ResponseFuture : public QObject {
      */
     template <class T> T result();
 
+    /**
+     * @brief Calls callback when request finishes successfully, without
+       blocking. If the request already finished, callback is called right
+       away
+     *
+     * @param callback
+     * @return ResponseFuture* This ResponseFuture, for chaining
+     */
+    ResponseFuture *then(std::function<void(Response)> callback);
+
+    /**
+     * @brief Same as then(), but converts the Response to T first
+     *
+     * @tparam T The type of Response to pass to callback
+     * @param callback
+     * @return ResponseFuture* This ResponseFuture, for chaining
+     */
+    template <class T> ResponseFuture *then(std::function<void(T)> callback);
+
+    /**
+     * @brief Calls callback when request finishes with an error or a broken
+       response, without blocking
+     *
+     * @param callback
+     * @return ResponseFuture* This ResponseFuture, for chaining
+     */
+    ResponseFuture *onError(std::function<void(Response)> callback);
+
+    /**
+     * @brief Calls callback when request finishes, whatever the outcome
+     *
+     * @param callback
+     * @return ResponseFuture* This ResponseFuture, for chaining
+     */
+    ResponseFuture *always(std::function<void(Response)> callback);
+
+    /**
+     * @brief Calls callback once every future has finished, whatever their
+       outcome, without blocking
+     *
+     * @param futures
+     * @param callback Receives the responses in the same order as futures
+     */
+    static void whenAll(const QList<ResponseFuture *> &         futures,
+                        std::function<void(QList<Response>)> callback);
+
+    /**
+     * @brief Aborts the ongoing request. responseComplete is still fired, with
+       a broken Response
+     *
+     */
+    void abort();
+
   signals:
     /**
      * @brief Is fired when we have response fetched and parsed
@@ -116,6 +218,14 @@ class PUBLIC ResponseFuture : public QObject {
      */
     void responseComplete(Response response);
 
+    /**
+     * @brief Is fired for each joined room of a streamed /sync response
+     *
+     * @param roomId
+     * @param update
+     */
+    void roomJoinUpdate(QString roomId, Types::RoomUpdate update);
+
   private:
     /**
      * @brief Initializes object. Takes same params of default constructor
@@ -124,11 +234,25 @@ class PUBLIC ResponseFuture : public QObject {
      */
     void init(QNetworkReply *reply);
 
-    QNetworkReply *m_reply;
-    bool           m_finished = false;
-    QByteArray     m_rawResponse;
+    QNetworkReply *   m_reply;
+    bool              m_finished = false;
+    Response          m_response;
+    SyncStreamParser *m_stream = nullptr;
+
+    std::function<void(QByteArray)> m_bodyHandler;
+    std::function<void(QByteArray)> m_bodyTap;
+    QByteArray                      m_tapped; ///< Streamed body read so far
 };
 
+template <class T> T ResponseFuture::result() {
+    return T(this->result());
+}
+
+template <class T>
+ResponseFuture *ResponseFuture::then(std::function<void(T)> callback) {
+    return this->then([=](Response response) { callback(T(response)); });
+}
+
 class PUBLIC ErrorResponse : public Response {};
 
 /**
@@ -189,10 +313,44 @@ class PUBLIC WellKnownResponse : public Response {
     QUrl identityServer; ///< Identity server URL returned by server
 };
 
+/**
+ * @brief Response object for filter upload
+ *
+ */
+class PUBLIC FilterResponse : public Response {
+    RESPONSE_CONSTRUCTOR(FilterResponse)
+
+  public:
+    QString filterId; ///< Required. The ID of the uploaded filter
+};
+
 class PUBLIC SyncResponse : public Response {
     RESPONSE_CONSTRUCTOR(SyncResponse)
 
+  private:
+    void parse(const ParseFilter &filter);
+
   public:
+    /**
+     * @brief Parses skipping what filter does not want. The constructors
+       without one keep everything
+     *
+     */
+    SyncResponse(QByteArray rawResponse, const ParseFilter &filter)
+        : Response(rawResponse) {
+        if (!this->isError() && !this->isBroken())
+            this->parse(filter);
+    };
+    SyncResponse(QJsonValue data, const ParseFilter &filter) : Response(data) {
+        if (!this->isError() && !this->isBroken())
+            this->parse(filter);
+    };
+    SyncResponse(const Response &other, const ParseFilter &filter)
+        : Response(other) {
+        if (!this->isError() && !this->isBroken())
+            this->parse(filter);
+    };
+
     /**
      * @brief Required. String to be used as since param of next sync
      *
@@ -217,9 +375,41 @@ class PUBLIC SyncResponse : public Response {
      * @brief Information on the send-to-device messages for the client device
      *
      */
-    QList<Types::Event> toDevice;
+    QList<Types::ToDeviceEvent> toDevice;
+
+    QJsonObject deviceLists; ///< Information on end-to-end device updates
+    QJsonObject deviceOneTimeKeysCount; ///< Amount of uploaded one time keys
+};
 
-    QVariantMap deviceLists; ///< Information on end-to-end device updates
-    QVariantMap deviceOneTimeKeysCount; ///< Amount of uploaded one time keys
+/**
+ * @brief Response object for /rooms/{roomId}/messages
+ *
+ */
+class PUBLIC MessagesResponse : public Response {
+    RESPONSE_CONSTRUCTOR(MessagesResponse)
+
+  public:
+    QString start; ///< Required. The token the pagination starts from
+
+    /**
+     * @brief The token the pagination ends at, to continue from. Empty, or
+       equal to start, once there are no more events
+     *
+     */
+    QString end;
+
+    /**
+     * @brief Events, in the direction of the pagination: newest first when
+       paginating back
+     *
+     */
+    QList<Types::RoomEvent> chunk;
+
+    /**
+     * @brief State relevant to chunk, e.g. members of its senders when lazy
+       loading them
+     *
+     */
+    QList<Types::StateEvent> state;
 };
 } // namespace MatrixCpp::Responses
\ No newline at end of file
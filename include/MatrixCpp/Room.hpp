@@ -13,11 +13,24 @@
 
 #pragma once
 
+#include <QHash>
+#include <QMutex>
 #include <QObject>
+#include <QReadWriteLock>
+#include <QSet>
+#include <QVector>
+#include <atomic>
 
+#include <MatrixCpp/RoomState.hpp>
+#include <MatrixCpp/Timeline.hpp>
 #include <MatrixCpp/Types.hpp>
 #include <MatrixCpp/export.hpp>
 
+namespace MatrixCpp {
+// Fast forward private types
+class SyncSnapshot;
+} // namespace MatrixCpp
+
 namespace MatrixCpp::Types {
 
 /**
@@ -34,7 +47,13 @@ class PUBLIC Room : public QObject {
      * @param roomId
      * @param client The Client this Room is registered
      */
-    Room(const QString &roomId, Client *client = nullptr);
+    Room(const Identifier &roomId, Client *client = nullptr);
+
+    /**
+     * @brief Destroy the Room, releasing the profiles of its members
+     *
+     */
+    ~Room();
 
     /**
      * @brief Returns Room's name
@@ -51,10 +70,230 @@ class PUBLIC Room : public QObject {
      */
     bool encrypted() const;
 
-    QString               roomId;       ///< This Room's ID
-    QMap<QString, User *> users;        ///< Users this Room has
-    QMap<QString, User *> invitedUsers; ///< Users invited to this Room
-    User *                creator;      ///< The creator of this Room
+    /**
+     * @brief Get a snapshot of the state of this Room. Thread-safe, and
+       cheap: the snapshot shares its data until this Room changes
+     *
+     * @return RoomState
+     */
+    RoomState state() const;
+
+    /**
+     * @brief Get a snapshot of the recent timeline of this Room, and mark it
+       as used (see lastUsed()). Thread-safe and cheap, as state()
+     *
+     * @return Timeline
+     */
+    Timeline timeline() const;
+
+    /**
+     * @brief Approximate size of the timeline of this Room. Thread-safe
+     *
+     * @return qint64
+     */
+    qint64 timelineBytes() const;
+
+    /**
+     * @brief Changes how many events the timeline of this Room keeps,
+       evicting the oldest ones if needed. Thread-safe
+     *
+     * @param maxEvents
+     * @param maxBytes
+     */
+    void setTimelineLimits(int maxEvents, qint64 maxBytes);
+
+    /**
+     * @brief Drops the timeline of this Room. Thread-safe
+     *
+     */
+    void clearTimeline();
+
+    /**
+     * @brief Loads events older than the oldest of the timeline with
+       /messages, from its prev_batch. Calls made while a request is ongoing
+       are coalesced into it; if they want more events, the rest is requested
+       once it completes. historyLoaded is emitted for every page. Must be
+       called on the Client thread
+     *
+     * @param count Number of events wanted
+     */
+    void paginateBack(int count = 50);
+
+    /**
+     * @brief Fills the gaps left in the timeline by limited sync responses,
+       page by page, until they are closed or the timeline is full.
+       historyLoaded is emitted for every page. Must be called on the Client
+       thread
+     *
+     */
+    void fillGaps();
+
+    /**
+     * @brief Tells which timeline event is the oldest a consumer shows. Once
+       within Client::prefetchDistance events of the oldest loaded one, the
+       next page is requested ahead of time, of the size last given to
+       paginateBack(). Must be called on the Client thread
+     *
+     * @param index
+     */
+    void scrolledTo(int index);
+
+    /**
+     * @brief Whether paginateBack() is waiting for a page
+     *
+     * @return true
+     * @return false
+     */
+    bool paginating() const;
+
+    /**
+     * @brief Whether the timeline starts with the first event of this Room,
+       as found by paginateBack(). Thread-safe
+     *
+     * @return true
+     * @return false
+     */
+    bool atStart() const;
+
+    /**
+     * @brief When this Room was last used, i.e. got timeline events or had
+       its timeline read. Only meant to order rooms, a larger value is more
+       recent
+     *
+     * @return quint64
+     */
+    quint64 lastUsed() const;
+
+    /**
+     * @brief Get the power levels of this Room. Thread-safe
+     *
+     * @return PowerLevelsContent
+     */
+    PowerLevelsContent powerLevels() const;
+
+    /**
+     * @brief Get the power level of a user. Thread-safe
+     *
+     * @param userId
+     * @return int
+     */
+    int powerLevel(const Identifier &userId) const;
+
+    /**
+     * @brief Whether a user may send an event. Thread-safe
+     *
+     * @param userId
+     * @param eventType
+     * @param state Whether the event is a state event
+     * @return true
+     * @return false
+     */
+    bool canSend(const Identifier &userId,
+                 const QString &   eventType,
+                 bool              state = false) const;
+
+    bool canInvite(const Identifier &userId) const; ///< Thread-safe
+
+    /**
+     * @brief Whether a user may kick anyone below their own level. Thread-safe
+     *
+     * @param userId
+     * @return true
+     * @return false
+     */
+    bool canKick(const Identifier &userId) const;
+
+    /**
+     * @brief Whether a user may kick target, whose level must be lower than
+       their own. Thread-safe
+     *
+     * @param userId
+     * @param target
+     * @return true
+     * @return false
+     */
+    bool canKick(const Identifier &userId, const Identifier &target) const;
+
+    /**
+     * @brief Whether a user may ban anyone below their own level. Thread-safe
+     *
+     * @param userId
+     * @return true
+     * @return false
+     */
+    bool canBan(const Identifier &userId) const;
+
+    /**
+     * @brief Whether a user may ban target, whose level must be lower than
+       their own. Thread-safe
+     *
+     * @param userId
+     * @param target
+     * @return true
+     * @return false
+     */
+    bool canBan(const Identifier &userId, const Identifier &target) const;
+
+    /**
+     * @brief Whether a user may redact events of others. Redacting their own
+       events only needs canSend(userId, "m.room.redaction"). Thread-safe
+     *
+     * @param userId
+     * @return true
+     * @return false
+     */
+    bool canRedact(const Identifier &userId) const;
+
+    /**
+     * @brief Whether a user may redact an event of sender: their own ones,
+       or those of users below their level. Thread-safe
+     *
+     * @param userId
+     * @param sender Sender of the event to redact
+     * @return true
+     * @return false
+     */
+    bool canRedact(const Identifier &userId, const Identifier &sender) const;
+
+    /**
+     * @brief Get a member of this Room
+     *
+     * @param userId
+     * @return User Null if userId is not joined nor invited
+     */
+    User member(const Identifier &userId) const;
+
+    /**
+     * @brief Get the membership of a user in this Room
+     *
+     * @param userId
+     * @return EventContent::Membership MEMBERSHIP_LEAVE if userId is not
+       joined nor invited
+     */
+    EventContent::Membership membership(const Identifier &userId) const;
+
+    /**
+     * @brief Get the members with a membership
+     *
+     * @param membership One of: MEMBERSHIP_JOIN, MEMBERSHIP_INVITE
+     * @return QVector<User>
+     */
+    QVector<User> members(
+        EventContent::Membership membership = EventContent::MEMBERSHIP_JOIN)
+        const;
+
+    /**
+     * @brief Get the number of members with a membership
+     *
+     * @param membership One of: MEMBERSHIP_JOIN, MEMBERSHIP_INVITE
+     * @return int
+     */
+    int memberCount(
+        EventContent::Membership membership = EventContent::MEMBERSHIP_JOIN)
+        const;
+
+    Identifier roomId;    ///< This Room's ID
+    Identifier creator;   ///< User ID of the creator of this Room
     bool federate = true; ///< Whether users on other servers can join this Room
     QString algorithm;    ///< Encryption algorithm used to encrypt messages
 
@@ -68,14 +307,39 @@ class PUBLIC Room : public QObject {
      * @param membership One of: MEMBERSHIP_JOIN, MEMBERSHIP_INVITE
      */
     void updateMember(
-        const QString &          userId,
+        const Identifier &       userId,
         const QString &          displayName = "",
         const QString &          avatarUrl   = "",
         EventContent::Membership membership  = EventContent::MEMBERSHIP_JOIN);
 
+    /**
+     * @brief Remove a member from this room, if known
+     *
+     * @param userId
+     */
+    void removeMember(const Identifier &userId);
+
+  signals:
+    /**
+     * @brief Emitted on the Client thread once a sync response updating this
+       Room has been applied to every room
+     *
+     */
+    void changed();
+
+    /**
+     * @brief Emitted once a page of events older than some of the timeline
+       was inserted in it
+     *
+     * @param count Number of events inserted, maybe 0 once filtered
+     */
+    void historyLoaded(int count);
+
   public slots:
     /**
-     * @brief Process StateEvent and update Room accordingly
+     * @brief Process StateEvent and update Room accordingly. May run on a
+       worker thread (see Client::applyThreads), as may EventRegistry
+       handlers it calls
      *
      * @param event
      */
@@ -89,7 +353,98 @@ class PUBLIC Room : public QObject {
     void onRoomMemberEvent(StateEvent event);
 
   private:
+    friend class MatrixCpp::Client;
+    friend class MatrixCpp::SyncSnapshot;
+
+    /**
+     * @brief Appends the timeline of a sync response. Thread-safe
+     *
+     * @param events
+     * @param limited
+     * @param prevBatch
+     */
+    void appendTimeline(const QList<RoomEvent> &events,
+                        bool                    limited,
+                        const QString &         prevBatch);
+
+    /**
+     * @brief Replaces a timeline event, e.g. once decrypted. Thread-safe
+     *
+     * @param event
+     */
+    void replaceTimelineEvent(const RoomEvent &event);
+
+    /**
+     * @brief Marks this Room as used now
+     *
+     */
+    void touch() const;
+
+    /**
+     * @brief Requests the next page of paginateBack()
+     *
+     */
+    void requestBack();
+
+    /**
+     * @brief Requests a page for the gap before a timeline event
+     *
+     * @param eventId
+     */
+    void fillGap(const QString &eventId);
+
+    /**
+     * @brief Decrypts and filters a page of /messages, as timeline events
+       of a sync response
+     *
+     * @param chunk Events, newest first
+     * @return QList<RoomEvent> Events, oldest first
+     */
+    QList<RoomEvent> prepareHistory(const QList<RoomEvent> &chunk);
+
+    /**
+     * @brief Derives m_powerLevels from m_state. m_stateLock must be held for
+       writing
+     *
+     */
+    void updatePowerLevels();
+
+    /**
+     * @brief A row of the member table
+     *
+     */
+    struct Member {
+        User                     user;
+        EventContent::Membership membership;
+    };
+
     QString m_name;
     bool    m_encrypted = false;
+
+    RoomState              m_state;
+    PowerLevelsContent     m_powerLevels; ///< Always valid, see noPowerLevels()
+    mutable QReadWriteLock m_stateLock;   ///< Guards m_state and m_powerLevels
+
+    Timeline                     m_timeline;
+    mutable QMutex               m_timelineLock; ///< Guards m_timeline
+    mutable std::atomic<quint64> m_lastUsed{0};
+
+    // Pagination, on the Client thread only
+    Client *      m_client;          ///< Requests pages, if any
+    int           m_pageSize   = 50; ///< Last count of paginateBack()
+    int           m_backWanted = 0;  ///< Events paginateBack() still wants
+    bool          m_paginating = false;
+    QSet<QString> m_gapFills; ///< Events whose gap is being filled
+
+    /**
+     * @brief Oldest event of this Room, once paginateBack() reached it.
+       Guarded by m_timelineLock
+     *
+     */
+    QString m_startEvent;
+
+    QSharedPointer<UserRegistry> m_registry; ///< Shares profiles among rooms
+    QVector<Member>              m_members;  ///< Joined and invited, unordered
+    QHash<Identifier, int>       m_memberIndex; ///< User ID to m_members index
 };
 } // namespace MatrixCpp::Types
\ No newline at end of file
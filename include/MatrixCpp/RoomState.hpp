@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file RoomState.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares RoomState, the current state events of a Room
+ * @version 0.1
+ * @date 2021-03-20
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QJsonObject>
+#include <QPair>
+#include <QSharedData>
+#include <QStringList>
+
+#include <MatrixCpp/Identifier.hpp>
+#include <MatrixCpp/export.hpp>
+
+namespace MatrixCpp::Types {
+// Defined in Types.hpp, which includes Room.hpp and so this file
+class PUBLIC StateEvent;
+class PUBLIC EventContent;
+class PUBLIC CreateContent;
+class PUBLIC RoomEncryptionContent;
+
+/**
+ * @brief The current state of a room: the latest state event of every
+   (type, state_key)
+ *
+ * Lookups are O(1). Only what is needed of each event is kept, and content
+ * equal to the one being replaced keeps the stored copy, so re-sent state
+ * does not take memory again. RoomState is implicitly shared: a copy is a
+ * snapshot which costs one reference until either side changes.
+ */
+class PUBLIC RoomState {
+  public:
+    /**
+     * @brief A state event, as stored
+     *
+     */
+    struct Entry {
+        QString     eventId;      ///< ID of the event which set this state
+        Identifier  sender;       ///< User who set this state
+        qint64      serverTs = 0; ///< When this state was set
+        QJsonObject content;      ///< The state itself
+    };
+
+    using Key = QPair<Identifier, Identifier>; ///< (type, state_key)
+
+    RoomState();
+
+    /**
+     * @brief Sets the state of event's type and state_key to event
+     *
+     * @param event
+     * @return true
+     * @return false event is broken or did not change anything
+     */
+    bool update(const StateEvent &event);
+
+    /**
+     * @brief Sets the state of key to entry
+     *
+     * @param key
+     * @param entry
+     */
+    void insert(const Key &key, const Entry &entry);
+
+    /**
+     * @brief Whether there is state for type and stateKey
+     *
+     * @param type
+     * @param stateKey
+     * @return true
+     * @return false
+     */
+    bool contains(const QString &type, const QString &stateKey = "") const;
+
+    /**
+     * @brief Get the state of type and stateKey
+     *
+     * @param type
+     * @param stateKey
+     * @return Entry Empty if there is none
+     */
+    Entry entry(const QString &type, const QString &stateKey = "") const;
+
+    /**
+     * @brief Get the content of the state of type and stateKey
+     *
+     * @param type
+     * @param stateKey
+     * @return QJsonObject Empty if there is none
+     */
+    QJsonObject content(const QString &type,
+                        const QString &stateKey = "") const;
+
+    /**
+     * @brief Get the state keys of type, in no particular order. Scans every
+       entry
+     *
+     * @param type
+     * @return QStringList
+     */
+    QStringList stateKeys(const QString &type) const;
+
+    /**
+     * @brief Get every entry
+     *
+     * @return QHash<Key, Entry>
+     */
+    QHash<Key, Entry> entries() const;
+
+    /**
+     * @brief Number of (type, state_key) with state
+     *
+     * @return int
+     */
+    int size() const;
+
+    // Typed accessors. Missing or broken state gives empty values
+
+    QString name() const;              ///< m.room.name
+    QString topic() const;             ///< m.room.topic
+    QString avatarUrl() const;         ///< m.room.avatar
+    QString canonicalAlias() const;    ///< m.room.canonical_alias
+    QString joinRule() const;          ///< m.room.join_rules
+    QString historyVisibility() const; ///< m.room.history_visibility
+
+    /**
+     * @brief Get m.room.create
+     *
+     * @return CreateContent Broken if missing
+     */
+    CreateContent create() const;
+
+    /**
+     * @brief Get m.room.encryption
+     *
+     * @return RoomEncryptionContent Broken if the room is not encrypted
+     */
+    RoomEncryptionContent encryption() const;
+
+    /**
+     * @brief Get the m.room.member state of a user
+     *
+     * @param userId
+     * @return EventContent Broken if the user never was a member
+     */
+    EventContent member(const QString &userId) const;
+
+  private:
+    struct Data : public QSharedData {
+        QHash<Key, Entry> entries;
+    };
+
+    /**
+     * @brief Reads a string field of the content of a state
+     *
+     */
+    QString field(const QString &type, const QString &key) const;
+
+    QSharedDataPointer<Data> d;
+};
+} // namespace MatrixCpp::Types
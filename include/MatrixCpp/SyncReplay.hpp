@@ -0,0 +1,154 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncReplay.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares SyncReplay, which feeds a recorded sync stream to a Client
+ * @version 0.1
+ * @date 2021-03-23
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QObject>
+#include <QTimer>
+#include <QVector>
+
+#include <MatrixCpp/Client.hpp>
+#include <MatrixCpp/export.hpp>
+
+namespace MatrixCpp {
+/**
+ * @brief Applies the /sync responses of a capture (see
+   Client::startRecording()) to a Client, without any network
+ *
+ * Every response is parsed with the parseFilter of the Client, then its rooms
+ * are applied by the same code as a live response, so profiling a replay
+ * shows the workload which was recorded. Nothing else is: no snapshot is
+ * saved, no gap filled, no to-device event handled and no key uploaded.
+ * Responses are decompressed right before being applied. The Client should
+ * not be syncing meanwhile, and must be constructed without encryption.
+ */
+class PUBLIC SyncReplay : public QObject {
+    Q_OBJECT
+
+  public:
+    /**
+     * @brief How fast responses are applied by start()
+     *
+     */
+    enum Pace {
+        PACE_FULL_SPEED, ///< Each as soon as the previous one was applied
+        PACE_REAL_TIME,  ///< Each as long after the first as when recorded
+    };
+
+    /**
+     * @brief Construct a new SyncReplay
+     *
+     * @param client Client responses are applied to
+     * @param parent
+     */
+    explicit SyncReplay(Client *client, QObject *parent = nullptr);
+
+    /**
+     * @brief Reads a capture, replacing any previously loaded one
+     *
+     * @param path
+     * @return true
+     * @return false path is missing, not a capture or of another version,
+       or the Client has encryption. A capture cut short is loaded up to its
+       last whole response
+     */
+    bool load(const QString &path);
+
+    /**
+     * @brief Applies every remaining response right away, without returning
+       to the event loop
+     *
+     * @return int Number of responses applied
+     */
+    int replayAll();
+
+    /**
+     * @brief Applies the remaining responses from the event loop, at pace.
+       finished is emitted after the last one
+     *
+     * @param pace
+     */
+    void start(Pace pace = PACE_FULL_SPEED);
+
+    /**
+     * @brief Stops a replay started by start(). The next one resumes from
+       the same response
+     *
+     */
+    void stop();
+
+    /**
+     * @brief Goes back to the first response
+     *
+     */
+    void rewind();
+
+    int  size() const;      ///< Number of responses in the capture
+    int  position() const;  ///< Index of the next response to apply
+    bool isRunning() const; ///< Whether start() is applying responses
+
+    /**
+     * @brief Get the time between the first and the last response when they
+       were recorded
+     *
+     * @return qint64 Milliseconds
+     */
+    qint64 duration() const;
+
+  signals:
+    /**
+     * @brief Emitted once a response was applied
+     *
+     * @param index Its index in the capture
+     */
+    void responseApplied(int index);
+
+    /**
+     * @brief Emitted when start() applied the last response
+     *
+     */
+    void finished();
+
+  private:
+    /**
+     * @brief A recorded response
+     *
+     */
+    struct Record {
+        qint64     at;   ///< Milliseconds since recording started
+        QByteArray body; ///< Compressed body
+    };
+
+    /**
+     * @brief Applies the response at position() and moves to the next one
+     *
+     */
+    void applyNext();
+
+    /**
+     * @brief Arms the timer for the next response, or finishes
+     *
+     */
+    void scheduleNext();
+
+    Client *        m_client;
+    QVector<Record> m_records;
+    int             m_position = 0;
+    Pace            m_pace     = PACE_FULL_SPEED;
+    bool            m_running  = false;
+    QTimer          m_timer;
+    QElapsedTimer   m_clock;      ///< Started by start()
+    qint64          m_offset = 0; ///< Recorded time start() began from
+};
+} // namespace MatrixCpp
@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file Timeline.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares Timeline, the most recent events of a Room
+ * @version 0.1
+ * @date 2021-03-21
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QList>
+#include <QSet>
+#include <QSharedDataPointer>
+#include <QString>
+
+#include <MatrixCpp/export.hpp>
+
+namespace MatrixCpp::Types {
+// Defined in Types.hpp, which includes Room.hpp and so this file
+class PUBLIC RoomEvent;
+
+/**
+ * @brief The most recent timeline events of a room, oldest first
+ *
+ * Events are kept in a ring buffer bounded by a number of events and an
+ * approximate size in bytes; once either is exceeded the oldest events are
+ * evicted. Every sync batch remembers its prev_batch token, and a limited
+ * batch following other events is marked as a gap, since the server left
+ * events out between the two. Eviction stops at the start of a batch when it
+ * can, so prevBatch() still tells where to paginate back from.
+ *
+ * Timeline is implicitly shared: a copy is a snapshot which costs one
+ * reference until either side changes.
+ */
+class PUBLIC Timeline {
+  public:
+    /**
+     * @brief Construct an empty Timeline
+     *
+     * @param maxEvents Maximum number of events kept
+     * @param maxBytes Maximum approximate size of the events kept
+     */
+    explicit Timeline(int maxEvents = 500, qint64 maxBytes = 1 << 20);
+
+    Timeline(const Timeline &other);
+    Timeline &operator=(const Timeline &other);
+    ~Timeline();
+
+    /**
+     * @brief Appends the timeline of a sync response
+     *
+     * @param events Events, oldest first
+     * @param limited Whether the server left events out before events
+     * @param prevBatch Token to paginate back from the first of events
+     */
+    void append(const QList<RoomEvent> &events,
+                bool                    limited,
+                const QString &         prevBatch);
+
+    /**
+     * @brief Inserts events paginated back from the token of event index,
+       i.e. older than it. If they reach the event before index, the gap
+       between the two is closed and events already there are skipped.
+       Otherwise the first inserted event carries the gap and prevBatch. Does
+       not evict, the limits are enforced again by the next append()
+     *
+     * @param index 0 to prepend to the timeline, or an event with a gap
+       before it
+     * @param events Events, oldest first
+     * @param prevBatch Token to paginate back from the first of events
+     * @return int Number of events inserted
+     */
+    int fill(int                     index,
+             const QList<RoomEvent> &events,
+             const QString &         prevBatch);
+
+    /**
+     * @brief Replaces the event with the same ID, e.g. once decrypted. Newer
+       events are looked up first
+     *
+     * @param event
+     * @return true
+     * @return false event is not in this Timeline
+     */
+    bool replace(const RoomEvent &event);
+
+    /**
+     * @brief Removes every event. Limits are kept
+     *
+     */
+    void clear();
+
+    /**
+     * @brief Changes the limits, evicting events if needed
+     *
+     * @param maxEvents
+     * @param maxBytes
+     */
+    void setLimits(int maxEvents, qint64 maxBytes);
+
+    int    maxEvents() const; ///< Maximum number of events kept
+    qint64 maxBytes() const;  ///< Maximum approximate size of events kept
+
+    int    size() const;    ///< Number of events
+    bool   isEmpty() const; ///< Whether there are no events
+    qint64 bytes() const;   ///< Approximate size of the events
+
+    /**
+     * @brief Get an event
+     *
+     * @param i 0 is the oldest event, size() - 1 the newest
+     * @return RoomEvent
+     */
+    RoomEvent at(int i) const;
+
+    /**
+     * @brief Whether the server left events out right before event i
+     *
+     * @param i
+     * @return true
+     * @return false
+     */
+    bool gapBefore(int i) const;
+
+    /**
+     * @brief Get the index of an event. Newer events are looked up first
+     *
+     * @param eventId
+     * @return int -1 if eventId is not in this Timeline
+     */
+    int indexOf(const QString &eventId) const;
+
+    /**
+     * @brief Get the IDs of the newest events
+     *
+     * @param count
+     * @return QSet<QString> Of at most count events
+     */
+    QSet<QString> lastEventIds(int count) const;
+
+    /**
+     * @brief Get every event, oldest first
+     *
+     * @return QList<RoomEvent>
+     */
+    QList<RoomEvent> events() const;
+
+    /**
+     * @brief Get the token to paginate back from the oldest event
+     *
+     * @return QString Empty if there are no events, or if the oldest batch
+       had to be cut by eviction
+     */
+    QString prevBatch() const;
+
+    /**
+     * @brief Get the token to paginate back from event i
+     *
+     * @param i
+     * @return QString Empty unless event i starts a batch
+     */
+    QString prevBatch(int i) const;
+
+  private:
+    struct Data;
+
+    QSharedDataPointer<Data> d;
+};
+} // namespace MatrixCpp::Types
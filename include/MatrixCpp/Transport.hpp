@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file Transport.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares Transport, which carries the HTTP requests of a Client
+ * @version 0.1
+ * @date 2021-03-22
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QObject>
+
+#include <MatrixCpp/export.hpp>
+
+namespace MatrixCpp {
+/**
+ * @brief Sends the HTTP requests of a Client
+ *
+ * Replies are plain QNetworkReply objects, so a Transport which does not
+ * touch the network (see MockTransport) only has to fake one. Replies are
+ * owned by the caller, which deletes them once finished.
+ */
+class PUBLIC Transport : public QObject {
+    Q_OBJECT
+
+  public:
+    using QObject::QObject;
+
+    /**
+     * @brief Sends a GET request
+     *
+     * @param request
+     * @return QNetworkReply*
+     */
+    virtual QNetworkReply *get(const QNetworkRequest &request) = 0;
+
+    /**
+     * @brief Sends a POST request
+     *
+     * @param request
+     * @param body
+     * @return QNetworkReply*
+     */
+    virtual QNetworkReply *post(const QNetworkRequest &request,
+                                const QByteArray &     body) = 0;
+};
+
+/**
+ * @brief Transport over the network, through a QNetworkAccessManager. Used
+   by default
+ *
+ */
+class PUBLIC NetworkTransport : public Transport {
+    Q_OBJECT
+
+  public:
+    explicit NetworkTransport(QObject *parent = nullptr);
+
+    QNetworkReply *get(const QNetworkRequest &request) override;
+    QNetworkReply *post(const QNetworkRequest &request,
+                        const QByteArray &     body) override;
+
+  private:
+    QNetworkAccessManager *m_nam;
+};
+} // namespace MatrixCpp
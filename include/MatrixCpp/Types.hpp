@@ -13,8 +13,15 @@
 
 #pragma once
 
-#include <QVariant>
-
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QJsonValue>
+#include <QMutex>
+#include <QSharedPointer>
+
+#include <MatrixCpp/Filter.hpp>
+#include <MatrixCpp/Identifier.hpp>
 #include <MatrixCpp/export.hpp>
 
 /**
@@ -30,7 +37,7 @@
         if (!this->isBroken())                           \
             this->parseData();                           \
     };                                                   \
-    type(QVariant data) : parent(data) {                 \
+    type(QJsonValue data) : parent(data) {               \
         if (!this->isBroken())                           \
             this->parseData();                           \
     };                                                   \
@@ -41,6 +48,26 @@
 
 #define MATRIXOBJ_CONSTRUCTOR(type) CLASS_CONSTRUCTOR(type, MatrixObj)
 
+/**
+ * @brief Generates constructors which parse with a ParseFilter, for
+   subclasses whose parseData() is parse() keeping everything
+ *
+ */
+#define FILTERED_CONSTRUCTOR(type, parent)                            \
+  private:                                                            \
+    void parse(const ParseFilter &filter);                            \
+                                                                      \
+  public:                                                             \
+    type(QByteArray rawResponse, const ParseFilter &filter)           \
+        : parent(rawResponse) {                                       \
+        if (!this->isBroken())                                        \
+            this->parse(filter);                                      \
+    };                                                                \
+    type(QJsonValue data, const ParseFilter &filter) : parent(data) { \
+        if (!this->isBroken())                                        \
+            this->parse(filter);                                      \
+    };
+
 /**
  * @brief Sets Response broken property if cond is true
  *
@@ -75,15 +102,18 @@ class PUBLIC EventContent;
 class PUBLIC CreateContent;
 class PUBLIC RoomNameContent;
 class PUBLIC RoomEncryptionContent;
+class PUBLIC PowerLevelsContent;
 
 // Events
 class PUBLIC RoomEvent;
 class PUBLIC StateEvent;
 class PUBLIC StrippedStateEvent;
 class PUBLIC RoomEncryptionEvent;
+class PUBLIC ToDeviceEvent;
 
 class PUBLIC Room;
 class PUBLIC User;
+class PUBLIC UserRegistry;
 
 /**
  * @brief Base class for every matrix object (JSON)
@@ -105,11 +135,12 @@ class PUBLIC MatrixObj {
     explicit MatrixObj(QByteArray rawJson);
 
     /**
-     * @brief Construct a new MatrixObj from QVariant data
+     * @brief Construct a new MatrixObj from already parsed JSON. The
+       underlying JSON buffer is shared, not copied
      *
      * @param data
      */
-    explicit MatrixObj(QVariant data);
+    explicit MatrixObj(QJsonValue data);
 
     /**
      * @brief Construct a new MatrixObj object based on other MatrixObj
@@ -133,7 +164,7 @@ class PUBLIC MatrixObj {
      */
     QByteArray getJson() const;
 
-    QVariant data; ///< Original data stored in this MatrixObj
+    QJsonValue data; ///< Original data stored in this MatrixObj
 
   protected:
     /**
@@ -152,6 +183,7 @@ class PUBLIC MatrixObj {
  */
 class PUBLIC RoomUpdate : public MatrixObj {
     MATRIXOBJ_CONSTRUCTOR(RoomUpdate)
+    FILTERED_CONSTRUCTOR(RoomUpdate, MatrixObj)
 
   public:
     /**
@@ -159,7 +191,7 @@ class PUBLIC RoomUpdate : public MatrixObj {
        render it to users
      *
      */
-    QVariantMap summary;
+    QJsonObject summary;
 
     /**
      * @brief Updates to the state, between the time indicated by the since
@@ -172,7 +204,7 @@ class PUBLIC RoomUpdate : public MatrixObj {
      * @brief The timeline of messages and state changes in the room
      *
      */
-    QVariantMap timeline;
+    QJsonObject timeline;
 
     /**
      * @brief The ephemeral events in the room that aren't recorded in the
@@ -191,7 +223,7 @@ class PUBLIC RoomUpdate : public MatrixObj {
      * @brief Counts of unread notifications for this room
      *
      */
-    QVariantMap unreadNotifications;
+    QJsonObject unreadNotifications;
 };
 
 /**
@@ -215,6 +247,7 @@ class PUBLIC RoomInvite : public MatrixObj {
  */
 class PUBLIC Rooms : public MatrixObj {
     MATRIXOBJ_CONSTRUCTOR(Rooms)
+    FILTERED_CONSTRUCTOR(Rooms, MatrixObj)
 
   public:
     Rooms(){};
@@ -222,7 +255,7 @@ class PUBLIC Rooms : public MatrixObj {
     QMap<QString, RoomUpdate> join; ///< The rooms that the user has joined
     QMap<QString, RoomInvite>
                 invite; ///< The rooms that the user has been invited to
-    QVariantMap leave; ///< The rooms that the user has left or been banned from
+    QJsonObject leave; ///< The rooms that the user has left or been banned from
 };
 
 /**
@@ -235,11 +268,13 @@ class PUBLIC Event : public MatrixObj {
   public:
     using MatrixObj::MatrixObj;
 
+    Event(){};
+
     /**
      * @brief Various types of Event
      *
      */
-    enum Type {
+    enum Type : int {
         // Presence events
         M_PRESENCE,
 
@@ -249,17 +284,29 @@ class PUBLIC Event : public MatrixObj {
         M_ROOM_NAME,
         M_ROOM_CREATE,
         M_ROOM_ENCRYPTION,
+        M_ROOM_ENCRYPTED,
+        M_ROOM_POWER_LEVELS,
 
         // Ephemeral events
         M_TYPING,
 
+        // To-device events
+        M_ROOM_KEY,
+
         // Other types of events
         M_UNKNOWN,
-        M_OTHER
+        M_OTHER,
+
+        /**
+         * @brief First value given to types registered through EventRegistry
+         *
+         */
+        M_CUSTOM = 0x100
     };
 
-    Type        type;    ///< Type of this event
-    QVariantMap content; ///< The event content
+    Type        type;     ///< Type of this event
+    QString     typeName; ///< Type string, shared by all events of this type
+    QJsonObject content;  ///< The event content
 };
 
 /**
@@ -337,13 +384,13 @@ class PUBLIC CreateContent : public MatrixObj {
     MATRIXOBJ_CONSTRUCTOR(CreateContent)
 
   public:
-    QString creator;      ///< Required. The user_id of the Room creator
+    Identifier creator;   ///< Required. The user_id of the Room creator
     bool federate = true; ///< Whether users on other servers can join this Room
     QString roomVersion = "1"; ///< The version of the Room
 
     // Predecessor fields (optional)
-    QString roomId;  ///< The ID of the old room
-    QString eventId; ///< The event ID of the last known event in the old room
+    Identifier roomId;  ///< The ID of the old room
+    QString    eventId; ///< The ID of the last known event in the old room
 };
 
 /**
@@ -387,6 +434,56 @@ class PUBLIC RoomNameContent : public MatrixObj {
     QString name;
 };
 
+/**
+ * @brief Content for an event of type m.room.power_levels. Defaults are the
+   ones of the spec for a missing key, see noPowerLevels() for a room without
+   this event
+ *
+ */
+class PUBLIC PowerLevelsContent : public MatrixObj {
+    MATRIXOBJ_CONSTRUCTOR(PowerLevelsContent)
+
+  public:
+    PowerLevelsContent(){};
+
+    /**
+     * @brief Get the levels of a room without m.room.power_levels, where only
+       its creator is privileged
+     *
+     * @param creator
+     * @return PowerLevelsContent
+     */
+    static PowerLevelsContent noPowerLevels(const Identifier &creator);
+
+    /**
+     * @brief Get the level of a user
+     *
+     * @param userId
+     * @return int
+     */
+    int userLevel(const Identifier &userId) const;
+
+    /**
+     * @brief Get the level required to send an event
+     *
+     * @param eventType
+     * @param state Whether the event is a state event
+     * @return int
+     */
+    int eventLevel(const QString &eventType, bool state = false) const;
+
+    QHash<Identifier, int> users;  ///< Levels of users, by user ID
+    QHash<QString, int>    events; ///< Levels required, by event type
+
+    int usersDefault  = 0;  ///< Level of users not in users
+    int eventsDefault = 0;  ///< Level required for events not in events
+    int stateDefault  = 50; ///< Level required for state not in events
+    int ban           = 50; ///< Level required to ban
+    int kick          = 50; ///< Level required to kick
+    int redact        = 50; ///< Level required to redact events of others
+    int invite        = 0;  ///< Level required to invite
+};
+
 /**
  * @brief Represents a room event
  *
@@ -395,6 +492,8 @@ class PUBLIC RoomEvent : public Event {
     CLASS_CONSTRUCTOR(RoomEvent, Event)
 
   public:
+    RoomEvent(){};
+
     QString eventId; ///< Required. The globally unique event identifier
 
     /**
@@ -402,14 +501,14 @@ class PUBLIC RoomEvent : public Event {
        this event
      *
      */
-    QString sender;
+    Identifier sender;
 
     /**
      * @brief Required. Timestamp in milliseconds on originating homeserver when
        this event was sent
      *
      */
-    int serverTs;
+    qint64 serverTs = 0;
 
     /**
      * @brief Contains optional extra information about the event
@@ -453,33 +552,131 @@ class PUBLIC StrippedStateEvent : public Event {
   public:
     EventContent content;  ///< Required. The content for the event
     QString      stateKey; ///< Required. The state_key for the event
-    QString      sender;   ///< Required. The sender for the event
+    Identifier   sender;   ///< Required. The sender for the event
+};
+
+/**
+ * @brief An event sent directly to this device, or the payload of an olm
+   encrypted one
+ *
+ */
+class PUBLIC ToDeviceEvent : public Event {
+    CLASS_CONSTRUCTOR(ToDeviceEvent, Event)
+
+  public:
+    ToDeviceEvent(){};
+
+    Identifier sender; ///< Required. The fully-qualified ID of the sender
+
+    /**
+     * @brief curve25519 key of the sending device. For encrypted events, taken
+       from content; for decrypted ones, the key of the olm session used
+     *
+     */
+    Identifier senderKey;
+
+    bool decrypted = false; ///< Whether this event was decrypted from olm
 };
 
 /**
- * @brief Represents a matrix user, used by Room to store members
+ * @brief A matrix user profile, used by Room to store members. A plain value:
+   profiles made by UserRegistry share their strings with every other room
+   the user is in
  *
  */
-class PUBLIC User : public QObject {
-    Q_OBJECT
+class PUBLIC User {
+  public:
+    User(){};
 
+    /**
+     * @brief Construct a new User object. Strings are not deduplicated, see
+       UserRegistry::acquire()
+     *
+     * @param userId
+     * @param displayName
+     * @param avatarUrl
+     */
+    User(const Identifier &userId,
+         const QString &   displayName = "",
+         const QString &   avatarUrl   = "");
+
+    /**
+     * @brief Whether this User is empty, e.g. as returned for unknown members
+     *
+     * @return true
+     * @return false
+     */
+    bool isNull() const;
+
+    Identifier userId;      ///< Fully qualified matrix user ID
+    QString    displayName; ///< User display name, if any
+    QString    avatarUrl;   ///< User avatar URL, if any
+};
+
+/**
+ * @brief Deduplicates user profiles among rooms of a Client
+ *
+ * Every display name and avatar URL is stored once, and profiles returned by
+ * acquire() only reference them, so a user in many rooms costs three
+ * pointers per room. Strings are counted by the members using them and
+ * dropped with the last one, so a profile change frees the old strings once
+ * no room holds them. Thread safe, so rooms can be applied concurrently.
+ */
+class PUBLIC UserRegistry {
   public:
     /**
-     * @brief Construct a new User object
+     * @brief Get a profile whose strings are shared with equal ones in use.
+       Each profile acquired must be released once its member goes away
      *
-     * @param room The Room this user is
      * @param userId
      * @param displayName
      * @param avatarUrl
+     * @return User
+     */
+    User acquire(const Identifier &userId,
+                 const QString &   displayName = "",
+                 const QString &   avatarUrl   = "");
+
+    /**
+     * @brief Stops using the strings of a profile returned by acquire()
+     *
+     * @param user
+     */
+    void release(const User &user);
+
+    /**
+     * @brief Number of distinct strings in use
+     *
+     * @return int
+     */
+    int size() const;
+
+    /**
+     * @brief Registry used by rooms without a Client
+     *
+     * @return QSharedPointer<UserRegistry>
+     */
+    static QSharedPointer<UserRegistry> shared();
+
+  private:
+    /**
+     * @brief Get the stored copy of string, storing it if new. m_lock must be
+       held
+     *
+     * @param string
+     * @return QString
+     */
+    QString acquireString(const QString &string);
+
+    /**
+     * @brief Forgets string once no member uses it. m_lock must be held
+     *
+     * @param string
      */
-    User(Room *         room,
-         const QString &userId,
-         const QString &displayName = "",
-         const QString &avatarUrl   = "");
+    void releaseString(const QString &string);
 
-    QString userId;      ///< Fully qualified matrix user ID
-    QString displayName; ///< User display name, if any
-    QString avatarUrl;   ///< User avatar URL, if any
+    mutable QMutex      m_lock;
+    QHash<QString, int> m_strings; ///< Stored copy to members using it
 };
 } // namespace Types
 } // namespace MatrixCpp
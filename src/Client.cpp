@@ -13,14 +13,22 @@
 
 #include <QException>
 #include <QJsonDocument>
-#include <QNetworkAccessManager>
 #include <QNetworkReply>
 #include <QNetworkRequest>
+#include <QTimer>
+#include <QVector>
+#include <algorithm>
 
 #include <MatrixCpp/Client.hpp>
 #include <MatrixCpp/Responses.hpp>
 
+#include "FilterCache.hpp"
 #include "Olm.hpp"
+#include "RequestMetrics.hpp"
+#include "SyncPipeline.hpp"
+#include "SyncRecorder.hpp"
+#include "SyncSnapshot.hpp"
+#include "src/Utils.hpp"
 
 using namespace MatrixCpp;
 using namespace MatrixCpp::Responses;
@@ -31,7 +39,23 @@ using namespace MatrixCpp::Crypto;
 
 Client::Client(const QUrl &homeserverUrl, bool encryption, QObject *parent)
     : QObject(parent), homeserverUrl(homeserverUrl), m_encryption(encryption),
-      m_nam(new QNetworkAccessManager(this)) {
+      m_transport(new NetworkTransport(this)),
+      m_syncPipeline(new SyncPipeline(this)),
+      m_requestMetrics(new RequestMetrics(this)) {
+    this->m_snapshotTimer.setSingleShot(true);
+
+    QObject::connect(&this->m_snapshotTimer,
+                     &QTimer::timeout,
+                     this,
+                     &Client::saveSnapshot);
+}
+
+Client::~Client() {
+    if (this->m_snapshotTimer.isActive())
+        this->saveSnapshot();
+
+    delete this->m_filterCache;
+    delete this->m_recorder;
 }
 
 /* Client::Client(const QString &host,
@@ -56,8 +80,27 @@ void Client::restore(const QString &userId,
     this->deviceId      = deviceId;
     this->m_accessToken = accessToken;
 
-    if (this->m_encryption)
-        this->m_olm = new Olm(this);
+    // Filter IDs are only valid for the user who uploaded them
+    delete this->m_filterCache;
+    this->m_filterCache = new FilterCache(this->storeDir.filePath(
+        "filters_" + QUrl::toPercentEncoding(userId + ".json")));
+
+    // Resume from where we were, unless we synced already
+    if (this->persistSync && this->rooms.isEmpty() &&
+        this->m_nextBatch.isEmpty() &&
+        SyncSnapshot::load(
+            this->snapshotPath(), this, &this->m_nextBatch, &this->rooms))
+        qDebug() << "Restored" << this->rooms.size() << "rooms from snapshot";
+
+    if (!this->m_encryption)
+        return;
+
+    this->m_olm = new Olm(this);
+
+    QObject::connect(this->m_olm,
+                     &Olm::roomEventDecrypted,
+                     this,
+                     &Client::onRoomEventDecrypted);
 }
 
 // Api routines
@@ -119,38 +162,169 @@ ResponseFuture *Client::sync(const QString &filter,
                              bool           fullState,
                              Presence       presence,
                              int            timeout) {
-    // Send keys if not sent yet and wait for it
-    if (this->m_olm && !this->m_olm->deviceKeysUploaded)
-        this->m_olm->sendKeys()->result();
+    ResponseFuture *future =
+        this->syncRequest(filter, since, fullState, presence, timeout);
 
-    QUrlQuery query;
+    this->applySync(future, [=](SyncResponse response) {
+        this->onSyncResponse(response);
+    });
 
-    if (!filter.isEmpty())
-        query.addQueryItem("filter", filter);
+    return future;
+}
 
-    if (!since.isEmpty())
-        query.addQueryItem("since", since);
-    else if (!this->m_nextBatch.isEmpty())
-        query.addQueryItem("since", this->m_nextBatch);
+ResponseFuture *Client::sync(const Filter & filter,
+                             const QString &since,
+                             bool           fullState,
+                             Presence       presence,
+                             int            timeout) {
+    return this->sync(
+        this->filterParam(filter), since, fullState, presence, timeout);
+}
 
-    query.addQueryItem("full_state", fullState ? "true" : "false");
-    query.addQueryItem("presence",
-                       presence == PRESENCE_ONLINE        ? "online"
-                       : presence == PRESENCE_UNAVAILABLE ? "unavailable"
-                                                          : "offline");
+ResponseFuture *Client::uploadFilter(const Filter &filter) {
+    QByteArray hash = filter.hash();
 
-    query.addQueryItem("timeout", QString::number(timeout));
+    ResponseFuture *future = this->send(
+        "/_matrix/client/r0/user/" + QUrl::toPercentEncoding(this->m_userId) +
+            "/filter",
+        QJsonDocument::fromJson(filter.toJson()).object().toVariantMap());
 
-    ResponseFuture *future = this->get("/_matrix/client/r0/sync", query);
+    this->m_uploadingFilters.insert(hash);
 
-    QObject::connect(
-        future, &ResponseFuture::responseComplete, [=](Response response) {
-            this->onSyncResponse(response);
-        });
+    future->always([=](Response response) {
+        this->m_uploadingFilters.remove(hash);
+
+        FilterResponse filterResponse = response;
+
+        if (filterResponse.isBroken() || filterResponse.isError()) {
+            qWarning() << "Could not upload filter" << hash;
+            return;
+        }
+
+        if (this->m_filterCache)
+            this->m_filterCache->insert(hash, filterResponse.filterId);
+    });
 
     return future;
 }
 
+ResponseFuture *Client::getMessages(const QString &roomId,
+                                    const QString &from,
+                                    bool           backwards,
+                                    int            limit,
+                                    const QString &to) {
+    QUrlQuery query;
+
+    query.addQueryItem("from", from);
+    query.addQueryItem("dir", backwards ? "b" : "f");
+    query.addQueryItem("limit", QString::number(limit));
+
+    if (!to.isEmpty())
+        query.addQueryItem("to", to);
+
+    return this->get("/_matrix/client/r0/rooms/" +
+                         QUrl::toPercentEncoding(roomId) + "/messages",
+                     query);
+}
+
+void Client::startSync(const QString &filter, Presence presence) {
+    this->m_syncFilter = filter;
+    this->m_syncTyped  = false;
+    this->startSyncLoop(presence);
+}
+
+void Client::startSync(const Filter &filter, Presence presence) {
+    this->m_syncTypedFilter = filter;
+    this->m_syncTyped       = true;
+    this->startSyncLoop(presence);
+}
+
+void Client::startSyncLoop(Presence presence) {
+    this->m_syncPresence = presence;
+
+    if (this->m_syncing)
+        return;
+
+    this->m_syncing      = true;
+    this->m_syncPaused   = false;
+    this->m_syncFailures = 0;
+
+    if (!this->m_syncFuture)
+        this->syncNext();
+}
+
+void Client::stopSync() {
+    this->m_syncing    = false;
+    this->m_syncPaused = false;
+
+    if (!this->m_syncFuture)
+        return;
+
+    // Completion handler of an aborted request must not see it as ours
+    ResponseFuture *future = this->m_syncFuture;
+    this->m_syncFuture     = nullptr;
+    future->abort();
+}
+
+void Client::pauseSync() {
+    if (this->m_syncing)
+        this->m_syncPaused = true;
+}
+
+void Client::resumeSync() {
+    if (!this->m_syncing || !this->m_syncPaused)
+        return;
+
+    this->m_syncPaused = false;
+
+    if (!this->m_syncFuture)
+        this->syncNext();
+}
+
+bool Client::isSyncing() const {
+    return this->m_syncing;
+}
+
+SyncStats Client::syncStats() const {
+    return this->m_syncPipeline->stats();
+}
+
+void Client::resetSyncStats() {
+    this->m_syncPipeline->resetStats();
+}
+
+QList<EndpointStats> Client::requestStats() const {
+    return this->m_requestMetrics->stats();
+}
+
+void Client::resetRequestStats() {
+    this->m_requestMetrics->reset();
+}
+
+QByteArray Client::prometheusMetrics() const {
+    return this->m_requestMetrics->toPrometheus();
+}
+
+bool Client::startRecording(const QString &path) {
+    delete this->m_recorder;
+    this->m_recorder = new SyncRecorder(path);
+
+    if (this->m_recorder->isOpen())
+        return true;
+
+    this->stopRecording();
+    return false;
+}
+
+void Client::stopRecording() {
+    delete this->m_recorder;
+    this->m_recorder = nullptr;
+}
+
+bool Client::isRecording() const {
+    return this->m_recorder;
+}
+
 ResponseFuture *Client::send(QString path, QVariantMap data) const {
     QUrl requestUrl = this->homeserverUrl;
     requestUrl.setPath(path);
@@ -176,6 +350,27 @@ QString Client::accessToken() const {
     return this->m_accessToken;
 }
 
+QString Client::nextBatch() const {
+    return this->m_nextBatch;
+}
+
+Transport *Client::transport() const {
+    return this->m_transport;
+}
+
+void Client::setTransport(Transport *transport) {
+    if (!transport || transport == this->m_transport)
+        return;
+
+    if (this->m_transport->parent() == this)
+        this->m_transport->deleteLater();
+
+    if (!transport->parent())
+        transport->setParent(this);
+
+    this->m_transport = transport;
+}
+
 // Protected slots
 
 void Client::onLoginResponse(LoginResponse response) {
@@ -198,47 +393,362 @@ void Client::onDiscoveryResponse(WellKnownResponse response) {
 }
 
 void Client::onSyncResponse(SyncResponse response) {
+    this->applySyncResponse(response, true);
+}
+
+void Client::onRoomJoinUpdate(const QMap<QString, RoomUpdate> &roomsUpdates) {
+    this->applyRoomJoinUpdate(roomsUpdates, true);
+}
+
+void Client::applyRoomJoinUpdate(const QMap<QString, RoomUpdate> &roomsUpdates,
+                                 bool                              live) {
+    QVector<QPair<Room *, const RoomUpdate *>> batch;
+    batch.reserve(roomsUpdates.size());
+
+    // Rooms are created here, on the Client thread, so workers only read
+    // this->rooms
+    QMap<QString, RoomUpdate>::const_iterator it = roomsUpdates.constBegin();
+    for (; it != roomsUpdates.constEnd(); ++it) {
+        // TODO: check if room is on invites
+
+        Room *&room = this->rooms[it.key()];
+
+        if (!room)
+            room = new Room(it.key(), this);
+
+        batch.append({room, &it.value()});
+    }
+
+    if (this->applyThreads > 1 && batch.size() > 1) {
+        // Calling thread is one of them
+        this->m_applyPool.setMaxThreadCount(this->applyThreads - 1);
+
+        Utils::parallelFor(this->m_applyPool, batch.size(), [&](int i) {
+            this->applyRoomUpdate(batch[i].first, *batch[i].second);
+        });
+    } else
+        for (const QPair<Room *, const RoomUpdate *> &entry : batch)
+            this->applyRoomUpdate(entry.first, *entry.second);
+
+    for (const QPair<Room *, const RoomUpdate *> &entry : batch) {
+        if (live && this->fillTimelineGaps &&
+            entry.second->timeline.value("limited").toBool())
+            entry.first->fillGaps();
+
+        emit entry.first->changed();
+    }
+}
+
+void Client::onToDeviceEvents(const QList<ToDeviceEvent> &events) {
+    QList<ToDeviceEvent> encrypted;
+
+    for (const ToDeviceEvent &event : events) {
+        if (event.type != Event::M_ROOM_ENCRYPTED)
+            emit this->toDeviceEvent(event);
+        else if (this->m_olm)
+            encrypted.append(event);
+        else
+            qWarning() << "Got encrypted to-device event from" << event.sender
+                       << "but encryption is disabled";
+    }
+
+    // Decrypted on worker threads, emitted through toDeviceEvent
+    if (!encrypted.isEmpty())
+        this->m_olm->decryptToDevice(encrypted);
+}
+
+void Client::onRoomEventDecrypted(QString roomId, RoomEvent event) {
+    Room *room = this->rooms.value(roomId);
+
+    if (!room ||
+        !this->parseFilter.accepts(ParseFilter::SECTION_TIMELINE,
+                                   event.typeName))
+        return;
+
+    room->onEvent(event);
+    room->replaceTimelineEvent(event);
+    emit room->changed();
+}
+
+void Client::applyRoomUpdate(Room *room, const RoomUpdate &update) {
+    for (StateEvent event : update.state)
+        room->onEvent(event);
+
+    const QJsonArray timeline = update.timeline.value("events").toArray();
+    QList<RoomEvent> applied;
+
+    // A sync retried after a failed streamed one delivers again the events
+    // of the rooms it applied
+    const QSet<QString> known =
+        room->timeline().lastEventIds(timeline.size());
+    bool skipped = false;
+
+    for (const QJsonValue &rawEvent : timeline) {
+        RoomEvent event = rawEvent;
+        bool      held;
+
+        if (known.contains(event.eventId)) {
+            skipped = true;
+            continue;
+        }
+
+        if (!this->prepareTimelineEvent(room, event, &held))
+            continue;
+
+        // Held events are applied by onRoomEventDecrypted, which replaces
+        // them in the timeline
+        if (!held)
+            room->onEvent(event);
+
+        applied.append(event);
+    }
+
+    // What is left continues the batch applied before
+    if (skipped)
+        room->appendTimeline(applied, false, QString());
+    else
+        room->appendTimeline(applied,
+                             update.timeline.value("limited").toBool(),
+                             update.timeline.value("prev_batch").toString());
+}
+
+// Private
+
+void Client::applySyncResponse(const SyncResponse &response, bool live) {
     if (response.isBroken() || response.isError())
         return;
 
     this->m_nextBatch = response.nextBatch;
 
+    // Keep one long-poll request outstanding while we apply this response
+    if (live && this->m_syncing && !this->m_syncPaused && !this->m_syncFuture)
+        this->syncNext();
+
     if (!response.rooms.join.isEmpty())
-        this->onRoomJoinUpdate(response.rooms.join);
+        this->applyRoomJoinUpdate(response.rooms.join, live);
+
+    // Streamed rooms were applied already, so this covers them too
+    this->trimTimelines();
+
+    // Replayed ones only touch rooms: nothing is decrypted, saved or sent
+    if (!live)
+        return;
+
+    if (!response.toDevice.isEmpty())
+        this->onToDeviceEvents(response.toDevice);
+
+    if (this->persistSync && !this->m_snapshotTimer.isActive())
+        this->m_snapshotTimer.start(this->persistDelay);
 
     // From now on handle olm stuff
     if (!this->m_encryption)
         return;
 
     this->m_olm->uploadedOneTimeKeys =
-        response.deviceOneTimeKeysCount["signed_curve25519"].toInt();
+        response.deviceOneTimeKeysCount.value("signed_curve25519").toInt();
 
-    // Upload one time keys if needed
-    if (this->m_olm->shouldUploadOneTimeKeys())
-        this->m_olm->sendKeys()
-            ->result(); // We should wait until next sync call
+    // Upload one time keys if needed. The count is refreshed by next sync
+    this->m_olm->sendKeysIfNeeded();
 }
 
-void Client::onRoomJoinUpdate(const QMap<QString, RoomUpdate> &roomsUpdates) {
-    QMap<QString, RoomUpdate>::const_iterator it = roomsUpdates.begin();
-    do {
-        // TODO: check if room is on invites
+bool Client::prepareTimelineEvent(Room *room, RoomEvent &event, bool *held) {
+    *held = false;
 
-        if (!this->rooms.contains(it.key()))
-            this->rooms.insert(it.key(), new Room(it.key(), this));
+    if (!this->parseFilter.accepts(ParseFilter::SECTION_TIMELINE,
+                                   event.typeName))
+        return false;
 
-        Room *room = this->rooms[it.key()];
+    if (event.type == Event::M_ROOM_ENCRYPTED && this->m_olm) {
+        if (!this->m_olm->decryptRoomEvent(room->roomId, event, held))
+            return false;
 
-        for (StateEvent event : it.value().state)
-            room->onEvent(event);
+        if (*held)
+            return true;
+    }
 
-        for (RoomEvent event : it.value().timeline["events"].toList()) {
-            room->onEvent(event);
+    // Now that its real type is known
+    return event.type == Event::M_ROOM_ENCRYPTED ||
+           this->parseFilter.accepts(ParseFilter::SECTION_TIMELINE,
+                                     event.typeName);
+}
+
+void Client::trimTimelines() {
+    if (this->timelineBudget <= 0)
+        return;
+
+    QVector<QPair<quint64, Room *>> used;
+    qint64                          bytes = 0;
+
+    used.reserve(this->rooms.size());
+
+    for (Room *room : qAsConst(this->rooms)) {
+        qint64 roomBytes = room->timelineBytes();
+
+        if (roomBytes > 0) {
+            used.append({room->lastUsed(), room});
+            bytes += roomBytes;
+        }
+    }
+
+    if (bytes <= this->timelineBudget)
+        return;
+
+    std::sort(used.begin(), used.end());
+
+    for (int i = 0; i < used.size() && bytes > this->timelineBudget; i++) {
+        Room *room = used[i].second;
+
+        bytes -= room->timelineBytes();
+        room->clearTimeline();
+
+        qDebug() << "TIMELINE dropped timeline of" << room->roomId;
+    }
+}
+
+ResponseFuture *Client::syncRequest(const QString &filter,
+                                    const QString &since,
+                                    bool           fullState,
+                                    Presence       presence,
+                                    int            timeout) {
+    // Send keys if not sent yet. The server does not need them to answer
+    // the sync, so do not wait for the upload
+    if (this->m_olm)
+        this->m_olm->sendKeysIfNeeded();
+
+    QUrlQuery query;
+
+    if (!filter.isEmpty())
+        query.addQueryItem("filter", filter);
+
+    if (!since.isEmpty())
+        query.addQueryItem("since", since);
+    else if (!this->m_nextBatch.isEmpty())
+        query.addQueryItem("since", this->m_nextBatch);
+
+    query.addQueryItem("full_state", fullState ? "true" : "false");
+    query.addQueryItem("presence",
+                       presence == PRESENCE_ONLINE        ? "online"
+                       : presence == PRESENCE_UNAVAILABLE ? "unavailable"
+                                                          : "offline");
+
+    query.addQueryItem("timeout", QString::number(timeout));
+
+    ResponseFuture *future = this->get("/_matrix/client/r0/sync", query);
+
+    // Whatever the recorder is once the response arrives
+    if (this->m_recorder)
+        future->tapBody([=](QByteArray body) {
+            if (this->m_recorder)
+                this->m_recorder->record(body);
+        });
+
+    if (this->streamSync) {
+        future->streamSync(this->parseFilter);
+
+        QObject::connect(future,
+                         &ResponseFuture::roomJoinUpdate,
+                         [=](QString roomId, RoomUpdate update) {
+                             if (!update.isBroken())
+                                 this->onRoomJoinUpdate({{roomId, update}});
+                         });
+    }
+
+    return future;
+}
+
+void Client::syncNext() {
+    // Typed filter is resolved again for every request, so its ID is used as
+    // soon as it is uploaded
+    ResponseFuture *future = this->syncRequest(
+        this->m_syncTyped ? this->filterParam(this->m_syncTypedFilter)
+                          : this->m_syncFilter,
+        "",
+        false,
+        this->m_syncPresence,
+        this->syncTimeout);
+    this->m_syncFuture     = future;
+
+    this->applySync(future, [=](SyncResponse response) {
+        // Stopped (and maybe restarted) while this request was ongoing
+        if (this->m_syncFuture != future)
+            return;
+
+        this->m_syncFuture = nullptr;
+
+        if (response.isBroken() || response.isError()) {
+            // Back off exponentially, up to syncMaxRetryDelay
+            int delay = qMin(1000 << qMin(this->m_syncFailures++, 16),
+                             this->syncMaxRetryDelay);
+
+            qWarning() << "SYNC request failed, retrying in" << delay
+                       << "ms";
+
+            QTimer::singleShot(delay, this, [=]() {
+                if (this->m_syncing && !this->m_syncPaused &&
+                    !this->m_syncFuture)
+                    this->syncNext();
+            });
+            return;
         }
-    } while (++it != roomsUpdates.end());
+
+        this->m_syncFailures = 0;
+
+        // onSyncResponse issues the next request as soon as next_batch is
+        // known
+        this->onSyncResponse(response);
+    });
 }
 
-// Private
+void Client::saveSnapshot() {
+    this->m_snapshotTimer.stop();
+
+    if (this->m_nextBatch.isEmpty())
+        return;
+
+    SyncSnapshot::save(this->snapshotPath(), this->m_nextBatch, this->rooms);
+}
+
+QString Client::filterParam(const Filter &filter) {
+    QByteArray hash = filter.hash();
+
+    if (this->m_filterCache && !this->m_filterCache->value(hash).isEmpty())
+        return this->m_filterCache->value(hash);
+
+    if (!this->m_userId.isEmpty() && !this->m_uploadingFilters.contains(hash))
+        this->uploadFilter(filter);
+
+    // Inline JSON is accepted as well
+    return filter.toJson();
+}
+
+QString Client::snapshotPath() const {
+    return this->storeDir.filePath(
+        "sync_" + QUrl::toPercentEncoding(this->m_userId + "_" +
+                                          this->deviceId + ".bin"));
+}
+
+void Client::applySync(ResponseFuture *                   future,
+                       std::function<void(SyncResponse)> callback) {
+    if (this->syncThreads <= 0 || this->streamSync) {
+        QObject::connect(
+            future, &ResponseFuture::responseComplete, [=](Response response) {
+                callback(SyncResponse(response, this->parseFilter));
+            });
+        return;
+    }
+
+    future->deferParse([=](QByteArray body) {
+        this->m_syncPipeline->setMaxThreadCount(this->syncThreads);
+        this->m_syncPipeline->submit(
+            body,
+            [=](const SyncResponse &response) {
+                // Apply before firing, as handlers of the future expect
+                callback(response);
+                future->complete(response);
+            },
+            this->parseFilter);
+    });
+}
 
 ResponseFuture *Client::get(QUrl url) const {
     QNetworkRequest request(url);
@@ -251,8 +761,10 @@ ResponseFuture *Client::get(QUrl url) const {
                              "Bearer " + this->m_accessToken.toUtf8());
 
     qDebug() << "GET" << url.path();
-    QNetworkReply *reply = this->m_nam->get(request);
+    QNetworkReply *reply = this->m_transport->get(request);
 
+    // Before ResponseFuture, which reads the reply as it comes
+    this->m_requestMetrics->track(reply, "GET", 0);
     QObject::connect(this, SIGNAL(abortRequests()), reply, SLOT(abort()));
 
     return new ResponseFuture(reply);
@@ -272,8 +784,9 @@ ResponseFuture *Client::send(QUrl url, QVariantMap data) const {
     QByteArray postData = QJsonDocument::fromVariant(data).toJson();
 
     qDebug() << "POST" << url.path();
-    QNetworkReply *reply = this->m_nam->post(request, postData);
+    QNetworkReply *reply = this->m_transport->post(request, postData);
 
+    this->m_requestMetrics->track(reply, "POST", postData.size());
     QObject::connect(this, SIGNAL(abortRequests()), reply, SLOT(abort()));
 
     return new ResponseFuture(reply);
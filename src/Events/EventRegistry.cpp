@@ -0,0 +1,129 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file EventRegistry.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements EventRegistry
+ * @version 0.1
+ * @date 2021-03-08
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <MatrixCpp/EventRegistry.hpp>
+
+using namespace MatrixCpp::Types;
+
+/**
+ * @brief FNV-1a hash, usable at compile time for case labels
+ *
+ */
+static constexpr quint32 fnv1a(const char *str, quint32 hash = 2166136261u) {
+    return *str ? fnv1a(str + 1, (hash ^ (quint8) *str) * 16777619u) : hash;
+}
+
+static quint32 fnv1a(const QString &str) {
+    quint32 hash = 2166136261u;
+
+    // Type strings are ASCII. Anything else cannot match a core type anyway
+    for (QChar c : str)
+        hash = (hash ^ (quint8) c.unicode()) * 16777619u;
+
+    return hash;
+}
+
+/**
+ * @brief Case for a core type. Duplicated hashes fail to compile, so the hash
+   is perfect for the core set and one comparison confirms the match. The
+   name handed out is static data, so copies of it never allocate nor lock
+ *
+ */
+#define CORE_TYPE(name, value)                    \
+    case fnv1a(name):                             \
+        if (typeName == QLatin1String(name)) {    \
+            if (interned)                         \
+                *interned = QStringLiteral(name); \
+            return Event::value;                  \
+        }                                         \
+        break;
+
+EventRegistry &EventRegistry::instance() {
+    static EventRegistry registry;
+    return registry;
+}
+
+Event::Type EventRegistry::registerType(const QString &typeName,
+                                        Handler        handler) {
+    QWriteLocker locker(&this->m_lock);
+
+    int type = coreType(typeName);
+
+    if (type == Event::M_OTHER) {
+        type = this->m_types.value(typeName, Event::M_OTHER);
+
+        if (type == Event::M_OTHER) {
+            type = this->m_nextType++;
+            this->m_types.insert(Identifier(typeName).toString(), type);
+        }
+    }
+
+    if (handler)
+        this->m_handlers.insert(type, handler);
+    else
+        this->m_handlers.remove(type);
+
+    return (Event::Type) type;
+}
+
+Event::Type EventRegistry::lookup(const QString &typeName, QString *interned) {
+    Event::Type type = coreType(typeName, interned);
+
+    if (type != Event::M_OTHER)
+        return type;
+
+    QReadLocker locker(&this->m_lock);
+
+    QHash<QString, int>::const_iterator it = this->m_types.constFind(typeName);
+
+    // Only registered names are shared. A remote server can send any number
+    // of other types, which would never be freed
+    if (interned)
+        *interned = it != this->m_types.constEnd() ? it.key() : typeName;
+
+    return it != this->m_types.constEnd() ? (Event::Type) *it
+                                          : Event::M_OTHER;
+}
+
+EventRegistry::Handler EventRegistry::handler(Event::Type type) const {
+    QReadLocker locker(&this->m_lock);
+    return this->m_handlers.value(type);
+}
+
+Event::Type EventRegistry::coreType(const QString &typeName,
+                                    QString *      interned) {
+    switch (fnv1a(typeName)) {
+        // Presence events
+        CORE_TYPE("m.presence", M_PRESENCE)
+
+        // Room events
+        CORE_TYPE("m.room.member", M_ROOM_MEMBER)
+        CORE_TYPE("m.room.message", M_ROOM_MESSAGE)
+        CORE_TYPE("m.room.name", M_ROOM_NAME)
+        CORE_TYPE("m.room.create", M_ROOM_CREATE)
+        CORE_TYPE("m.room.encryption", M_ROOM_ENCRYPTION)
+        CORE_TYPE("m.room.encrypted", M_ROOM_ENCRYPTED)
+        CORE_TYPE("m.room.power_levels", M_ROOM_POWER_LEVELS)
+
+        // Ephemeral events
+        CORE_TYPE("m.typing", M_TYPING)
+
+        // To-device events
+        CORE_TYPE("m.room_key", M_ROOM_KEY)
+
+        default:
+            break;
+    }
+
+    return Event::M_OTHER;
+}
@@ -20,10 +20,10 @@ using namespace MatrixCpp::Types;
  */
 
 void EventContent::parseData() {
-    QVariantMap dataMap = this->data.toMap();
-    BROKEN(dataMap["membership"].isNull())
+    const QJsonObject dataObject = this->data.toObject();
+    BROKEN(!dataObject.contains("membership"))
 
-    QString membership = dataMap["membership"].toString();
+    QString membership = dataObject.value("membership").toString();
     this->membership   = MEMBERSHIP_UNKNOWN;
 
     if (membership == "invite")
@@ -37,10 +37,10 @@ void EventContent::parseData() {
     else if (membership == "ban")
         this->membership = MEMBERSHIP_BAN;
 
-    this->avatarUrl    = dataMap["avatar_url"].toString();
-    this->displayName  = dataMap["displayname"].toString();
-    this->isDirect     = dataMap["is_direct"].toBool();
-    this->unsignedData = dataMap["unsigned"];
+    this->avatarUrl    = dataObject.value("avatar_url").toString();
+    this->displayName  = dataObject.value("displayname").toString();
+    this->isDirect     = dataObject.value("is_direct").toBool();
+    this->unsignedData = dataObject.value("unsigned");
 }
 
 /*
@@ -48,13 +48,13 @@ void EventContent::parseData() {
  */
 
 void RoomEncryptionContent::parseData() {
-    QVariantMap dataMap = this->data.toMap();
+    const QJsonObject dataObject = this->data.toObject();
 
-    this->algorithm = dataMap["algorithm"].toString();
+    this->algorithm = dataObject.value("algorithm").toString();
     BROKEN(this->algorithm.isEmpty())
 
-    this->rotationPeriod    = dataMap["rotation_period_ms"].toInt();
-    this->msgRotationPeriod = dataMap["rotation_period_msgs"].toInt();
+    this->rotationPeriod    = dataObject.value("rotation_period_ms").toInt();
+    this->msgRotationPeriod = dataObject.value("rotation_period_msgs").toInt();
 }
 
 /*
@@ -62,29 +62,97 @@ void RoomEncryptionContent::parseData() {
  */
 
 void RoomNameContent::parseData() {
-    QVariantMap dataMap = this->data.toMap();
+    const QJsonObject dataObject = this->data.toObject();
 
-    this->name = dataMap["name"].toString();
+    this->name = dataObject.value("name").toString();
     BROKEN(this->name.isEmpty())
 }
 
+/*
+ * PowerLevelsContent
+ */
+
+/**
+ * @brief Reads a power level. Older rooms may have them as strings
+ *
+ */
+static int powerLevel(const QJsonValue &value, int fallback) {
+    if (!value.isString())
+        return value.toInt(fallback);
+
+    bool ok;
+    int  level = value.toString().toInt(&ok);
+
+    return ok ? level : fallback;
+}
+
+void PowerLevelsContent::parseData() {
+    const QJsonObject dataObject = this->data.toObject();
+
+    this->usersDefault  = powerLevel(dataObject.value("users_default"), 0);
+    this->eventsDefault = powerLevel(dataObject.value("events_default"), 0);
+    this->stateDefault  = powerLevel(dataObject.value("state_default"), 50);
+    this->ban           = powerLevel(dataObject.value("ban"), 50);
+    this->kick          = powerLevel(dataObject.value("kick"), 50);
+    this->redact        = powerLevel(dataObject.value("redact"), 50);
+    this->invite        = powerLevel(dataObject.value("invite"), 0);
+
+    const QJsonObject users  = dataObject.value("users").toObject();
+    const QJsonObject events = dataObject.value("events").toObject();
+
+    this->users.reserve(users.size());
+    this->events.reserve(events.size());
+
+    for (QJsonObject::const_iterator it = users.begin(); it != users.end();
+         ++it)
+        this->users.insert(it.key(),
+                           powerLevel(it.value(), this->usersDefault));
+
+    for (QJsonObject::const_iterator it = events.begin(); it != events.end();
+         ++it)
+        this->events.insert(it.key(),
+                            powerLevel(it.value(), this->eventsDefault));
+}
+
+PowerLevelsContent
+PowerLevelsContent::noPowerLevels(const Identifier &creator) {
+    PowerLevelsContent levels;
+
+    levels.m_broken     = false;
+    levels.stateDefault = 0;
+
+    if (!creator.isEmpty())
+        levels.users.insert(creator, 100);
+
+    return levels;
+}
+
+int PowerLevelsContent::userLevel(const Identifier &userId) const {
+    return this->users.value(userId, this->usersDefault);
+}
+
+int PowerLevelsContent::eventLevel(const QString &eventType, bool state) const {
+    return this->events.value(
+        eventType, state ? this->stateDefault : this->eventsDefault);
+}
+
 /*
  * RoomEvent
  */
 
 void RoomEvent::parseData() {
-    QVariantMap dataMap = this->data.toMap();
+    const QJsonObject dataObject = this->data.toObject();
 
-    this->eventId = dataMap["event_id"].toString();
+    this->eventId = dataObject.value("event_id").toString();
     BROKEN(this->eventId.isEmpty())
 
-    this->sender = dataMap["sender"].toString();
+    this->sender = dataObject.value("sender").toString();
     BROKEN(this->sender.isEmpty())
 
-    this->serverTs = dataMap["origin_server_ts"].toInt();
+    this->serverTs = (qint64) dataObject.value("origin_server_ts").toDouble();
     BROKEN(this->serverTs == 0)
 
-    this->unsignedData = dataMap["unsigned"];
+    this->unsignedData = dataObject.value("unsigned");
 }
 
 /*
@@ -92,10 +160,10 @@ void RoomEvent::parseData() {
  */
 
 void StateEvent::parseData() {
-    QVariantMap dataMap = this->data.toMap();
+    const QJsonObject dataObject = this->data.toObject();
 
-    this->stateKey    = dataMap["state_key"].toString();
-    this->prevContent = dataMap["prev_content"];
+    this->stateKey    = dataObject.value("state_key").toString();
+    this->prevContent = dataObject.value("prev_content");
 }
 
 /*
@@ -103,13 +171,26 @@ void StateEvent::parseData() {
  */
 
 void StrippedStateEvent::parseData() {
-    QVariantMap dataMap = this->data.toMap();
+    const QJsonObject dataObject = this->data.toObject();
 
-    this->content = dataMap["content"];
+    this->content = dataObject.value("content");
     BROKEN(this->content.isBroken())
 
-    this->sender = dataMap["seneder"].toString();
+    this->sender = dataObject.value("sender").toString();
+    BROKEN(this->sender.isEmpty())
+
+    this->stateKey = dataObject.value("state_key").toString();
+}
+
+/*
+ * ToDeviceEvent
+ */
+
+void ToDeviceEvent::parseData() {
+    const QJsonObject dataObject = this->data.toObject();
+
+    this->sender = dataObject.value("sender").toString();
     BROKEN(this->sender.isEmpty())
 
-    this->stateKey = dataMap["state_key"].toString();
+    this->senderKey = this->content.value("sender_key").toString();
 }
\ No newline at end of file
@@ -0,0 +1,158 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file Filter.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements sync filter builders
+ * @version 0.1
+ * @date 2021-03-17
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QCryptographicHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include <MatrixCpp/Filter.hpp>
+
+using namespace MatrixCpp;
+
+/**
+ * @brief Sets key to list, unless list is empty
+ *
+ */
+static void insertList(QJsonObject &      json,
+                       const QString &    key,
+                       const QStringList &list) {
+    if (!list.isEmpty())
+        json.insert(key, QJsonArray::fromStringList(list));
+}
+
+/*
+ * EventFilter
+ */
+
+QJsonObject EventFilter::toJson() const {
+    QJsonObject json;
+
+    if (this->limit >= 0)
+        json.insert("limit", this->limit);
+
+    insertList(json, "types", this->types);
+    insertList(json, "not_types", this->notTypes);
+    insertList(json, "senders", this->senders);
+    insertList(json, "not_senders", this->notSenders);
+
+    return json;
+}
+
+/*
+ * RoomEventFilter
+ */
+
+QJsonObject RoomEventFilter::toJson() const {
+    QJsonObject json = EventFilter::toJson();
+
+    insertList(json, "rooms", this->rooms);
+    insertList(json, "not_rooms", this->notRooms);
+
+    if (this->lazyLoadMembers)
+        json.insert("lazy_load_members", true);
+
+    if (this->includeRedundantMembers)
+        json.insert("include_redundant_members", true);
+
+    return json;
+}
+
+/*
+ * RoomFilter
+ */
+
+QJsonObject RoomFilter::toJson() const {
+    QJsonObject json;
+
+    insertList(json, "rooms", this->rooms);
+    insertList(json, "not_rooms", this->notRooms);
+
+    if (this->includeLeave)
+        json.insert("include_leave", true);
+
+    const QPair<QString, const RoomEventFilter *> sections[] = {
+        {"timeline", &this->timeline},
+        {"state", &this->state},
+        {"ephemeral", &this->ephemeral},
+        {"account_data", &this->accountData}};
+
+    for (const auto &section : sections) {
+        QJsonObject filter = section.second->toJson();
+
+        if (!filter.isEmpty())
+            json.insert(section.first, filter);
+    }
+
+    return json;
+}
+
+/*
+ * Filter
+ */
+
+QByteArray Filter::toJson() const {
+    QJsonObject json;
+    QJsonObject room        = this->room.toJson();
+    QJsonObject presence    = this->presence.toJson();
+    QJsonObject accountData = this->accountData.toJson();
+
+    // Excluding every type is how the filter API disables a section
+    if (!this->includePresence)
+        presence = QJsonObject({{"not_types", QJsonArray({"*"})}});
+
+    if (!this->includeAccountData)
+        accountData = QJsonObject({{"not_types", QJsonArray({"*"})}});
+
+    if (!room.isEmpty())
+        json.insert("room", room);
+
+    if (!presence.isEmpty())
+        json.insert("presence", presence);
+
+    if (!accountData.isEmpty())
+        json.insert("account_data", accountData);
+
+    insertList(json, "event_fields", this->eventFields);
+
+    // QJsonObject keeps keys sorted
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+QByteArray Filter::hash() const {
+    return QCryptographicHash::hash(this->toJson(), QCryptographicHash::Sha256)
+        .toHex();
+}
+
+/*
+ * ParseFilter
+ */
+
+bool ParseFilter::wants(Section section) const {
+    return this->sections & section;
+}
+
+bool ParseFilter::accepts(Section section, const QString &type) const {
+    if (!this->wants(section))
+        return false;
+
+    if (this->types.isEmpty() || this->types.contains(type))
+        return true;
+
+    // Real type is only known once decrypted
+    return type == QLatin1String("m.room.encrypted") &&
+           (section == SECTION_TIMELINE || section == SECTION_TO_DEVICE);
+}
+
+bool ParseFilter::keeps(Section section, const QJsonValue &event) const {
+    return this->accepts(section, event.toObject().value("type").toString());
+}
@@ -0,0 +1,60 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file FilterCache.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements FilterCache
+ * @version 0.1
+ * @date 2021-03-17
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QDebug>
+#include <QVariantMap>
+
+#include "FilterCache.hpp"
+
+using namespace MatrixCpp;
+
+FilterCache::FilterCache(QString path) : JsonFile(path) {
+    if (!this->file.exists())
+        return;
+
+    try {
+        const QVariantMap ids = this->read().toMap();
+
+        QVariantMap::const_iterator it = ids.constBegin();
+        for (; it != ids.constEnd(); ++it)
+            this->m_ids.insert(it.key().toUtf8(), it.value().toString());
+    } catch (const std::runtime_error &error) {
+        // Filters are simply uploaded again
+        qWarning() << error.what();
+    }
+}
+
+QString FilterCache::value(const QByteArray &hash) const {
+    return this->m_ids.value(hash);
+}
+
+void FilterCache::insert(const QByteArray &hash, const QString &filterId) {
+    this->m_ids.insert(hash, filterId);
+
+    try {
+        this->save();
+    } catch (const std::runtime_error &error) {
+        // Still cached for this session
+        qWarning() << error.what();
+    }
+}
+
+QVariant FilterCache::encode() {
+    QVariantMap ids;
+
+    QHash<QByteArray, QString>::const_iterator it = this->m_ids.constBegin();
+    for (; it != this->m_ids.constEnd(); ++it)
+        ids.insert(QString::fromUtf8(it.key()), it.value());
+
+    return ids;
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file FilterCache.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares FilterCache, which remembers uploaded filter IDs
+ * @version 0.1
+ * @date 2021-03-17
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QHash>
+
+#include "src/Utils.hpp"
+
+namespace MatrixCpp {
+/**
+ * @brief Maps filter hashes (see Filter::hash()) to the filter IDs the server
+   gave them, saved to a JSON file
+ *
+ */
+class FilterCache : public JsonFile {
+  public:
+    /**
+     * @brief Construct a new FilterCache object, loading path if it exists
+     *
+     * @param path
+     */
+    explicit FilterCache(QString path);
+
+    /**
+     * @brief Get the filter ID of a filter
+     *
+     * @param hash
+     * @return QString Empty if the filter was not uploaded
+     */
+    QString value(const QByteArray &hash) const;
+
+    /**
+     * @brief Remembers the filter ID of a filter and saves the cache
+     *
+     * @param hash
+     * @param filterId
+     */
+    void insert(const QByteArray &hash, const QString &filterId);
+
+  protected:
+    QVariant encode() override;
+
+  private:
+    QHash<QByteArray, QString> m_ids;
+};
+} // namespace MatrixCpp
@@ -0,0 +1,128 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file Identifier.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements Identifier and its intern table
+ * @version 0.1
+ * @date 2021-03-19
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QHash>
+#include <QReadWriteLock>
+
+#include <MatrixCpp/Identifier.hpp>
+
+using namespace MatrixCpp::Types;
+
+struct MatrixCpp::Types::IdentifierEntry {
+    QByteArray utf8;
+    QString    string; ///< utf8 decoded, shared by toString()
+    uint       hash;
+};
+
+/**
+ * @brief Every interned ID. Entries are never removed, so pointers to them
+   stay valid for the whole process
+ *
+ */
+struct InternTable {
+    QReadWriteLock                             lock;
+    QHash<QByteArray, const IdentifierEntry *> entries;
+};
+
+static InternTable &internTable() {
+    // Leaked on purpose: identifiers may outlive static destructors
+    static InternTable *table = new InternTable;
+    return *table;
+}
+
+/**
+ * @brief Get the table entry of utf8, adding it if new
+ *
+ * @param utf8 Not empty
+ * @return const IdentifierEntry*
+ */
+static const IdentifierEntry *intern(const QByteArray &utf8) {
+    InternTable &table = internTable();
+
+    {
+        // Fast path: most IDs of a sync were seen before
+        QReadLocker            locker(&table.lock);
+        const IdentifierEntry *entry = table.entries.value(utf8);
+
+        if (entry)
+            return entry;
+    }
+
+    QWriteLocker            locker(&table.lock);
+    const IdentifierEntry *&entry = table.entries[utf8];
+
+    // Another thread may have added it meanwhile
+    if (!entry)
+        entry = new IdentifierEntry{utf8, QString::fromUtf8(utf8), qHash(utf8)};
+
+    return entry;
+}
+
+Identifier::Identifier(const QString &id) {
+    if (!id.isEmpty())
+        this->m_entry = intern(id.toUtf8());
+}
+
+Identifier Identifier::fromUtf8(const QByteArray &utf8) {
+    Identifier id;
+
+    if (!utf8.isEmpty())
+        id.m_entry = intern(utf8);
+
+    return id;
+}
+
+QString Identifier::toString() const {
+    return this->m_entry ? this->m_entry->string : QString();
+}
+
+QByteArray Identifier::toUtf8() const {
+    return this->m_entry ? this->m_entry->utf8 : QByteArray();
+}
+
+bool Identifier::isEmpty() const {
+    return !this->m_entry;
+}
+
+uint Identifier::hash() const {
+    return this->m_entry ? this->m_entry->hash : 0;
+}
+
+int Identifier::internedCount() {
+    InternTable &table = internTable();
+    QReadLocker  locker(&table.lock);
+
+    return table.entries.size();
+}
+
+bool Identifier::operator<(const Identifier &other) const {
+    return this->toUtf8() < other.toUtf8();
+}
+
+QDebug MatrixCpp::Types::operator<<(QDebug debug, const Identifier &id) {
+    return debug << id.toString();
+}
+
+QDataStream &MatrixCpp::Types::operator<<(QDataStream &     stream,
+                                          const Identifier &id) {
+    return stream << id.toUtf8();
+}
+
+QDataStream &MatrixCpp::Types::operator>>(QDataStream &stream,
+                                          Identifier & id) {
+    QByteArray utf8;
+    stream >> utf8;
+
+    id = Identifier::fromUtf8(utf8);
+    return stream;
+}
@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file RequestMetrics.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements RequestMetrics and LatencyHistogram
+ * @version 0.1
+ * @date 2021-03-25
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMetaEnum>
+#include <QStringList>
+#include <QUrl>
+#include <algorithm>
+#include <memory>
+
+#include "RequestMetrics.hpp"
+
+using namespace MatrixCpp;
+
+// LatencyHistogram
+
+void LatencyHistogram::add(qint64 us) {
+    const QVector<qint64> &bounds = LatencyHistogram::bounds();
+
+    if (this->counts.isEmpty())
+        this->counts.fill(0, bounds.size() + 1);
+
+    this->counts[std::lower_bound(bounds.begin(), bounds.end(), us) -
+                 bounds.begin()]++;
+    this->samples++;
+    this->sum += us;
+    this->max = qMax(this->max, us);
+}
+
+const QVector<qint64> &LatencyHistogram::bounds() {
+    static const QVector<qint64> bounds{5000,
+                                        10000,
+                                        25000,
+                                        50000,
+                                        100000,
+                                        250000,
+                                        500000,
+                                        1000000,
+                                        2500000,
+                                        5000000,
+                                        10000000,
+                                        30000000,
+                                        60000000};
+
+    return bounds;
+}
+
+// RequestMetrics
+
+/**
+ * @brief What is known of a running request
+ *
+ */
+struct RequestTiming {
+    QElapsedTimer clock;
+    qint64        queue    = -1; ///< Microseconds, -1 until the body was sent
+    qint64        ttfb     = -1; ///< Microseconds, -1 until a response came
+    qint64        received = 0;  ///< Body bytes, as reported by the reply
+};
+
+RequestMetrics::RequestMetrics(QObject *parent) : QObject(parent) {}
+
+void RequestMetrics::track(QNetworkReply *reply,
+                           const QString &method,
+                           qint64         requestBytes) {
+    auto    timing = std::make_shared<RequestTiming>();
+    QString endpoint =
+        RequestMetrics::endpoint(reply->url().path(QUrl::FullyEncoded));
+
+    timing->clock.start();
+
+    auto responded = [=]() {
+        if (timing->ttfb < 0)
+            timing->ttfb = timing->clock.nsecsElapsed() / 1000;
+    };
+
+    QObject::connect(reply, &QNetworkReply::metaDataChanged, this, responded);
+    QObject::connect(reply, &QNetworkReply::readyRead, this, responded);
+
+    QObject::connect(reply,
+                     &QNetworkReply::uploadProgress,
+                     this,
+                     [=](qint64 sent, qint64 total) {
+                         if (timing->queue < 0 && total > 0 && sent == total)
+                             timing->queue =
+                                 timing->clock.nsecsElapsed() / 1000;
+                     });
+
+    QObject::connect(reply,
+                     &QNetworkReply::downloadProgress,
+                     this,
+                     [=](qint64 received, qint64) {
+                         timing->received = qMax(timing->received, received);
+                     });
+
+    QObject::connect(reply, &QNetworkReply::finished, this, [=]() {
+        EndpointStats &stats = this->at(method, endpoint);
+        QVariant       status =
+            reply->attribute(QNetworkRequest::HttpStatusCodeAttribute);
+
+        qint64 received = timing->received;
+
+        // Not every reply reports progress, the body was announced though
+        if (received <= 0)
+            received = reply->header(QNetworkRequest::ContentLengthHeader)
+                           .toLongLong();
+
+        stats.requests++;
+        stats.requestBytes += requestBytes;
+        stats.responseBytes += received;
+
+        if (timing->queue >= 0)
+            stats.queue.add(timing->queue);
+        if (timing->ttfb >= 0)
+            stats.ttfb.add(timing->ttfb);
+        stats.total.add(timing->clock.nsecsElapsed() / 1000);
+
+        if (status.isValid())
+            stats.statuses[status.toInt()]++;
+        else
+            stats.networkErrors[reply->error()]++;
+    });
+}
+
+QList<EndpointStats> RequestMetrics::stats() const {
+    return this->m_endpoints.values();
+}
+
+void RequestMetrics::reset() {
+    this->m_endpoints.clear();
+}
+
+/**
+ * @brief Escapes a Prometheus label value
+ *
+ * @param value
+ * @return QString
+ */
+static QString escape(QString value) {
+    return value.replace('\\', "\\\\")
+        .replace('"', "\\\"")
+        .replace('\n', "\\n");
+}
+
+/**
+ * @brief Microseconds as Prometheus seconds
+ *
+ * @param us
+ * @return QString
+ */
+static QString seconds(qint64 us) {
+    return QString::number(us / 1e6, 'g', 12);
+}
+
+QByteArray RequestMetrics::toPrometheus() const {
+    static const QMetaEnum errors =
+        QMetaEnum::fromType<QNetworkReply::NetworkError>();
+
+    QString out;
+
+    auto family = [&](const QString &name,
+                      const QString &type,
+                      const QString &help) {
+        out += "# HELP " + name + " " + help + "\n";
+        out += "# TYPE " + name + " " + type + "\n";
+    };
+
+    // Concatenated rather than arg()'d, percent encoded paths hold %NN
+    auto sample = [&](const QString &name,
+                      const QString &labels,
+                      const QString &value) {
+        out += name + "{" + labels + "} " + value + "\n";
+    };
+
+    auto labels = [](const EndpointStats &stats) -> QString {
+        return "method=\"" + escape(stats.method) + "\",endpoint=\"" +
+               escape(stats.endpoint) + "\"";
+    };
+
+    auto counter = [&](const QString &name,
+                       const QString &help,
+                       quint64 EndpointStats::*field) {
+        family(name, "counter", help);
+
+        for (const EndpointStats &stats : this->m_endpoints)
+            sample(name, labels(stats), QString::number(stats.*field));
+    };
+
+    auto histogram = [&](const QString &name,
+                         const QString &help,
+                         LatencyHistogram EndpointStats::*field) {
+        const QVector<qint64> &bounds = LatencyHistogram::bounds();
+
+        family(name, "histogram", help);
+
+        for (const EndpointStats &stats : this->m_endpoints) {
+            const LatencyHistogram &histogram  = stats.*field;
+            QString                 label      = labels(stats);
+            quint64                 cumulative = 0;
+
+            for (int i = 0; i < bounds.size(); i++) {
+                cumulative += histogram.counts.value(i);
+                sample(name + "_bucket",
+                       label + ",le=\"" + seconds(bounds[i]) + "\"",
+                       QString::number(cumulative));
+            }
+
+            sample(name + "_bucket",
+                   label + ",le=\"+Inf\"",
+                   QString::number(histogram.samples));
+            sample(name + "_sum", label, seconds(histogram.sum));
+            sample(name + "_count", label, QString::number(histogram.samples));
+        }
+    };
+
+    counter("matrixcpp_requests_total",
+            "Finished requests",
+            &EndpointStats::requests);
+    counter("matrixcpp_request_bytes_total",
+            "Bytes sent in request bodies",
+            &EndpointStats::requestBytes);
+    counter("matrixcpp_response_bytes_total",
+            "Bytes received in response bodies",
+            &EndpointStats::responseBytes);
+
+    family("matrixcpp_responses_total",
+           "counter",
+           "Responses by HTTP status code");
+
+    for (const EndpointStats &stats : this->m_endpoints)
+        for (auto it = stats.statuses.begin(); it != stats.statuses.end();
+             it++)
+            sample("matrixcpp_responses_total",
+                   labels(stats) + ",status=\"" + QString::number(it.key()) +
+                       "\"",
+                   QString::number(it.value()));
+
+    family("matrixcpp_request_errors_total",
+           "counter",
+           "Requests which got no HTTP status, by network error");
+
+    for (const EndpointStats &stats : this->m_endpoints)
+        for (auto it = stats.networkErrors.begin();
+             it != stats.networkErrors.end();
+             it++)
+            sample("matrixcpp_request_errors_total",
+                   labels(stats) + ",error=\"" +
+                       errors.valueToKey(it.key()) + "\"",
+                   QString::number(it.value()));
+
+    histogram("matrixcpp_request_queue_seconds",
+              "Time until the request body was sent",
+              &EndpointStats::queue);
+    histogram("matrixcpp_request_ttfb_seconds",
+              "Time until the first response headers or data",
+              &EndpointStats::ttfb);
+    histogram("matrixcpp_request_duration_seconds",
+              "Time until the request finished",
+              &EndpointStats::total);
+
+    return out.toUtf8();
+}
+
+QString RequestMetrics::endpoint(const QString &path) {
+    // Segments following these take that many parameters
+    static const QHash<QString, QStringList> parameters{
+        {"filter", {"{filterId}"}},
+        {"send", {"{eventType}", "{txnId}"}},
+        {"sendToDevice", {"{eventType}", "{txnId}"}},
+        {"state", {"{eventType}", "{stateKey}"}},
+        {"redact", {"{eventId}", "{txnId}"}},
+        {"receipt", {"{receiptType}", "{eventId}"}},
+        {"account_data", {"{type}"}},
+        {"tags", {"{tag}"}},
+        {"download", {"{serverName}", "{mediaId}"}},
+        {"thumbnail", {"{serverName}", "{mediaId}"}},
+    };
+    static const QHash<QChar, QString> sigils{{'!', "{roomId}"},
+                                               {'@', "{userId}"},
+                                               {'$', "{eventId}"},
+                                               {'#', "{roomAlias}"},
+                                               {'+', "{groupId}"}};
+
+    QStringList segments = path.split('/');
+    QStringList pending;
+
+    for (QString &segment : segments) {
+        QString decoded = QUrl::fromPercentEncoding(segment.toUtf8());
+
+        if (!pending.isEmpty())
+            segment = pending.takeFirst();
+        else if (!decoded.isEmpty() && sigils.contains(decoded[0]))
+            segment = sigils[decoded[0]];
+        else
+            pending = parameters.value(segment);
+    }
+
+    return segments.join('/');
+}
+
+// Private
+
+EndpointStats &RequestMetrics::at(const QString &method,
+                                  const QString &endpoint) {
+    EndpointStats &stats = this->m_endpoints[{endpoint, method}];
+
+    if (stats.endpoint.isEmpty()) {
+        stats.method   = method;
+        stats.endpoint = endpoint;
+    }
+
+    return stats;
+}
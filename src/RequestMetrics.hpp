@@ -0,0 +1,97 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file RequestMetrics.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares RequestMetrics, which measures the requests of a Client
+ * @version 0.1
+ * @date 2021-03-25
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QMap>
+#include <QNetworkReply>
+#include <QObject>
+#include <QPair>
+
+#include <MatrixCpp/Client.hpp>
+
+namespace MatrixCpp {
+/**
+ * @brief Collects EndpointStats from the replies of a Client
+ *
+ * Timings are taken from the signals of each reply, on the thread the reply
+ * lives in, which must be the thread of this object. A reply is accounted
+ * for once finished, so requests still running are not part of stats().
+ */
+class RequestMetrics : public QObject {
+    Q_OBJECT
+
+  public:
+    /**
+     * @brief Construct a new RequestMetrics
+     *
+     * @param parent
+     */
+    explicit RequestMetrics(QObject *parent = nullptr);
+
+    /**
+     * @brief Measures reply until it finishes. Must be called right after
+       the request was made, before anything else reads from reply
+     *
+     * @param reply
+     * @param method GET or POST
+     * @param requestBytes Size of the request body
+     */
+    void
+    track(QNetworkReply *reply, const QString &method, qint64 requestBytes);
+
+    /**
+     * @brief Get the measures of every endpoint requested since the last
+       reset
+     *
+     * @return QList<EndpointStats> Sorted by endpoint, then method
+     */
+    QList<EndpointStats> stats() const;
+
+    /**
+     * @brief Clears stats()
+     *
+     */
+    void reset();
+
+    /**
+     * @brief Writes stats() in the Prometheus text exposition format
+     *
+     * @return QByteArray
+     */
+    QByteArray toPrometheus() const;
+
+    /**
+     * @brief Turns a request path into its endpoint template. Segments which
+       are ids, known by their sigil, or follow a segment known to take
+       parameters, such as send/{eventType}/{txnId}, are replaced by {name}
+     *
+     * @param path Percent encoded, as sent
+     * @return QString
+     */
+    static QString endpoint(const QString &path);
+
+  private:
+    /**
+     * @brief Stats of the endpoint, created on first use
+     *
+     * @param method
+     * @param endpoint
+     * @return EndpointStats&
+     */
+    EndpointStats &at(const QString &method, const QString &endpoint);
+
+    /// (endpoint, method) to its stats, in the order stats() returns them
+    QMap<QPair<QString, QString>, EndpointStats> m_endpoints;
+};
+} // namespace MatrixCpp
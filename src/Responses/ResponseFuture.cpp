@@ -13,11 +13,15 @@
 
 #include <QEventLoop>
 #include <QNetworkReply>
+#include <QSharedPointer>
+#include <QVector>
 
 #include <MatrixCpp/Responses.hpp>
 #include <qnamespace.h>
 #include <qnetworkaccessmanager.h>
 
+#include "SyncStreamParser.hpp"
+
 using namespace MatrixCpp::Responses;
 
 // Public functions
@@ -30,6 +34,52 @@ ResponseFuture::ResponseFuture(const ResponseFuture &other) {
     this->init(other.m_reply);
 }
 
+ResponseFuture::~ResponseFuture() {
+    delete this->m_stream;
+}
+
+void ResponseFuture::streamSync(const ParseFilter &filter) {
+    if (this->m_stream || this->m_finished)
+        return;
+
+    this->m_stream = new SyncStreamParser(
+        [=](const QString &roomId, const QByteArray &rawRoom) {
+            emit this->roomJoinUpdate(roomId,
+                                      Types::RoomUpdate(rawRoom, filter));
+        });
+
+    QObject::connect(this->m_reply, &QNetworkReply::readyRead, this, [=]() {
+        // An error body is short and read whole once finished, so none of
+        // its rooms are applied
+        if (this->m_reply->error() != QNetworkReply::NoError)
+            return;
+
+        QByteArray chunk = this->m_reply->readAll();
+
+        if (this->m_bodyTap)
+            this->m_tapped += chunk;
+
+        this->m_stream->feed(chunk);
+    });
+}
+
+void ResponseFuture::deferParse(std::function<void(QByteArray)> handler) {
+    if (!this->m_finished)
+        this->m_bodyHandler = handler;
+}
+
+void ResponseFuture::tapBody(std::function<void(QByteArray)> handler) {
+    if (!this->m_finished)
+        this->m_bodyTap = handler;
+}
+
+void ResponseFuture::complete(Response response) {
+    this->m_finished = true;
+    this->m_response = response;
+
+    emit this->responseComplete(this->result());
+}
+
 Response ResponseFuture::result() {
     // Wait for response if it's not completed
     if (!this->m_finished) {
@@ -40,7 +90,56 @@ Response ResponseFuture::result() {
     }
 
     this->deleteLater();
-    return Response(this->m_rawResponse);
+    return this->m_response;
+}
+
+ResponseFuture *ResponseFuture::then(std::function<void(Response)> callback) {
+    return this->always([=](Response response) {
+        if (!response.isBroken() && !response.isError())
+            callback(response);
+    });
+}
+
+ResponseFuture *ResponseFuture::onError(std::function<void(Response)> callback) {
+    return this->always([=](Response response) {
+        if (response.isBroken() || response.isError())
+            callback(response);
+    });
+}
+
+ResponseFuture *ResponseFuture::always(std::function<void(Response)> callback) {
+    if (this->m_finished)
+        callback(this->m_response);
+    else
+        QObject::connect(this, &ResponseFuture::responseComplete, callback);
+
+    return this;
+}
+
+void ResponseFuture::whenAll(const QList<ResponseFuture *> &      futures,
+                             std::function<void(QList<Response>)> callback) {
+    if (futures.isEmpty()) {
+        callback({});
+        return;
+    }
+
+    // Shared between every completion handler
+    auto responses = QSharedPointer<QVector<Response>>::create(futures.size());
+    auto remaining = QSharedPointer<int>::create(futures.size());
+
+    for (int i = 0; i < futures.size(); i++)
+        futures[i]->always([=](Response response) {
+            (*responses)[i] = response;
+
+            if (--(*remaining) == 0)
+                callback(responses->toList());
+        });
+}
+
+void ResponseFuture::abort() {
+    // Reply is gone once a deferred body has been handed over
+    if (!this->m_finished && this->m_reply)
+        this->m_reply->abort();
 }
 
 // Private functions
@@ -49,8 +148,29 @@ void ResponseFuture::init(QNetworkReply *reply) {
     this->m_reply = reply;
 
     QObject::connect(reply, &QNetworkReply::finished, [=]() {
-        this->m_finished    = true;
-        this->m_rawResponse = reply->readAll();
+        QByteArray body = reply->readAll();
+
+        // Streamed chunks were read already
+        if (this->m_bodyTap && reply->error() == QNetworkReply::NoError)
+            this->m_bodyTap(this->m_tapped + body);
+
+        this->m_tapped.clear();
+
+        if (this->m_bodyHandler) {
+            reply->deleteLater();
+            this->m_reply = nullptr;
+            this->m_bodyHandler(body);
+            return;
+        }
+
+        this->m_finished = true;
+
+        if (this->m_stream && reply->error() == QNetworkReply::NoError) {
+            this->m_stream->feed(body);
+            this->m_response = Response(this->m_stream->skeleton());
+        } else
+            this->m_response = Response(body);
+
         reply->deleteLater();
         emit this->responseComplete(this->result());
     });
@@ -11,6 +11,7 @@
  *
  */
 
+#include <MatrixCpp/Filter.hpp>
 #include <MatrixCpp/Responses.hpp>
 
 using namespace MatrixCpp::Responses;
@@ -21,7 +22,7 @@ using namespace MatrixCpp::Types;
  */
 
 bool Response::isError() const {
-    return !this->data.toMap()["errcode"].isNull();
+    return this->data.toObject().contains("errcode");
 }
 
 void Response::parseData() {
@@ -33,18 +34,20 @@ void Response::parseData() {
  */
 
 void VersionsResponse::parseData() {
-    CHECK_MAP()
-    BROKEN(dataMap["versions"].isNull())
+    CHECK_OBJECT()
+    BROKEN(!dataObject.contains("versions"))
 
-    this->versions = dataMap["versions"].value<QStringList>();
+    const QJsonArray versions = dataObject.value("versions").toArray();
 
-    QVariantMap unstableFeaturesMap = dataMap["unstable_features"].toMap();
+    for (const QJsonValue &version : versions)
+        this->versions.append(version.toString());
 
-    if (!unstableFeaturesMap.isEmpty()) {
-        QVariantMap::iterator it = unstableFeaturesMap.begin();
-        for (; it != unstableFeaturesMap.end(); ++it)
-            this->unstableFeatures[it.key()] = it.value().toBool();
-    }
+    const QJsonObject unstableFeatures =
+        dataObject.value("unstable_features").toObject();
+
+    QJsonObject::const_iterator it = unstableFeatures.constBegin();
+    for (; it != unstableFeatures.constEnd(); ++it)
+        this->unstableFeatures[it.key()] = it.value().toBool();
 }
 
 /*
@@ -52,21 +55,21 @@ void VersionsResponse::parseData() {
  */
 
 void LoginTypesResponse::parseData() {
-    CHECK_MAP()
-    BROKEN(dataMap["flows"].isNull())
+    CHECK_OBJECT()
+    BROKEN(!dataObject.contains("flows"))
 
-    QVariantList flows = dataMap["flows"].toList();
+    const QJsonArray flows = dataObject.value("flows").toArray();
 
-    for (QVariant item : flows) {
-        QVariantMap entry = item.toMap();
+    for (const QJsonValue &item : flows) {
+        const QJsonObject entry = item.toObject();
 
-        if (entry.isEmpty() || entry["type"].isNull())
+        if (entry.isEmpty() || !entry.contains("type"))
             continue;
 
         QMap<QString, QString> newEntry;
-        newEntry["type"] = entry["type"].toString();
+        newEntry["type"] = entry.value("type").toString();
 
-        this->types.append(entry["type"].toString());
+        this->types.append(entry.value("type").toString());
         this->flows.append(newEntry);
     }
 }
@@ -76,27 +79,29 @@ void LoginTypesResponse::parseData() {
  */
 
 void LoginResponse::parseData() {
-    CHECK_MAP()
+    CHECK_OBJECT()
 
     for (QString key : {"user_id", "access_token", "device_id"})
-        BROKEN(dataMap[key].isNull())
+        BROKEN(!dataObject.contains(key))
 
-    this->userId      = dataMap["user_id"].toString();
-    this->accessToken = dataMap["access_token"].toString();
-    this->deviceId    = dataMap["device_id"].toString();
+    this->userId      = dataObject.value("user_id").toString();
+    this->accessToken = dataObject.value("access_token").toString();
+    this->deviceId    = dataObject.value("device_id").toString();
 
-    if (dataMap["well_known"].isNull())
+    if (!dataObject.contains("well_known"))
         return; // End it here
 
-    this->homeserver = dataMap["well_known"]
-                           .toMap()["m.homeserver"]
-                           .toMap()["base_url"]
-                           .toUrl();
+    const QJsonObject wellKnown = dataObject.value("well_known").toObject();
+
+    this->homeserver = QUrl(wellKnown.value("m.homeserver")
+                                .toObject()
+                                .value("base_url")
+                                .toString());
 
-    this->identityServer = dataMap["well_known"]
-                               .toMap()["m.identity_server"]
-                               .toMap()["base_url"]
-                               .toUrl();
+    this->identityServer = QUrl(wellKnown.value("m.identity_server")
+                                    .toObject()
+                                    .value("base_url")
+                                    .toString());
 }
 
 /*
@@ -104,11 +109,25 @@ void LoginResponse::parseData() {
  */
 
 void WellKnownResponse::parseData() {
-    CHECK_MAP()
+    CHECK_OBJECT()
+
+    this->homeserver = QUrl(
+        dataObject.value("m.homeserver").toObject().value("base_url").toString());
+    this->identityServer = QUrl(dataObject.value("m.identity_server")
+                                    .toObject()
+                                    .value("base_url")
+                                    .toString());
+}
 
-    this->homeserver = dataMap["m.homeserver"].toMap()["base_url"].toUrl();
-    this->identityServer =
-        dataMap["m.identity_server"].toMap()["base_url"].toUrl();
+/*
+ * FilterResponse
+ */
+
+void FilterResponse::parseData() {
+    CHECK_OBJECT()
+
+    this->filterId = dataObject.value("filter_id").toString();
+    BROKEN(this->filterId.isEmpty())
 }
 
 /*
@@ -116,22 +135,76 @@ void WellKnownResponse::parseData() {
  */
 
 void SyncResponse::parseData() {
-    CHECK_MAP()
-    BROKEN(dataMap["next_batch"].isNull())
+    this->parse(ParseFilter());
+}
 
-    this->nextBatch = dataMap["next_batch"].toString();
-    this->rooms     = dataMap["rooms"];
+void SyncResponse::parse(const ParseFilter &filter) {
+    CHECK_OBJECT()
+    BROKEN(!dataObject.contains("next_batch"))
+
+    this->nextBatch = dataObject.value("next_batch").toString();
+    this->rooms     = Types::Rooms(dataObject.value("rooms"), filter);
+
+    // Unwanted events are skipped by type, before anything is built for them
+    const QJsonArray presence =
+        filter.wants(ParseFilter::SECTION_PRESENCE)
+            ? dataObject.value("presence")
+                  .toObject()
+                  .value("events")
+                  .toArray()
+            : QJsonArray();
+
+    for (const QJsonValue &event : presence)
+        if (filter.keeps(ParseFilter::SECTION_PRESENCE, event))
+            this->presence.append(event);
+
+    const QJsonArray accountData =
+        filter.wants(ParseFilter::SECTION_ACCOUNT_DATA)
+            ? dataObject.value("account_data")
+                  .toObject()
+                  .value("events")
+                  .toArray()
+            : QJsonArray();
+
+    for (const QJsonValue &event : accountData)
+        if (filter.keeps(ParseFilter::SECTION_ACCOUNT_DATA, event))
+            this->accountData.append(event);
+
+    const QJsonArray toDevice =
+        filter.wants(ParseFilter::SECTION_TO_DEVICE)
+            ? dataObject.value("to_device")
+                  .toObject()
+                  .value("events")
+                  .toArray()
+            : QJsonArray();
+
+    for (const QJsonValue &event : toDevice)
+        if (filter.keeps(ParseFilter::SECTION_TO_DEVICE, event))
+            this->toDevice.append(event);
+
+    this->deviceLists = dataObject.value("device_lists").toObject();
+    this->deviceOneTimeKeysCount =
+        dataObject.value("device_one_time_keys_count").toObject();
+}
 
-    for (QVariant event : dataMap["presence"].toMap()["events"].toList())
-        this->presence.append(event);
+/*
+ * MessagesResponse
+ */
 
-    for (QVariant event : dataMap["account_data"].toMap()["events"].toList())
-        this->accountData.append(event);
+void MessagesResponse::parseData() {
+    CHECK_OBJECT()
+    BROKEN(!dataObject.contains("start"))
 
-    for (QVariant event : dataMap["to_device"].toMap()["events"].toList())
-        this->toDevice.append(event);
+    this->start = dataObject.value("start").toString();
+    this->end   = dataObject.value("end").toString();
 
-    this->deviceLists = dataMap["device_lists"].toMap();
-    this->deviceOneTimeKeysCount =
-        dataMap["device_one_time_keys_count"].toMap();
-}
\ No newline at end of file
+    const QJsonArray chunk = dataObject.value("chunk").toArray();
+
+    for (const QJsonValue &event : chunk)
+        this->chunk.append(event);
+
+    const QJsonArray state = dataObject.value("state").toArray();
+
+    for (const QJsonValue &event : state)
+        this->state.append(event);
+}
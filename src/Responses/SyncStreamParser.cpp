@@ -0,0 +1,146 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncStreamParser.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements SyncStreamParser
+ * @version 0.1
+ * @date 2021-03-06
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include "SyncStreamParser.hpp"
+
+using namespace MatrixCpp::Responses;
+
+SyncStreamParser::SyncStreamParser(RoomCallback callback)
+    : m_callback(callback) {
+}
+
+void SyncStreamParser::feed(const QByteArray &chunk) {
+    const char *data      = chunk.constData();
+    int         size      = chunk.size();
+    int         segment   = 0; // Start of bytes not yet moved
+    bool        keepChars = false;
+
+    for (int i = 0; i < size; i++) {
+        char c = data[i];
+
+        // We only care about strings that can be keys we are looking for
+        keepChars = this->m_mode != MODE_ROOM && this->m_depth <= 3;
+
+        if (this->m_inString) {
+            if (this->m_escape)
+                this->m_escape = false;
+            else if (c == '\\')
+                this->m_escape = true;
+            else if (c == '"') {
+                this->m_inString = false;
+                continue;
+            }
+
+            if (keepChars)
+                this->m_string.append(c);
+            continue;
+        }
+
+        switch (c) {
+            case '"':
+                this->m_inString   = true;
+                this->m_afterColon = false;
+                this->m_string.clear();
+                break;
+            case ':':
+                if (keepChars)
+                    this->m_keys[this->m_depth] = this->m_string;
+                this->m_afterColon = true;
+                break;
+            case '{':
+            case '[':
+                if (c == '{' && this->m_afterColon) {
+                    if (this->m_mode == MODE_SKELETON && this->m_depth == 2 &&
+                        this->m_keys[1] == "rooms" &&
+                        this->m_keys[2] == "join") {
+                        // Keep "{" of rooms.join in skeleton, drop the rest
+                        this->flush(chunk, segment, i + 1);
+                        this->m_mode = MODE_JOIN;
+                        segment      = i + 1;
+                    } else if (this->m_mode == MODE_JOIN &&
+                               this->m_depth == 3) {
+                        // A room starts here
+                        this->m_mode = MODE_ROOM;
+                        segment      = i;
+                    }
+                }
+
+                this->m_depth++;
+                this->m_afterColon = false;
+                break;
+            case '}':
+            case ']':
+                this->m_depth--;
+                this->m_afterColon = false;
+
+                if (this->m_mode == MODE_ROOM && this->m_depth == 3) {
+                    this->flush(chunk, segment, i + 1);
+                    segment = i + 1;
+
+                    QByteArray roomKey = this->m_keys[3];
+                    QString    roomId;
+
+                    if (roomKey.contains('\\'))
+                        roomId = QJsonDocument::fromJson("[\"" + roomKey + "\"]")
+                                     .array()
+                                     .first()
+                                     .toString();
+                    else
+                        roomId = QString::fromUtf8(roomKey);
+
+                    this->m_mode = MODE_JOIN;
+                    this->m_callback(roomId, this->m_room);
+
+                    // Release memory, next room can be way smaller
+                    this->m_room = QByteArray();
+                } else if (this->m_mode == MODE_JOIN && this->m_depth == 2) {
+                    // Closing brace of rooms.join goes to skeleton
+                    this->m_mode = MODE_SKELETON;
+                    segment      = i;
+                }
+                break;
+            case ',':
+                this->m_afterColon = false;
+                break;
+            default:
+                // Whitespace does not change anything, but values do
+                if (c != ' ' && c != '\n' && c != '\r' && c != '\t')
+                    this->m_afterColon = false;
+        }
+    }
+
+    this->flush(chunk, segment, size);
+}
+
+QByteArray SyncStreamParser::skeleton() const {
+    return this->m_skeleton;
+}
+
+void SyncStreamParser::flush(const QByteArray &chunk, int from, int to) {
+    if (from >= to)
+        return;
+
+    switch (this->m_mode) {
+        case MODE_SKELETON:
+            this->m_skeleton.append(chunk.constData() + from, to - from);
+            break;
+        case MODE_ROOM:
+            this->m_room.append(chunk.constData() + from, to - from);
+            break;
+        case MODE_JOIN:
+            break;
+    }
+}
@@ -0,0 +1,85 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncStreamParser.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares SyncStreamParser, used by ResponseFuture
+ * @version 0.1
+ * @date 2021-03-06
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QString>
+#include <functional>
+
+namespace MatrixCpp::Responses {
+/**
+ * @brief Incremental scanner for /sync response bodies
+ *
+ * Bytes are fed as they arrive from the network. Every value of rooms.join is
+ * cut out of the document as soon as its closing brace is seen and handed to
+ * the callback, so only the room being downloaded is kept in memory. The rest
+ * of the document is kept as a skeleton where rooms.join is an empty object.
+ */
+class SyncStreamParser {
+  public:
+    /**
+     * @brief Called for each complete joined room
+     *
+     */
+    using RoomCallback =
+        std::function<void(const QString &roomId, const QByteArray &rawRoom)>;
+
+    /**
+     * @brief Construct a new SyncStreamParser
+     *
+     * @param callback Called for each joined room, in document order
+     */
+    explicit SyncStreamParser(RoomCallback callback);
+
+    /**
+     * @brief Feeds the next chunk of the response body
+     *
+     * @param chunk
+     */
+    void feed(const QByteArray &chunk);
+
+    /**
+     * @brief The document without joined rooms contents
+     *
+     * @return QByteArray
+     */
+    QByteArray skeleton() const;
+
+  private:
+    enum Mode {
+        MODE_SKELETON, ///< Bytes are kept in the skeleton
+        MODE_JOIN,     ///< Inside rooms.join, between rooms. Bytes are dropped
+        MODE_ROOM      ///< Inside a joined room. Bytes are kept in m_room
+    };
+
+    /**
+     * @brief Moves chunk[from, to) to the destination of current mode
+     *
+     */
+    void flush(const QByteArray &chunk, int from, int to);
+
+    RoomCallback m_callback;
+    Mode         m_mode = MODE_SKELETON;
+    QByteArray   m_skeleton;
+    QByteArray   m_room;
+
+    int  m_depth      = 0;
+    bool m_inString   = false;
+    bool m_escape     = false;
+    bool m_afterColon = false;
+
+    QByteArray m_string;  ///< Raw contents of the string being scanned
+    QByteArray m_keys[4]; ///< Keys of the values at depth 1 to 3
+};
+} // namespace MatrixCpp::Responses
@@ -13,32 +13,319 @@
 
 #include "MatrixCpp/Types.hpp"
 #include <QDebug>
+#include <QPointer>
 
+#include <MatrixCpp/Client.hpp>
+#include <MatrixCpp/EventRegistry.hpp>
+#include <MatrixCpp/Responses.hpp>
 #include <MatrixCpp/Room.hpp>
 
-#define defineContent(type)                                   \
-    type content(event.content);                              \
-    if (content.isBroken()) {                                 \
-        qCritical() << "Error while processing event"         \
-                    << event.data.toMap()["type"].toString(); \
-        return;                                               \
+#define defineContent(type)                                              \
+    type content(event.content);                                         \
+    if (content.isBroken()) {                                            \
+        qCritical() << "Error while processing event" << event.typeName; \
+        return;                                                          \
     }
 
+using namespace MatrixCpp::Responses;
 using namespace MatrixCpp::Types;
 
-Room::Room(const QString &roomId, Client *client)
-    : QObject((QObject *) client), roomId(roomId) {
+// Ticks on every use of any Room, which orders them by last use
+static std::atomic<quint64> useClock{0};
+
+Room::Room(const Identifier &roomId, Client *client)
+    : QObject((QObject *) client), roomId(roomId), m_client(client),
+      m_registry(client ? client->m_userRegistry : UserRegistry::shared()) {
+    this->updatePowerLevels();
+
+    if (client)
+        this->m_timeline.setLimits(client->timelineMaxEvents,
+                                   client->timelineMaxBytes);
+}
+
+Room::~Room() {
+    for (const Member &member : qAsConst(this->m_members))
+        this->m_registry->release(member.user);
 }
 
 QString Room::name() const {
     if (!this->m_name.isEmpty())
         return this->m_name;
-    return this->roomId;
+    return this->roomId.toString();
+}
+
+RoomState Room::state() const {
+    QReadLocker locker(&this->m_stateLock);
+    return this->m_state;
+}
+
+Timeline Room::timeline() const {
+    this->touch();
+
+    QMutexLocker locker(&this->m_timelineLock);
+    return this->m_timeline;
+}
+
+qint64 Room::timelineBytes() const {
+    QMutexLocker locker(&this->m_timelineLock);
+    return this->m_timeline.bytes();
+}
+
+void Room::setTimelineLimits(int maxEvents, qint64 maxBytes) {
+    QMutexLocker locker(&this->m_timelineLock);
+    this->m_timeline.setLimits(maxEvents, maxBytes);
+}
+
+void Room::clearTimeline() {
+    QMutexLocker locker(&this->m_timelineLock);
+    this->m_timeline.clear();
+}
+
+quint64 Room::lastUsed() const {
+    return this->m_lastUsed.load(std::memory_order_relaxed);
+}
+
+void Room::appendTimeline(const QList<RoomEvent> &events,
+                          bool                    limited,
+                          const QString &         prevBatch) {
+    this->touch();
+
+    QMutexLocker locker(&this->m_timelineLock);
+    this->m_timeline.append(events, limited, prevBatch);
+}
+
+void Room::replaceTimelineEvent(const RoomEvent &event) {
+    QMutexLocker locker(&this->m_timelineLock);
+    this->m_timeline.replace(event);
+}
+
+void Room::paginateBack(int count) {
+    if (!this->m_client) {
+        qWarning() << "ROOM" << this->name()
+                   << "cannot paginate without a Client";
+        return;
+    }
+
+    this->m_pageSize   = count;
+    this->m_backWanted = qMax(this->m_backWanted, count);
+
+    // Ongoing request continues with what is still wanted
+    if (!this->m_paginating && !this->atStart())
+        this->requestBack();
+}
+
+void Room::fillGaps() {
+    QStringList gaps;
+
+    {
+        QMutexLocker locker(&this->m_timelineLock);
+
+        for (int i = 1; i < this->m_timeline.size(); i++)
+            if (this->m_timeline.gapBefore(i))
+                gaps.append(this->m_timeline.at(i).eventId);
+    }
+
+    for (const QString &eventId : gaps)
+        this->fillGap(eventId);
+}
+
+void Room::scrolledTo(int index) {
+    if (this->m_client && index < this->m_client->prefetchDistance)
+        this->paginateBack(this->m_pageSize);
+}
+
+bool Room::paginating() const {
+    return this->m_paginating;
+}
+
+bool Room::atStart() const {
+    QMutexLocker locker(&this->m_timelineLock);
+
+    return !this->m_startEvent.isEmpty() && !this->m_timeline.isEmpty() &&
+           this->m_timeline.at(0).eventId == this->m_startEvent;
+}
+
+void Room::touch() const {
+    this->m_lastUsed.store(useClock.fetch_add(1, std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+}
+
+void Room::requestBack() {
+    QString expected;
+    bool    empty;
+
+    {
+        QMutexLocker locker(&this->m_timelineLock);
+
+        expected = this->m_timeline.prevBatch();
+        empty    = this->m_timeline.isEmpty();
+    }
+
+    if (expected.isEmpty() && !empty) {
+        qWarning() << "ROOM" << this->name()
+                   << "cannot paginate, the start of its timeline was evicted";
+        this->m_backWanted = 0;
+        return;
+    }
+
+    // Without a timeline, start from now
+    QString from = empty ? this->m_client->nextBatch() : expected;
+
+    if (from.isEmpty()) {
+        this->m_backWanted = 0;
+        return;
+    }
+
+    QPointer<Room> self(this);
+    this->m_paginating = true;
+
+    this->m_client
+        ->getMessages(this->roomId.toString(), from, true, this->m_backWanted)
+        ->always([=](Response response) {
+            if (!self)
+                return;
+
+            this->m_paginating = false;
+
+            MessagesResponse page = response;
+
+            if (page.isBroken() || page.isError()) {
+                qWarning() << "ROOM" << this->name()
+                           << "could not paginate back from" << from;
+                this->m_backWanted = 0;
+                return;
+            }
+
+            QList<RoomEvent> events = this->prepareHistory(page.chunk);
+            int              inserted;
+
+            // Servers leave end out, or repeat start, once at the start
+            bool start = page.chunk.isEmpty() || page.end.isEmpty() ||
+                         page.end == page.start;
+
+            {
+                QMutexLocker locker(&this->m_timelineLock);
+
+                // Evicted from meanwhile, the page does not follow anymore
+                if (!expected.isEmpty() &&
+                    this->m_timeline.prevBatch() != expected) {
+                    this->m_backWanted = 0;
+                    return;
+                }
+
+                inserted = this->m_timeline.fill(0, events, page.end);
+
+                if (start && !this->m_timeline.isEmpty())
+                    this->m_startEvent = this->m_timeline.at(0).eventId;
+            }
+
+            this->m_backWanted =
+                start ? 0 : qMax(0, this->m_backWanted - page.chunk.size());
+
+            emit this->historyLoaded(inserted);
+
+            if (this->m_backWanted > 0)
+                this->requestBack();
+        });
+}
+
+void Room::fillGap(const QString &eventId) {
+    if (!this->m_client || this->m_gapFills.contains(eventId))
+        return;
+
+    QString from;
+
+    {
+        QMutexLocker locker(&this->m_timelineLock);
+        int          i = this->m_timeline.indexOf(eventId);
+
+        if (i > 0 && this->m_timeline.gapBefore(i))
+            from = this->m_timeline.prevBatch(i);
+    }
+
+    if (from.isEmpty())
+        return;
+
+    QPointer<Room> self(this);
+    this->m_gapFills.insert(eventId);
+
+    this->m_client
+        ->getMessages(this->roomId.toString(), from, true, this->m_pageSize)
+        ->always([=](Response response) {
+            if (!self)
+                return;
+
+            this->m_gapFills.remove(eventId);
+
+            MessagesResponse page = response;
+
+            if (page.isBroken() || page.isError()) {
+                qWarning() << "ROOM" << this->name()
+                           << "could not fill gap before" << eventId;
+                return;
+            }
+
+            QList<RoomEvent> events = this->prepareHistory(page.chunk);
+            int              inserted;
+            QString          next;
+
+            bool more = !page.chunk.isEmpty() && !page.end.isEmpty() &&
+                        page.end != page.start;
+
+            {
+                QMutexLocker locker(&this->m_timelineLock);
+                int          i = this->m_timeline.indexOf(eventId);
+
+                // Evicted or filled meanwhile
+                if (i <= 0 || !this->m_timeline.gapBefore(i) ||
+                    this->m_timeline.prevBatch(i) != from)
+                    return;
+
+                inserted = this->m_timeline.fill(i, events, page.end);
+
+                // Still open, now before the first inserted event
+                if (this->m_timeline.gapBefore(i) &&
+                    this->m_timeline.size() < this->m_timeline.maxEvents())
+                    next = this->m_timeline.at(i).eventId;
+            }
+
+            emit this->historyLoaded(inserted);
+
+            if (more && !next.isEmpty())
+                this->fillGap(next);
+        });
+}
+
+QList<RoomEvent> Room::prepareHistory(const QList<RoomEvent> &chunk) {
+    QList<RoomEvent> events;
+    events.reserve(chunk.size());
+
+    for (int i = chunk.size() - 1; i >= 0; i--) {
+        RoomEvent event = chunk[i];
+        bool      held;
+
+        // Held events are replaced once decrypted, as those of syncs
+        if (this->m_client->prepareTimelineEvent(this, event, &held))
+            events.append(event);
+    }
+
+    return events;
 }
 
 void Room::onEvent(RoomEvent event) {
-    qDebug() << "ROOM" << this->name()
-             << "EVENT:" << event.data.toMap()["type"].toString();
+    qDebug() << "ROOM" << this->name() << "EVENT:" << event.typeName;
+
+    // Timeline events with a state_key change state too
+    if (event.data.toObject().contains("state_key")) {
+        StateEvent   stateEvent(event);
+        QWriteLocker locker(&this->m_stateLock);
+
+        // Power levels only change here, so queries never compute them
+        if (this->m_state.update(stateEvent) && stateEvent.stateKey.isEmpty() &&
+            (event.type == Event::M_ROOM_POWER_LEVELS ||
+             event.type == Event::M_ROOM_CREATE))
+            this->updatePowerLevels();
+    }
 
     switch (event.type) {
         case Event::M_ROOM_MEMBER:
@@ -47,10 +334,7 @@ void Room::onEvent(RoomEvent event) {
         case Event::M_ROOM_CREATE: {
             defineContent(CreateContent);
 
-            if (!this->users.contains(content.creator))
-                this->updateMember(content.creator);
-
-            this->creator  = this->users.value(content.creator);
+            this->creator  = content.creator;
             this->federate = content.federate;
             break;
         }
@@ -73,9 +357,15 @@ void Room::onEvent(RoomEvent event) {
         }
 
         default:
-            qDebug() << __FUNCTION__ << "Implement me:"
-                     << event.data.toMap()["type"].toString();
+            break;
     }
+
+    // Handlers registered by the application, core types included
+    EventRegistry::Handler handler =
+        EventRegistry::instance().handler(event.type);
+
+    if (handler)
+        handler(this, event);
 }
 
 void Room::onRoomMemberEvent(StateEvent event) {
@@ -90,57 +380,182 @@ void Room::onRoomMemberEvent(StateEvent event) {
                                content.membership);
             break;
         case EventContent::MEMBERSHIP_BAN:
-        case EventContent::MEMBERSHIP_LEAVE: {
-            User *user;
-            user = this->users.take(event.stateKey);
-            delete user;
-            user = this->invitedUsers.take(event.stateKey);
-            delete user;
+        case EventContent::MEMBERSHIP_LEAVE:
+            this->removeMember(event.stateKey);
             break;
-        }
         default:
             break;
     }
 }
 
-void Room::updateMember(const QString &          userId,
+void Room::updateMember(const Identifier &       userId,
                         const QString &          displayName,
                         const QString &          avatarUrl,
                         EventContent::Membership membership) {
-    // Start by checking if we know this member
-    // If we do not know, add them
-    if (!this->users.contains(userId) && !this->invitedUsers.contains(userId)) {
-        User *user = new User(this, userId, displayName, avatarUrl);
-        if (membership == EventContent::MEMBERSHIP_JOIN)
-            this->users.insert(userId, user);
-        else
-            this->invitedUsers.insert(userId, user);
-
-        qDebug() << "ROOM" << this->name() << "ADD:" << user->userId;
-
-        // We have nothing left to do
+    int index = this->m_memberIndex.value(userId, -1);
+
+    // If we do not know this member, add them
+    if (index < 0) {
+        this->m_memberIndex.insert(userId, this->m_members.size());
+        this->m_members.append(
+            {this->m_registry->acquire(userId, displayName, avatarUrl),
+             membership});
+
+        qDebug() << "ROOM" << this->name() << "ADD:" << userId;
         return;
     }
 
-    // Now update the user accordingly
-    User *user = nullptr;
+    // Now update the member accordingly. Empty fields are left as they were
+    Member &member = this->m_members[index];
+
+    // User changed from invited -> join
+    if (membership == EventContent::MEMBERSHIP_JOIN)
+        member.membership = membership;
+
+    if (displayName.isEmpty() && avatarUrl.isEmpty())
+        return;
+
+    User previous = member.user;
+
+    member.user = this->m_registry->acquire(
+        userId,
+        displayName.isEmpty() ? previous.displayName : displayName,
+        avatarUrl.isEmpty() ? previous.avatarUrl : avatarUrl);
 
-    if (membership == EventContent::MEMBERSHIP_JOIN &&
-        this->invitedUsers.contains(userId)) {
-        // User changed from invited -> join
-        user = this->invitedUsers.take(userId);
-        this->users.insert(userId, user);
-    } else
-        user = this->users[userId];
+    // Acquired first, so strings kept by the new profile are not dropped
+    this->m_registry->release(previous);
+}
 
-    if (!user) {
-        qCritical() << "User broken" << userId;
+void Room::removeMember(const Identifier &userId) {
+    QHash<Identifier, int>::iterator it = this->m_memberIndex.find(userId);
+
+    if (it == this->m_memberIndex.end())
         return;
+
+    int index = it.value();
+    this->m_memberIndex.erase(it);
+    this->m_registry->release(this->m_members[index].user);
+
+    // Fill the hole with the last member, so the table stays dense
+    int last = this->m_members.size() - 1;
+
+    if (index != last) {
+        this->m_members[index] = this->m_members[last];
+        this->m_memberIndex.insert(this->m_members[index].user.userId, index);
     }
 
-    if (!displayName.isEmpty())
-        user->displayName = displayName;
+    this->m_members.removeLast();
+}
+
+PowerLevelsContent Room::powerLevels() const {
+    QReadLocker locker(&this->m_stateLock);
+    return this->m_powerLevels;
+}
 
-    if (!avatarUrl.isEmpty())
-        user->avatarUrl = avatarUrl;
-}
\ No newline at end of file
+int Room::powerLevel(const Identifier &userId) const {
+    QReadLocker locker(&this->m_stateLock);
+    return this->m_powerLevels.userLevel(userId);
+}
+
+bool Room::canSend(const Identifier &userId,
+                   const QString &   eventType,
+                   bool              state) const {
+    QReadLocker locker(&this->m_stateLock);
+
+    return this->m_powerLevels.userLevel(userId) >=
+           this->m_powerLevels.eventLevel(eventType, state);
+}
+
+bool Room::canInvite(const Identifier &userId) const {
+    QReadLocker locker(&this->m_stateLock);
+
+    return this->m_powerLevels.userLevel(userId) >=
+           this->m_powerLevels.invite;
+}
+
+bool Room::canKick(const Identifier &userId) const {
+    QReadLocker locker(&this->m_stateLock);
+    return this->m_powerLevels.userLevel(userId) >= this->m_powerLevels.kick;
+}
+
+bool Room::canKick(const Identifier &userId, const Identifier &target) const {
+    QReadLocker locker(&this->m_stateLock);
+    int         level = this->m_powerLevels.userLevel(userId);
+
+    return level >= this->m_powerLevels.kick &&
+           level > this->m_powerLevels.userLevel(target);
+}
+
+bool Room::canBan(const Identifier &userId) const {
+    QReadLocker locker(&this->m_stateLock);
+    return this->m_powerLevels.userLevel(userId) >= this->m_powerLevels.ban;
+}
+
+bool Room::canBan(const Identifier &userId, const Identifier &target) const {
+    QReadLocker locker(&this->m_stateLock);
+    int         level = this->m_powerLevels.userLevel(userId);
+
+    return level >= this->m_powerLevels.ban &&
+           level > this->m_powerLevels.userLevel(target);
+}
+
+bool Room::canRedact(const Identifier &userId) const {
+    QReadLocker locker(&this->m_stateLock);
+
+    return this->m_powerLevels.userLevel(userId) >=
+           this->m_powerLevels.redact;
+}
+
+bool Room::canRedact(const Identifier &userId,
+                     const Identifier &sender) const {
+    QReadLocker locker(&this->m_stateLock);
+    int         level = this->m_powerLevels.userLevel(userId);
+
+    if (userId == sender)
+        return level >= this->m_powerLevels.eventLevel("m.room.redaction");
+
+    return level >= this->m_powerLevels.redact &&
+           level > this->m_powerLevels.userLevel(sender);
+}
+
+void Room::updatePowerLevels() {
+    // Empty levels are levels too, only missing ones fall back
+    if (!this->m_state.contains("m.room.power_levels"))
+        this->m_powerLevels =
+            PowerLevelsContent::noPowerLevels(this->m_state.create().creator);
+    else
+        this->m_powerLevels = PowerLevelsContent(
+            QJsonValue(this->m_state.content("m.room.power_levels")));
+}
+
+User Room::member(const Identifier &userId) const {
+    int index = this->m_memberIndex.value(userId, -1);
+    return index < 0 ? User() : this->m_members[index].user;
+}
+
+EventContent::Membership Room::membership(const Identifier &userId) const {
+    int index = this->m_memberIndex.value(userId, -1);
+
+    return index < 0 ? EventContent::MEMBERSHIP_LEAVE
+                     : this->m_members[index].membership;
+}
+
+QVector<User> Room::members(EventContent::Membership membership) const {
+    QVector<User> members;
+
+    for (const Member &member : this->m_members)
+        if (member.membership == membership)
+            members.append(member.user);
+
+    return members;
+}
+
+int Room::memberCount(EventContent::Membership membership) const {
+    int count = 0;
+
+    for (const Member &member : this->m_members)
+        if (member.membership == membership)
+            count++;
+
+    return count;
+}
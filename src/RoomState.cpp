@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file RoomState.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements RoomState
+ * @version 0.1
+ * @date 2021-03-20
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <MatrixCpp/RoomState.hpp>
+#include <MatrixCpp/Types.hpp>
+
+using namespace MatrixCpp::Types;
+
+RoomState::RoomState() : d(new Data) {
+}
+
+bool RoomState::update(const StateEvent &event) {
+    if (event.isBroken())
+        return false;
+
+    // Read through constData(), which does not detach from snapshots
+    const QHash<Key, Entry> &entries = this->d.constData()->entries;
+
+    Key                               key(event.typeName, event.stateKey);
+    QHash<Key, Entry>::const_iterator old = entries.constFind(key);
+
+    if (old != entries.constEnd() && old->eventId == event.eventId)
+        return false;
+
+    Entry entry = {event.eventId, event.sender, event.serverTs, event.content};
+
+    // Keep the stored copy, which snapshots may share
+    if (old != entries.constEnd() && old->content == entry.content)
+        entry.content = old->content;
+
+    // Detaches if a snapshot holds the current data
+    this->d->entries.insert(key, entry);
+    return true;
+}
+
+void RoomState::insert(const Key &key, const Entry &entry) {
+    this->d->entries.insert(key, entry);
+}
+
+bool RoomState::contains(const QString &type, const QString &stateKey) const {
+    return this->d->entries.contains(Key(type, stateKey));
+}
+
+RoomState::Entry RoomState::entry(const QString &type,
+                                  const QString &stateKey) const {
+    return this->d->entries.value(Key(type, stateKey));
+}
+
+QJsonObject RoomState::content(const QString &type,
+                               const QString &stateKey) const {
+    return this->entry(type, stateKey).content;
+}
+
+QStringList RoomState::stateKeys(const QString &type) const {
+    Identifier  id(type);
+    QStringList keys;
+
+    QHash<Key, Entry>::const_iterator it = this->d->entries.constBegin();
+    for (; it != this->d->entries.constEnd(); ++it)
+        if (it.key().first == id)
+            keys.append(it.key().second.toString());
+
+    return keys;
+}
+
+QHash<RoomState::Key, RoomState::Entry> RoomState::entries() const {
+    return this->d->entries;
+}
+
+int RoomState::size() const {
+    return this->d->entries.size();
+}
+
+QString RoomState::field(const QString &type, const QString &key) const {
+    return this->content(type).value(key).toString();
+}
+
+QString RoomState::name() const {
+    return this->field("m.room.name", "name");
+}
+
+QString RoomState::topic() const {
+    return this->field("m.room.topic", "topic");
+}
+
+QString RoomState::avatarUrl() const {
+    return this->field("m.room.avatar", "url");
+}
+
+QString RoomState::canonicalAlias() const {
+    return this->field("m.room.canonical_alias", "alias");
+}
+
+QString RoomState::joinRule() const {
+    return this->field("m.room.join_rules", "join_rule");
+}
+
+QString RoomState::historyVisibility() const {
+    return this->field("m.room.history_visibility", "history_visibility");
+}
+
+CreateContent RoomState::create() const {
+    return QJsonValue(this->content("m.room.create"));
+}
+
+RoomEncryptionContent RoomState::encryption() const {
+    return QJsonValue(this->content("m.room.encryption"));
+}
+
+EventContent RoomState::member(const QString &userId) const {
+    return QJsonValue(this->content("m.room.member", userId));
+}
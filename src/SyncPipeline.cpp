@@ -0,0 +1,104 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncPipeline.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements SyncPipeline
+ * @version 0.1
+ * @date 2021-03-15
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QJsonDocument>
+
+#include "SyncPipeline.hpp"
+
+using namespace MatrixCpp;
+using namespace MatrixCpp::Responses;
+
+SyncPipeline::SyncPipeline(QObject *parent) : QObject(parent) {
+    this->m_clock.start();
+}
+
+void SyncPipeline::submit(const QByteArray & body,
+                          Commit             commit,
+                          const ParseFilter &filter) {
+    quint64 sequence    = this->m_nextSequence++;
+    qint64  submittedAt = this->m_clock.nsecsElapsed();
+
+    this->m_pool.start([=]() {
+        qint64 startedAt = this->m_clock.nsecsElapsed();
+
+        QJsonParseError error;
+        QJsonDocument   doc = QJsonDocument::fromJson(body, &error);
+
+        qint64 decodedAt = this->m_clock.nsecsElapsed();
+
+        // A body which is not JSON gives the same broken response as usual
+        SyncResponse response =
+            error.error != QJsonParseError::NoError
+                ? SyncResponse(body, filter)
+                : SyncResponse(QJsonValue(doc.object()), filter);
+
+        qint64 parsedAt = this->m_clock.nsecsElapsed();
+
+        QMetaObject::invokeMethod(
+            this,
+            [=]() {
+                this->m_stats.queued += (startedAt - submittedAt) / 1000;
+                this->m_stats.decoded += (decodedAt - startedAt) / 1000;
+                this->m_stats.parsed += (parsedAt - decodedAt) / 1000;
+
+                this->m_parsed.insert(sequence, {response, commit, parsedAt});
+                this->drain();
+            },
+            Qt::QueuedConnection);
+    });
+}
+
+void SyncPipeline::setMaxThreadCount(int count) {
+    this->m_pool.setMaxThreadCount(count);
+}
+
+SyncStats SyncPipeline::stats() const {
+    return this->m_stats;
+}
+
+void SyncPipeline::resetStats() {
+    this->m_stats = SyncStats();
+}
+
+void SyncPipeline::drain() {
+    // A commit spinning a nested event loop must not start the next one
+    if (this->m_draining)
+        return;
+
+    this->m_draining = true;
+
+    QMap<quint64, Parsed>::iterator next =
+        this->m_parsed.find(this->m_nextCommit);
+
+    while (next != this->m_parsed.end()) {
+        Parsed parsed = next.value();
+        this->m_parsed.erase(next);
+        this->m_nextCommit++;
+
+        qint64 committingAt = this->m_clock.nsecsElapsed();
+        parsed.commit(parsed.response);
+        qint64 committed =
+            (this->m_clock.nsecsElapsed() - committingAt) / 1000;
+
+        this->m_stats.syncs++;
+        this->m_stats.reordered += (committingAt - parsed.readyAt) / 1000;
+        this->m_stats.committed += committed;
+        this->m_stats.maxCommitted =
+            qMax(this->m_stats.maxCommitted, committed);
+
+        // Commit may have let the event loop run, look it up again
+        next = this->m_parsed.find(this->m_nextCommit);
+    }
+
+    this->m_draining = false;
+}
@@ -0,0 +1,108 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncPipeline.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares SyncPipeline, which parses sync responses off the owner
+   thread
+ * @version 0.1
+ * @date 2021-03-15
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QObject>
+#include <QThreadPool>
+#include <functional>
+
+#include <MatrixCpp/Client.hpp>
+#include <MatrixCpp/Responses.hpp>
+
+namespace MatrixCpp {
+/**
+ * @brief Parses /sync bodies on a thread pool and commits them in order
+ *
+ * JSON decoding and typed event construction run on worker threads. Parsed
+ * responses are committed on the thread this object lives in, in the order
+ * they were submitted, whatever order the workers finish in.
+ */
+class SyncPipeline : public QObject {
+    Q_OBJECT
+
+  public:
+    /**
+     * @brief Called on the owner thread to apply a parsed response
+     *
+     */
+    using Commit = std::function<void(const Responses::SyncResponse &)>;
+
+    /**
+     * @brief Construct a new SyncPipeline
+     *
+     * @param parent
+     */
+    explicit SyncPipeline(QObject *parent = nullptr);
+
+    /**
+     * @brief Queues a response body for parsing. Does not block
+     *
+     * @param body Raw /sync response body
+     * @param commit Called with the parsed response once every earlier
+       submitted response has been committed
+     * @param filter Applied while parsing
+     */
+    void submit(const QByteArray & body,
+                Commit             commit,
+                const ParseFilter &filter = ParseFilter());
+
+    /**
+     * @brief Sets how many worker threads parse responses
+     *
+     * @param count
+     */
+    void setMaxThreadCount(int count);
+
+    /**
+     * @brief Get the stage timings
+     *
+     * @return SyncStats
+     */
+    SyncStats stats() const;
+
+    /**
+     * @brief Clears the stage timings
+     *
+     */
+    void resetStats();
+
+  private:
+    /**
+     * @brief A parsed response waiting for its turn
+     *
+     */
+    struct Parsed {
+        Responses::SyncResponse response;
+        Commit                  commit;
+        qint64                  readyAt; ///< m_clock time parsing finished
+    };
+
+    /**
+     * @brief Commits every parsed response whose turn has come
+     *
+     */
+    void drain();
+
+    QThreadPool           m_pool;
+    QElapsedTimer         m_clock;
+    quint64               m_nextSequence = 0; ///< Given to the next submit
+    quint64               m_nextCommit   = 0; ///< Sequence to commit next
+    bool                  m_draining     = false;
+    QMap<quint64, Parsed> m_parsed;
+    SyncStats             m_stats;
+};
+} // namespace MatrixCpp
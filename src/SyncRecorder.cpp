@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncRecorder.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements SyncRecorder
+ * @version 0.1
+ * @date 2021-03-23
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QDebug>
+#include <QRegularExpression>
+
+#include "SyncRecorder.hpp"
+
+using namespace MatrixCpp;
+
+SyncRecorder::SyncRecorder(const QString &path) : m_file(path) {
+    if (!this->m_file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning() << "CAPTURE could not write" << path << ":"
+                   << this->m_file.errorString();
+        return;
+    }
+
+    this->m_stream.setDevice(&this->m_file);
+    this->m_stream.setVersion(QDataStream::Qt_5_12);
+    this->m_stream << CAPTURE_MAGIC << CAPTURE_VERSION;
+
+    this->m_file.flush();
+    this->m_clock.start();
+}
+
+bool SyncRecorder::isOpen() const {
+    return this->m_file.isOpen();
+}
+
+bool SyncRecorder::record(const QByteArray &body) {
+    if (!this->isOpen())
+        return false;
+
+    this->m_stream << (qint64) this->m_clock.elapsed()
+                   << qCompress(redact(body, &this->m_tokens));
+
+    if (this->m_stream.status() != QDataStream::Ok || !this->m_file.flush()) {
+        qWarning() << "CAPTURE could not write" << this->m_file.fileName()
+                   << ":" << this->m_file.errorString();
+        this->m_file.close();
+        return false;
+    }
+
+    return true;
+}
+
+QByteArray SyncRecorder::redact(const QByteArray &       body,
+                                QHash<QString, QString> *tokens) {
+    static const QRegularExpression token(
+        R"re(("(?:next|prev)_batch"\s*:\s*")((?:[^"\\]|\\.)*)")re");
+
+    const QString                   json = QString::fromUtf8(body);
+    QString                         redacted;
+    int                             last = 0;
+    QRegularExpressionMatchIterator it   = token.globalMatch(json);
+
+    redacted.reserve(json.size());
+
+    while (it.hasNext()) {
+        QRegularExpressionMatch match       = it.next();
+        QString &               placeholder = (*tokens)[match.captured(2)];
+
+        if (placeholder.isEmpty())
+            placeholder = QString("redacted_%1").arg(tokens->size());
+
+        redacted += json.midRef(last, match.capturedStart(2) - last);
+        redacted += placeholder;
+        last = match.capturedEnd(2);
+    }
+
+    redacted += json.midRef(last);
+
+    return redacted.toUtf8();
+}
@@ -0,0 +1,78 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncRecorder.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares SyncRecorder, which writes /sync bodies to a capture file
+ * @version 0.1
+ * @date 2021-03-23
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QString>
+
+namespace MatrixCpp {
+static const quint32 CAPTURE_MAGIC   = 0x4d435343; // "MCSC"
+static const quint32 CAPTURE_VERSION = 1;
+
+/**
+ * @brief Appends raw /sync response bodies to a capture file, see
+   Client::startRecording() and SyncReplay
+ *
+ * A capture is a versioned QDataStream header followed by one record per
+ * response: the milliseconds since recording started, then the body
+ * compressed by qCompress(). Records are flushed one by one, so a capture
+ * cut short by a crash still holds every response before it.
+ */
+class SyncRecorder {
+  public:
+    /**
+     * @brief Opens path for recording, replacing any capture there
+     *
+     * @param path
+     */
+    explicit SyncRecorder(const QString &path);
+
+    /**
+     * @brief Whether the capture file could be opened
+     *
+     * @return true
+     * @return false
+     */
+    bool isOpen() const;
+
+    /**
+     * @brief Appends a response body, with its tokens redacted
+     *
+     * @param body
+     * @return true
+     * @return false The capture could not be written
+     */
+    bool record(const QByteArray &body);
+
+    /**
+     * @brief Replaces the value of every next_batch and prev_batch key of
+       body by a placeholder. The same token always gets the same placeholder
+     *
+     * @param body
+     * @param tokens Token to placeholder, extended with new tokens
+     * @return QByteArray
+     */
+    static QByteArray redact(const QByteArray &       body,
+                             QHash<QString, QString> *tokens);
+
+  private:
+    QFile                   m_file;
+    QDataStream             m_stream;
+    QElapsedTimer           m_clock;
+    QHash<QString, QString> m_tokens; ///< Token to placeholder
+};
+} // namespace MatrixCpp
@@ -0,0 +1,178 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncReplay.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements SyncReplay
+ * @version 0.1
+ * @date 2021-03-23
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QDataStream>
+#include <QDebug>
+#include <QFile>
+#include <climits>
+
+#include <MatrixCpp/SyncReplay.hpp>
+
+#include "SyncRecorder.hpp"
+
+using namespace MatrixCpp;
+using namespace MatrixCpp::Responses;
+
+SyncReplay::SyncReplay(Client *client, QObject *parent)
+    : QObject(parent), m_client(client) {
+    this->m_timer.setSingleShot(true);
+    this->m_timer.setTimerType(Qt::PreciseTimer);
+
+    QObject::connect(&this->m_timer, &QTimer::timeout, this, [=]() {
+        this->applyNext();
+        this->scheduleNext();
+    });
+}
+
+bool SyncReplay::load(const QString &path) {
+    // Timeline events would go through its Olm, which remembers them
+    if (this->m_client->m_encryption) {
+        qWarning() << "CAPTURE cannot be replayed to a Client with encryption";
+        return false;
+    }
+
+    QFile file(path);
+
+    if (!file.open(QFile::ReadOnly)) {
+        qWarning() << "CAPTURE could not read" << path << ":"
+                   << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    quint32     magic, version;
+
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream >> magic >> version;
+
+    if (stream.status() != QDataStream::Ok || magic != CAPTURE_MAGIC ||
+        version != CAPTURE_VERSION) {
+        qWarning() << "CAPTURE" << path << "is not a capture of this version";
+        return false;
+    }
+
+    this->stop();
+    this->m_records.clear();
+    this->m_position = 0;
+
+    while (!stream.atEnd()) {
+        Record record;
+
+        stream >> record.at >> record.body;
+
+        // Recording was cut short, keep what came before
+        if (stream.status() != QDataStream::Ok) {
+            qWarning() << "CAPTURE" << path << "is truncated after"
+                       << this->m_records.size() << "responses";
+            break;
+        }
+
+        this->m_records.append(record);
+    }
+
+    return true;
+}
+
+int SyncReplay::replayAll() {
+    int applied = 0;
+
+    this->stop();
+
+    for (; this->m_position < this->m_records.size(); applied++)
+        this->applyNext();
+
+    return applied;
+}
+
+void SyncReplay::start(Pace pace) {
+    this->stop();
+
+    this->m_pace    = pace;
+    this->m_running = true;
+    this->m_offset  = this->m_position < this->m_records.size()
+                          ? this->m_records[this->m_position].at
+                          : 0;
+    this->m_clock.start();
+
+    this->scheduleNext();
+}
+
+void SyncReplay::stop() {
+    this->m_running = false;
+    this->m_timer.stop();
+}
+
+void SyncReplay::rewind() {
+    this->m_position = 0;
+
+    // Carry on from the start at the same pace
+    if (this->m_running)
+        this->start(this->m_pace);
+}
+
+int SyncReplay::size() const {
+    return this->m_records.size();
+}
+
+int SyncReplay::position() const {
+    return this->m_position;
+}
+
+bool SyncReplay::isRunning() const {
+    return this->m_running;
+}
+
+qint64 SyncReplay::duration() const {
+    return this->m_records.isEmpty()
+               ? 0
+               : this->m_records.last().at - this->m_records.first().at;
+}
+
+// Private
+
+void SyncReplay::applyNext() {
+    int        index = this->m_position++;
+    QByteArray body  = qUncompress(this->m_records[index].body);
+
+    if (body.isEmpty())
+        qWarning() << "CAPTURE response" << index << "is broken";
+    else {
+        // Parsed as a live response is, see Client::applySync
+        SyncResponse response(body, this->m_client->parseFilter);
+
+        this->m_client->applySyncResponse(response, false);
+    }
+
+    emit this->responseApplied(index);
+}
+
+void SyncReplay::scheduleNext() {
+    if (!this->m_running)
+        return;
+
+    if (this->m_position >= this->m_records.size()) {
+        this->m_running = false;
+
+        emit this->finished();
+        return;
+    }
+
+    qint64 delay = 0;
+
+    if (this->m_pace == PACE_REAL_TIME)
+        delay = this->m_records[this->m_position].at - this->m_offset -
+                this->m_clock.elapsed();
+
+    // Late responses are applied right away, the pace catches up
+    this->m_timer.start((int) qBound<qint64>(0, delay, INT_MAX));
+}
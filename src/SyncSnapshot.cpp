@@ -0,0 +1,171 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncSnapshot.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements SyncSnapshot
+ * @version 0.1
+ * @date 2021-03-16
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QCborMap>
+#include <QCborValue>
+#include <QDebug>
+#include <QFile>
+#include <QSaveFile>
+
+#include "SyncSnapshot.hpp"
+#include "src/Utils.hpp"
+
+using namespace MatrixCpp;
+using namespace MatrixCpp::Types;
+
+static const quint32 SNAPSHOT_MAGIC   = 0x4d435353; // "MCSS"
+static const quint32 SNAPSHOT_VERSION = 6;
+
+bool SyncSnapshot::save(const QString &path,
+                        const QString &nextBatch,
+                        const QHash<Types::Identifier, Types::Room *> &rooms) {
+    QSaveFile file(path);
+
+    if (!file.open(QFile::WriteOnly)) {
+        qWarning() << "SNAPSHOT could not write" << path << ":"
+                   << file.errorString();
+        return false;
+    }
+
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_12);
+
+    stream << SNAPSHOT_MAGIC << SNAPSHOT_VERSION << nextBatch
+           << (quint32) rooms.size();
+
+    for (const Room *room : rooms)
+        writeRoom(stream, room);
+
+    if (stream.status() != QDataStream::Ok || !Utils::syncToDisk(file) ||
+        !file.commit()) {
+        qWarning() << "SNAPSHOT could not write" << path << ":"
+                   << file.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+bool SyncSnapshot::load(const QString &                          path,
+                        Client *                                 client,
+                        QString *                                nextBatch,
+                        QHash<Types::Identifier, Types::Room *> *rooms) {
+    QFile file(path);
+
+    if (!file.open(QFile::ReadOnly))
+        return false;
+
+    QDataStream stream(&file);
+    quint32     magic, version, roomCount;
+    QString     batch;
+
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream >> magic >> version;
+
+    if (stream.status() != QDataStream::Ok || magic != SNAPSHOT_MAGIC ||
+        version != SNAPSHOT_VERSION) {
+        qWarning() << "SNAPSHOT ignoring" << path << "of another version";
+        return false;
+    }
+
+    stream >> batch >> roomCount;
+
+    QHash<Identifier, Room *> loaded;
+
+    for (quint32 i = 0; i < roomCount && stream.status() == QDataStream::Ok;
+         i++) {
+        Room *room = readRoom(stream, client);
+        loaded.insert(room->roomId, room);
+    }
+
+    if (stream.status() != QDataStream::Ok || batch.isEmpty()) {
+        qWarning() << "SNAPSHOT" << path << "is broken";
+        qDeleteAll(loaded);
+        return false;
+    }
+
+    *nextBatch = batch;
+    *rooms     = loaded;
+    return true;
+}
+
+void SyncSnapshot::writeRoom(QDataStream &stream, const Types::Room *room) {
+    stream << room->roomId << room->m_name << room->m_encrypted
+           << room->algorithm << room->federate << room->creator
+           << (quint32) room->m_members.size();
+
+    for (const Room::Member &member : room->m_members)
+        stream << member.user.userId << member.user.displayName
+               << member.user.avatarUrl << (qint32) member.membership;
+
+    const QHash<RoomState::Key, RoomState::Entry> state =
+        room->state().entries();
+
+    stream << (quint32) state.size();
+
+    QHash<RoomState::Key, RoomState::Entry>::const_iterator it =
+        state.constBegin();
+    for (; it != state.constEnd(); ++it)
+        stream << it.key().first << it.key().second << it->eventId
+               << it->sender << it->serverTs
+               << QCborValue::fromJsonValue(it->content).toCbor();
+}
+
+Types::Room *SyncSnapshot::readRoom(QDataStream &stream, Client *client) {
+    Identifier roomId;
+    quint32    count;
+
+    stream >> roomId;
+
+    Room *room = new Room(roomId, client);
+
+    stream >> room->m_name >> room->m_encrypted >> room->algorithm >>
+        room->federate >> room->creator >> count;
+
+    // A broken count must not reserve gigabytes
+    if (stream.status() == QDataStream::Ok && count <= 1u << 20) {
+        room->m_members.reserve(count);
+        room->m_memberIndex.reserve(count);
+    }
+
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        Identifier userId;
+        QString    displayName, avatarUrl;
+        qint32     membership;
+
+        stream >> userId >> displayName >> avatarUrl >> membership;
+
+        room->updateMember(userId,
+                           displayName,
+                           avatarUrl,
+                           (EventContent::Membership) membership);
+    }
+
+    stream >> count;
+
+    for (quint32 i = 0; i < count && stream.status() == QDataStream::Ok; i++) {
+        RoomState::Key   key;
+        RoomState::Entry entry;
+        QByteArray       content;
+
+        stream >> key.first >> key.second >> entry.eventId >> entry.sender >>
+            entry.serverTs >> content;
+
+        // Binary, so no JSON is parsed on load
+        entry.content = QCborValue::fromCbor(content).toMap().toJsonObject();
+        room->m_state.insert(key, entry);
+    }
+
+    room->updatePowerLevels();
+    return room;
+}
@@ -0,0 +1,66 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file SyncSnapshot.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares SyncSnapshot, which persists sync position and room state
+ * @version 0.1
+ * @date 2021-03-16
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QDataStream>
+#include <QHash>
+#include <QString>
+
+#include <MatrixCpp/Client.hpp>
+#include <MatrixCpp/Room.hpp>
+
+namespace MatrixCpp {
+/**
+ * @brief Saves and loads next_batch and the state of every room
+ *
+ * The snapshot is a versioned QDataStream, state contents included as CBOR,
+ * so loading it is a linear read without any JSON parsing. A snapshot of
+ * another version is ignored, which falls back to an initial sync.
+ */
+class SyncSnapshot {
+  public:
+    /**
+     * @brief Atomically writes a snapshot
+     *
+     * @param path
+     * @param nextBatch
+     * @param rooms
+     * @return true
+     * @return false
+     */
+    static bool save(const QString &                                path,
+                     const QString &                                nextBatch,
+                     const QHash<Types::Identifier, Types::Room *> &rooms);
+
+    /**
+     * @brief Reads a snapshot, creating its rooms. Nothing is created if the
+       snapshot is missing, of another version or broken
+     *
+     * @param path
+     * @param client Parent of the created rooms
+     * @param nextBatch Receives the sync position
+     * @param rooms Receives the rooms
+     * @return true
+     * @return false
+     */
+    static bool load(const QString &                          path,
+                     Client *                                 client,
+                     QString *                                nextBatch,
+                     QHash<Types::Identifier, Types::Room *> *rooms);
+
+  private:
+    static void         writeRoom(QDataStream &stream, const Types::Room *room);
+    static Types::Room *readRoom(QDataStream &stream, Client *client);
+};
+} // namespace MatrixCpp
@@ -0,0 +1,398 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file Timeline.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements Timeline
+ * @version 0.1
+ * @date 2021-03-21
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QVector>
+
+#include <MatrixCpp/Timeline.hpp>
+#include <MatrixCpp/Types.hpp>
+
+using namespace MatrixCpp::Types;
+
+/**
+ * @brief Approximate memory taken by a JSON value. Only meant to compare
+   events with each other, not to match what the allocator sees
+ *
+ */
+static qint64 jsonSize(const QJsonValue &value) {
+    // Roughly the bookkeeping of a value in its container
+    const qint64 overhead = 16;
+
+    switch (value.type()) {
+        case QJsonValue::String:
+            return overhead + value.toString().size() * sizeof(QChar);
+        case QJsonValue::Array: {
+            const QJsonArray array = value.toArray();
+            qint64           size  = overhead;
+
+            for (const QJsonValue &item : array)
+                size += jsonSize(item);
+
+            return size;
+        }
+        case QJsonValue::Object: {
+            const QJsonObject object = value.toObject();
+            qint64            size   = overhead;
+
+            QJsonObject::const_iterator it = object.constBegin();
+            for (; it != object.constEnd(); ++it)
+                size += it.key().size() * sizeof(QChar) + jsonSize(it.value());
+
+            return size;
+        }
+        default:
+            return overhead;
+    }
+}
+
+struct Timeline::Data : public QSharedData {
+    /**
+     * @brief A timeline event, as stored
+     *
+     */
+    struct Item {
+        RoomEvent event;
+        QString   prevBatch;     ///< Set on the first event of a batch only
+        bool      gap   = false; ///< Events are missing right before this one
+        qint64    bytes = 0;     ///< Approximate size of this Item
+    };
+
+    /**
+     * @brief Ring buffer of count items starting at first. Grows as needed,
+       up to maxEvents
+     *
+     */
+    QVector<Item> items;
+
+    int    first = 0;
+    int    count = 0;
+    qint64 bytes = 0;
+
+    int    maxEvents;
+    qint64 maxBytes;
+
+    const Item &at(int i) const {
+        return this->items[(this->first + i) % this->items.size()];
+    }
+
+    Item &at(int i) {
+        return this->items[(this->first + i) % this->items.size()];
+    }
+
+    /**
+     * @brief Moves the items to a buffer of capacity slots, oldest first
+     *
+     */
+    void reallocate(int capacity) {
+        QVector<Item> items(capacity);
+
+        for (int i = 0; i < this->count; i++)
+            items[i] = std::move(this->at(i));
+
+        this->items = items;
+        this->first = 0;
+    }
+
+    /**
+     * @brief Appends item, evicting the oldest one if maxEvents is reached
+     *
+     * @return true An item was evicted
+     * @return false
+     */
+    bool push(const Item &item) {
+        bool evicted = false;
+
+        if (this->count == this->items.size()) {
+            if (this->items.size() < this->maxEvents)
+                this->reallocate(
+                    qMin(qMax(16, this->items.size() * 2), this->maxEvents));
+            else {
+                this->pop();
+                evicted = true;
+            }
+        }
+
+        this->at(this->count++) = item;
+        this->bytes += item.bytes;
+
+        return evicted;
+    }
+
+    void pop() {
+        Item &item = this->at(0);
+
+        this->bytes -= item.bytes;
+        item = Item(); // Release the event now, not once overwritten
+
+        this->first = (this->first + 1) % this->items.size();
+        this->count--;
+    }
+
+    /**
+     * @brief Evicts the oldest items until both limits are met, then up to
+       the start of the next batch, so the oldest item keeps its token
+     *
+     * @param evicted Whether items were evicted already, e.g. by push()
+     */
+    void evict(bool evicted = false) {
+        while (this->count > 0 && (this->count > this->maxEvents ||
+                                   this->bytes > this->maxBytes)) {
+            this->pop();
+            evicted = true;
+        }
+
+        if (!evicted || this->count == 0 || !this->at(0).prevBatch.isEmpty())
+            return;
+
+        int next = 1;
+        while (next < this->count && this->at(next).prevBatch.isEmpty())
+            next++;
+
+        // Only batch left, keep what we can of it
+        if (next == this->count)
+            return;
+
+        while (next-- > 0)
+            this->pop();
+    }
+};
+
+Timeline::Timeline(int maxEvents, qint64 maxBytes) : d(new Data) {
+    this->d->maxEvents = qMax(0, maxEvents);
+    this->d->maxBytes  = qMax<qint64>(0, maxBytes);
+}
+
+Timeline::Timeline(const Timeline &other) : d(other.d) {
+}
+
+Timeline &Timeline::operator=(const Timeline &other) {
+    this->d = other.d;
+    return *this;
+}
+
+Timeline::~Timeline() {
+}
+
+void Timeline::append(const QList<RoomEvent> &events,
+                      bool                    limited,
+                      const QString &         prevBatch) {
+    if (events.isEmpty() || this->d->maxEvents == 0)
+        return;
+
+    bool first   = true;
+    bool evicted = false;
+
+    for (const RoomEvent &event : events) {
+        Data::Item item;
+
+        item.event = event;
+        item.bytes = sizeof(Data::Item) + jsonSize(event.data);
+
+        if (first) {
+            item.prevBatch = prevBatch;
+            item.gap       = limited && this->d->count > 0;
+            first          = false;
+
+            item.bytes += prevBatch.size() * sizeof(QChar);
+        }
+
+        evicted |= this->d->push(item);
+    }
+
+    this->d->evict(evicted);
+}
+
+int Timeline::fill(int                     index,
+                   const QList<RoomEvent> &events,
+                   const QString &         prevBatch) {
+    Q_ASSERT(index >= 0 && index <= this->d->count);
+
+    const Data *data   = this->d.constData();
+    int         from   = 0;
+    bool        closed = false;
+
+    // Pages overlap what we have once they reach the event before the gap
+    if (index > 0) {
+        const QString before = data->at(index - 1).event.eventId;
+
+        for (int i = events.size() - 1; i >= 0 && !closed; i--)
+            if (events[i].eventId == before) {
+                from   = i + 1;
+                closed = true;
+            }
+    }
+
+    int inserted = events.size() - from;
+
+    // Nothing new, but the next page starts elsewhere
+    if (inserted == 0 && !closed) {
+        if (index < data->count) {
+            Data::Item &item = this->d->at(index);
+
+            this->d->bytes += (prevBatch.size() - item.prevBatch.size()) *
+                              (qint64) sizeof(QChar);
+            item.prevBatch = prevBatch;
+        }
+
+        return 0;
+    }
+
+    // Rebuilt in order, which is as cheap as shifting the ring. data stays
+    // the shared block until the end: writing through d would detach it
+    QVector<Data::Item> items(qMax(data->items.size(), data->count + inserted));
+    int                 count = 0;
+    qint64              added = 0;
+
+    for (int i = 0; i < index; i++)
+        items[count++] = data->at(i);
+
+    for (int i = from; i < events.size(); i++) {
+        Data::Item &item = items[count++];
+
+        item.event = events[i];
+        item.bytes = sizeof(Data::Item) + jsonSize(events[i].data);
+
+        if (i == from && !closed) {
+            item.prevBatch = prevBatch;
+            item.gap       = index > 0;
+
+            item.bytes += prevBatch.size() * sizeof(QChar);
+        }
+
+        added += item.bytes;
+    }
+
+    for (int i = index; i < data->count; i++) {
+        items[count] = data->at(i);
+
+        // Either closed, or moved to the first inserted event
+        if (i == index)
+            items[count].gap = false;
+
+        count++;
+    }
+
+    this->d->items = items;
+    this->d->first = 0;
+    this->d->count = count;
+    this->d->bytes += added;
+
+    return inserted;
+}
+
+bool Timeline::replace(const RoomEvent &event) {
+    int i = this->indexOf(event.eventId);
+
+    if (i < 0)
+        return false;
+
+    // Detaches if a snapshot holds the current data
+    Data::Item &item  = this->d->at(i);
+    qint64      bytes = sizeof(Data::Item) + jsonSize(event.data) +
+                        item.prevBatch.size() * sizeof(QChar);
+
+    this->d->bytes += bytes - item.bytes;
+    item.event = event;
+    item.bytes = bytes;
+
+    this->d->evict();
+    return true;
+}
+
+void Timeline::clear() {
+    this->d->items.clear();
+    this->d->first = 0;
+    this->d->count = 0;
+    this->d->bytes = 0;
+}
+
+void Timeline::setLimits(int maxEvents, qint64 maxBytes) {
+    this->d->maxEvents = qMax(0, maxEvents);
+    this->d->maxBytes  = qMax<qint64>(0, maxBytes);
+
+    this->d->evict();
+
+    if (this->d->items.size() > this->d->maxEvents)
+        this->d->reallocate(this->d->count);
+}
+
+int Timeline::maxEvents() const {
+    return this->d->maxEvents;
+}
+
+qint64 Timeline::maxBytes() const {
+    return this->d->maxBytes;
+}
+
+int Timeline::size() const {
+    return this->d->count;
+}
+
+bool Timeline::isEmpty() const {
+    return this->d->count == 0;
+}
+
+qint64 Timeline::bytes() const {
+    return this->d->bytes;
+}
+
+RoomEvent Timeline::at(int i) const {
+    Q_ASSERT(i >= 0 && i < this->d->count);
+    return this->d->at(i).event;
+}
+
+bool Timeline::gapBefore(int i) const {
+    Q_ASSERT(i >= 0 && i < this->d->count);
+    return this->d->at(i).gap;
+}
+
+int Timeline::indexOf(const QString &eventId) const {
+    int i = this->d->count - 1;
+
+    while (i >= 0 && this->d->at(i).event.eventId != eventId)
+        i--;
+
+    return i;
+}
+
+QSet<QString> Timeline::lastEventIds(int count) const {
+    QSet<QString> ids;
+    int           i = qMax(0, this->d->count - count);
+
+    ids.reserve(this->d->count - i);
+
+    for (; i < this->d->count; i++)
+        ids.insert(this->d->at(i).event.eventId);
+
+    return ids;
+}
+
+QList<RoomEvent> Timeline::events() const {
+    QList<RoomEvent> events;
+    events.reserve(this->d->count);
+
+    for (int i = 0; i < this->d->count; i++)
+        events.append(this->d->at(i).event);
+
+    return events;
+}
+
+QString Timeline::prevBatch() const {
+    return this->d->count > 0 ? this->d->at(0).prevBatch : QString();
+}
+
+QString Timeline::prevBatch(int i) const {
+    Q_ASSERT(i >= 0 && i < this->d->count);
+    return this->d->at(i).prevBatch;
+}
@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file Transport.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements NetworkTransport
+ * @version 0.1
+ * @date 2021-03-22
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <MatrixCpp/Transport.hpp>
+
+using namespace MatrixCpp;
+
+NetworkTransport::NetworkTransport(QObject *parent)
+    : Transport(parent), m_nam(new QNetworkAccessManager(this)) {
+}
+
+QNetworkReply *NetworkTransport::get(const QNetworkRequest &request) {
+    return this->m_nam->get(request);
+}
+
+QNetworkReply *NetworkTransport::post(const QNetworkRequest &request,
+                                      const QByteArray &     body) {
+    return this->m_nam->post(request, body);
+}
@@ -13,6 +13,8 @@
 
 #include <QJsonDocument>
 
+#include <MatrixCpp/EventRegistry.hpp>
+#include <MatrixCpp/Filter.hpp>
 #include <MatrixCpp/Types.hpp>
 
 using namespace MatrixCpp::Types;
@@ -32,10 +34,14 @@ MatrixObj::MatrixObj(QByteArray rawJson) {
 
     BROKEN(error.error)
 
-    this->data = doc.toVariant();
+    // Parsed once here. Every object below shares doc's buffer
+    if (doc.isObject())
+        this->data = doc.object();
+    else
+        this->data = doc.array();
 }
 
-MatrixObj::MatrixObj(QVariant data) {
+MatrixObj::MatrixObj(QJsonValue data) {
     this->data = data;
 }
 
@@ -45,7 +51,9 @@ MatrixObj::MatrixObj(const MatrixObj &other) {
 }
 
 QByteArray MatrixObj::getJson() const {
-    QJsonDocument doc = QJsonDocument::fromVariant(this->data);
+    QJsonDocument doc = this->data.isArray()
+                            ? QJsonDocument(this->data.toArray())
+                            : QJsonDocument(this->data.toObject());
     return doc.toJson();
 }
 
@@ -58,35 +66,17 @@ bool MatrixObj::isBroken() const {
  */
 
 void Event::parseData() {
-    QString type = this->data.toMap()["type"].toString();
+    const QJsonObject dataObject = this->data.toObject();
+
+    QString type = dataObject.value("type").toString();
     BROKEN(type.isEmpty())
 
-    this->content = this->data.toMap()["content"].toMap();
-    BROKEN(this->content.isEmpty())
-
-    // Presence events
-    if (type == "m.presence")
-        this->type = M_PRESENCE;
-
-    // Room events
-    else if (type == "m.room.member")
-        this->type = M_ROOM_MEMBER;
-    else if (type == "m.room.message")
-        this->type = M_ROOM_MESSAGE;
-    else if (type == "m.room.name")
-        this->type = M_ROOM_NAME;
-    else if (type == "m.room.create")
-        this->type = M_ROOM_CREATE;
-    else if (type == "m.room.encryption")
-        this->type = M_ROOM_ENCRYPTION;
-
-    // Ephemeral events
-    else if (type == "m.typing")
-        this->type = M_TYPING;
-
-    // Other types
-    else
-        this->type = M_OTHER;
+    this->content = dataObject.value("content").toObject();
+
+    // State may be emptied on purpose, e.g. power levels back to defaults
+    BROKEN(this->content.isEmpty() && !dataObject.contains("state_key"))
+
+    this->type = EventRegistry::instance().lookup(type, &this->typeName);
 }
 
 /*
@@ -94,27 +84,29 @@ void Event::parseData() {
  */
 
 void UnsignedData::parseData() {
-    QVariantMap dataMap = this->data.toMap();
+    const QJsonObject dataObject = this->data.toObject();
 
-    this->age             = dataMap["age"].toInt();
-    this->redactedBecause = dataMap["redacted_because"];
-    this->transactionId   = dataMap["transaction_id"].toString();
+    this->age             = dataObject.value("age").toInt();
+    this->redactedBecause = dataObject.value("redacted_because");
+    this->transactionId   = dataObject.value("transaction_id").toString();
 }
 
 /*
  * CreateContent
  */
 void CreateContent::parseData() {
-    QVariantMap dataMap = this->data.toMap();
+    const QJsonObject dataObject = this->data.toObject();
 
-    this->creator = dataMap["creator"].toString();
+    this->creator = dataObject.value("creator").toString();
     BROKEN(this->creator.isEmpty())
 
-    this->federate    = dataMap["federate"].toBool();
-    this->roomVersion = dataMap["room_version"].toString();
+    this->federate    = dataObject.value("federate").toBool();
+    this->roomVersion = dataObject.value("room_version").toString();
 
-    this->roomId  = dataMap["predecessor"].toMap()["room_id"].toString();
-    this->eventId = dataMap["predecessor"].toMap()["event_id"].toString();
+    const QJsonObject predecessor = dataObject.value("predecessor").toObject();
+
+    this->roomId  = predecessor.value("room_id").toString();
+    this->eventId = predecessor.value("event_id").toString();
 }
 
 /*
@@ -122,31 +114,69 @@ void CreateContent::parseData() {
  */
 
 void RoomUpdate::parseData() {
-    QVariantMap dataMap = this->data.toMap();
+    this->parse(ParseFilter());
+}
 
-    this->summary = dataMap["summary"].toMap();
+void RoomUpdate::parse(const ParseFilter &filter) {
+    const QJsonObject dataObject = this->data.toObject();
 
-    for (QVariant event : dataMap["state"].toMap()["events"].toList()) {
-        StateEvent state = event;
-        if (!state.isBroken())
-            this->state.append(state);
-    }
+    this->summary = dataObject.value("summary").toObject();
+
+    // Unwanted events are skipped by type, before anything is built for them
+    const QJsonArray state =
+        filter.wants(ParseFilter::SECTION_STATE)
+            ? dataObject.value("state").toObject().value("events").toArray()
+            : QJsonArray();
+
+    for (const QJsonValue &event : state) {
+        if (!filter.keeps(ParseFilter::SECTION_STATE, event))
+            continue;
 
-    this->timeline = dataMap["timeline"].toMap();
+        StateEvent stateEvent = event;
+        if (!stateEvent.isBroken())
+            this->state.append(stateEvent);
+    }
 
-    for (QVariant event : dataMap["ephemeral"].toMap()["events"].toList()) {
-        Event ephemeral = event;
-        if (!ephemeral.isBroken())
-            this->ephemeral.append(ephemeral);
+    // Timeline events are built when applied, see Client::applyRoomUpdate
+    if (filter.wants(ParseFilter::SECTION_TIMELINE))
+        this->timeline = dataObject.value("timeline").toObject();
+
+    const QJsonArray ephemeral =
+        filter.wants(ParseFilter::SECTION_EPHEMERAL)
+            ? dataObject.value("ephemeral")
+                  .toObject()
+                  .value("events")
+                  .toArray()
+            : QJsonArray();
+
+    for (const QJsonValue &event : ephemeral) {
+        if (!filter.keeps(ParseFilter::SECTION_EPHEMERAL, event))
+            continue;
+
+        Event ephemeralEvent = event;
+        if (!ephemeralEvent.isBroken())
+            this->ephemeral.append(ephemeralEvent);
     }
 
-    for (QVariant event : dataMap["account_data"].toMap()["events"].toList()) {
-        Event accountData = event;
-        if (!accountData.isBroken())
-            this->accountData.append(accountData);
+    const QJsonArray accountData =
+        filter.wants(ParseFilter::SECTION_ROOM_ACCOUNT)
+            ? dataObject.value("account_data")
+                  .toObject()
+                  .value("events")
+                  .toArray()
+            : QJsonArray();
+
+    for (const QJsonValue &event : accountData) {
+        if (!filter.keeps(ParseFilter::SECTION_ROOM_ACCOUNT, event))
+            continue;
+
+        Event accountDataEvent = event;
+        if (!accountDataEvent.isBroken())
+            this->accountData.append(accountDataEvent);
     }
 
-    this->unreadNotifications = dataMap["unread_notifications"].toMap();
+    this->unreadNotifications =
+        dataObject.value("unread_notifications").toObject();
 }
 
 /*
@@ -154,9 +184,13 @@ void RoomUpdate::parseData() {
  */
 
 void RoomInvite::parseData() {
-    QVariantMap inviteState = this->data.toMap()["invite_state"].toMap();
+    const QJsonArray events = this->data.toObject()
+                                  .value("invite_state")
+                                  .toObject()
+                                  .value("events")
+                                  .toArray();
 
-    for (QVariant event : inviteState["events"].toList()) {
+    for (const QJsonValue &event : events) {
         StrippedStateEvent stateEvent = event;
         if (!stateEvent.isBroken())
             this->events.append(stateEvent);
@@ -168,35 +202,95 @@ void RoomInvite::parseData() {
  */
 
 void Rooms::parseData() {
-    QVariantMap dataMap = this->data.toMap();
+    this->parse(ParseFilter());
+}
 
-    QVariantMap                 join = dataMap["join"].toMap();
-    QVariantMap::const_iterator it   = join.begin();
-    for (; it != join.end(); ++it) {
-        RoomUpdate room = it.value();
+void Rooms::parse(const ParseFilter &filter) {
+    const QJsonObject dataObject = this->data.toObject();
+
+    const QJsonObject           join = dataObject.value("join").toObject();
+    QJsonObject::const_iterator it   = join.constBegin();
+    for (; it != join.constEnd(); ++it) {
+        RoomUpdate room(it.value(), filter);
         if (!room.isBroken())
             this->join.insert(it.key(), room);
     }
 
-    QVariantMap invite = dataMap["invite"].toMap();
-    it                 = invite.begin();
-    for (; it != invite.end(); ++it) {
+    const QJsonObject invite = dataObject.value("invite").toObject();
+    it                       = invite.constBegin();
+    for (; it != invite.constEnd(); ++it) {
         RoomInvite room = it.value();
         if (!room.isBroken())
             this->invite.insert(it.key(), room);
     }
 
-    this->leave = dataMap["leave"].toMap();
+    this->leave = dataObject.value("leave").toObject();
 }
 
 /*
  * User
  */
 
-User::User(Room *         room,
-           const QString &userId,
-           const QString &displayName,
-           const QString &avatarUrl)
-    : QObject(room), userId(userId), avatarUrl(avatarUrl),
-      displayName(displayName) {
-}
\ No newline at end of file
+User::User(const Identifier &userId,
+           const QString &   displayName,
+           const QString &   avatarUrl)
+    : userId(userId), displayName(displayName), avatarUrl(avatarUrl) {
+}
+
+bool User::isNull() const {
+    return this->userId.isEmpty();
+}
+
+/*
+ * UserRegistry
+ */
+
+User UserRegistry::acquire(const Identifier &userId,
+                           const QString &   displayName,
+                           const QString &   avatarUrl) {
+    QMutexLocker locker(&this->m_lock);
+
+    return User(userId,
+                this->acquireString(displayName),
+                this->acquireString(avatarUrl));
+}
+
+void UserRegistry::release(const User &user) {
+    QMutexLocker locker(&this->m_lock);
+
+    this->releaseString(user.displayName);
+    this->releaseString(user.avatarUrl);
+}
+
+int UserRegistry::size() const {
+    QMutexLocker locker(&this->m_lock);
+    return this->m_strings.size();
+}
+
+QSharedPointer<UserRegistry> UserRegistry::shared() {
+    static QSharedPointer<UserRegistry> registry =
+        QSharedPointer<UserRegistry>::create();
+
+    return registry;
+}
+
+QString UserRegistry::acquireString(const QString &string) {
+    // Empty strings share no data anyway
+    if (string.isEmpty())
+        return QString();
+
+    QHash<QString, int>::iterator it = this->m_strings.find(string);
+
+    if (it == this->m_strings.end())
+        it = this->m_strings.insert(string, 0);
+
+    ++it.value();
+    return it.key();
+}
+
+void UserRegistry::releaseString(const QString &string) {
+    QHash<QString, int>::iterator it = this->m_strings.find(string);
+
+    if (it != this->m_strings.end() && --it.value() == 0)
+        this->m_strings.erase(it);
+}
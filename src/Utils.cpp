@@ -11,9 +11,16 @@
  *
  */
 
+#include <QAtomicInt>
 #include <QJsonDocument>
+#include <QSemaphore>
 #include <QTemporaryFile>
 
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include "Utils.hpp"
 
 using namespace MatrixCpp;
@@ -119,4 +126,57 @@ uint8_t *Utils::randomBytes(size_t len) {
     random[i] = rand() >> (remainder * 8);
 
     return random;
-}
\ No newline at end of file
+}
+
+bool Utils::syncToDisk(QFileDevice &file) {
+    if (!file.flush())
+        return false;
+
+#ifdef Q_OS_UNIX
+    return fsync(file.handle()) == 0;
+#else
+    return true;
+#endif
+}
+
+void Utils::syncDirectory(const QString &path) {
+#ifdef Q_OS_UNIX
+    int fd = open(QFile::encodeName(path).constData(), O_RDONLY);
+
+    if (fd < 0)
+        return;
+
+    fsync(fd);
+    close(fd);
+#else
+    Q_UNUSED(path)
+#endif
+}
+
+void Utils::parallelFor(QThreadPool &            pool,
+                        int                      count,
+                        std::function<void(int)> fn) {
+    if (count <= 0)
+        return;
+
+    QAtomicInt next = 0;
+    QSemaphore done;
+
+    auto work = [&]() {
+        for (int i = next.fetchAndAddRelaxed(1); i < count;
+             i     = next.fetchAndAddRelaxed(1))
+            fn(i);
+    };
+
+    // The calling thread works too
+    int helpers = qMin(pool.maxThreadCount(), count - 1);
+
+    for (int i = 0; i < helpers; i++)
+        pool.start([&]() {
+            work();
+            done.release();
+        });
+
+    work();
+    done.acquire(helpers);
+}
@@ -14,6 +14,8 @@
 #pragma once
 
 #include <QFile>
+#include <QThreadPool>
+#include <functional>
 
 namespace MatrixCpp {
 /**
@@ -70,5 +72,32 @@ QByteArray canonicalJson(QVariantMap json);
  * @return uint8_t* Random bytes pointer. Must be manually destroyed
  */
 uint8_t *randomBytes(size_t len);
+
+/**
+ * @brief Flushes file and waits until its contents reach the disk
+ *
+ * @param file An open file
+ * @return true
+ * @return false
+ */
+bool syncToDisk(QFileDevice &file);
+
+/**
+ * @brief Waits until directory entries (e.g. a rename) reach the disk
+ *
+ * @param path
+ */
+void syncDirectory(const QString &path);
+
+/**
+ * @brief Calls fn(0) to fn(count - 1) on pool and on the calling thread.
+   Every thread takes the next index as soon as it is done with one, so uneven
+   work is balanced. Blocks until all calls returned
+ *
+ * @param pool
+ * @param count
+ * @param fn
+ */
+void parallelFor(QThreadPool &pool, int count, std::function<void(int)> fn);
 } // namespace Utils
 } // namespace MatrixCpp
\ No newline at end of file
@@ -0,0 +1,324 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file GroupSessionStore.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements GroupSessionStore
+ * @version 0.1
+ * @date 2021-03-14
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QDebug>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+#include "GroupSessionStore.hpp"
+#include "src/Utils.hpp"
+
+using namespace MatrixCpp::Crypto;
+
+bool GroupSessionId::operator==(const GroupSessionId &other) const {
+    return this->sessionId == other.sessionId &&
+           this->senderKey == other.senderKey && this->roomId == other.roomId;
+}
+
+uint MatrixCpp::Crypto::qHash(const GroupSessionId &id, uint seed) {
+    // Session IDs are random, so they alone spread well
+    return Types::qHash(id.sessionId, seed);
+}
+
+GroupSessionStore::InboundSession::InboundSession(
+    OlmInboundGroupSession *session)
+    : session(session) {
+}
+
+GroupSessionStore::InboundSession::~InboundSession() {
+    olm_clear_inbound_group_session(this->session);
+    free(this->session);
+}
+
+GroupSessionStore::GroupSessionStore(QString path, QString key)
+    : key(key.toStdString()) {
+    this->file.setFileName(path);
+}
+
+GroupSessionStore::GroupSessionStore() {
+}
+
+bool GroupSessionStore::addInbound(const GroupSessionId &id,
+                                   const QByteArray &    sessionKey) {
+    QMutexLocker locker(&this->m_lock);
+
+    this->loadIndex();
+
+    OlmInboundGroupSession *session = newSession();
+    QByteArray              keyBuf  = sessionKey;
+
+    if (olm_init_inbound_group_session(session,
+                                       (uint8_t *) keyBuf.data(),
+                                       keyBuf.size()) == olm_error()) {
+        qWarning() << "MEGOLM invalid session key for" << id.sessionId << "("
+                   << olm_inbound_group_session_last_error(session) << ")";
+        InboundSession owner(session);
+        return false;
+    }
+
+    QByteArray sessionId(olm_inbound_group_session_id_length(session),
+                         Qt::Uninitialized);
+
+    if (olm_inbound_group_session_id(session,
+                                     (uint8_t *) sessionId.data(),
+                                     sessionId.size()) == olm_error() ||
+        sessionId != id.sessionId.toUtf8()) {
+        qWarning() << "MEGOLM session key does not match session"
+                   << id.sessionId;
+        InboundSession owner(session);
+        return false;
+    }
+
+    quint32 firstKnownIndex =
+        olm_inbound_group_session_first_known_index(session);
+
+    QHash<GroupSessionId, Record>::const_iterator record =
+        this->m_index.constFind(id);
+
+    // Keep the session able to decrypt the most messages
+    if (record != this->m_index.constEnd() &&
+        record->firstKnownIndex <= firstKnownIndex) {
+        InboundSession owner(session);
+        return true;
+    }
+
+    qDebug() << "MEGOLM adding session" << id.sessionId << "for"
+             << id.roomId;
+
+    this->append(id, session, firstKnownIndex);
+    this->m_cache.setMaxCost(this->cacheSize);
+    this->m_cache.insert(id, new InboundSession(session));
+    return true;
+}
+
+bool GroupSessionStore::contains(const GroupSessionId &id) {
+    QMutexLocker locker(&this->m_lock);
+
+    this->loadIndex();
+    return this->m_index.contains(id);
+}
+
+QByteArray GroupSessionStore::decrypt(const GroupSessionId &id,
+                                      const QByteArray &    ciphertext,
+                                      const QString &       eventId,
+                                      qint64                serverTs,
+                                      QString *             error) {
+    QMutexLocker locker(&this->m_lock);
+
+    OlmInboundGroupSession *session = this->session(id);
+
+    if (!session) {
+        if (error)
+            *error = "unknown session";
+        return "";
+    }
+
+    // olm destroys the message buffer, so every call gets its own copy
+    QByteArray message = ciphertext;
+    size_t     maxLength =
+        olm_group_decrypt_max_plaintext_length(session,
+                                               (uint8_t *) message.data(),
+                                               message.size());
+
+    if (maxLength == olm_error()) {
+        if (error)
+            *error = olm_inbound_group_session_last_error(session);
+        return "";
+    }
+
+    QByteArray plain(maxLength, Qt::Uninitialized);
+    uint32_t   messageIndex;
+
+    message       = ciphertext;
+    size_t length = olm_group_decrypt(session,
+                                      (uint8_t *) message.data(),
+                                      message.size(),
+                                      (uint8_t *) plain.data(),
+                                      maxLength,
+                                      &messageIndex);
+
+    if (length == olm_error()) {
+        if (error)
+            *error = olm_inbound_group_session_last_error(session);
+        return "";
+    }
+
+    plain.truncate(length);
+
+    // The same index may only ever be used by one event
+    QMap<quint32, QPair<QString, qint64>> &seen = this->m_seen[id];
+    QMap<quint32, QPair<QString, qint64>>::const_iterator first =
+        seen.constFind(messageIndex);
+
+    if (first != seen.constEnd() &&
+        (first->first != eventId || first->second != serverTs)) {
+        qWarning() << "MEGOLM message index" << messageIndex << "of"
+                   << id.sessionId << "replayed by" << eventId;
+
+        if (error)
+            *error = "replayed message index";
+        return "";
+    }
+
+    seen.insert(messageIndex, {eventId, serverTs});
+
+    while (seen.size() > qMax(1, this->seenPerSession))
+        seen.erase(seen.begin());
+
+    return plain;
+}
+
+OlmInboundGroupSession *GroupSessionStore::session(const GroupSessionId &id) {
+    // Try to find cached
+    InboundSession *cached = this->m_cache.object(id);
+
+    if (cached)
+        return cached->session;
+
+    this->loadIndex();
+
+    QHash<GroupSessionId, Record>::const_iterator record =
+        this->m_index.constFind(id);
+
+    if (record == this->m_index.constEnd())
+        return nullptr;
+
+    if (!this->file.open(QFile::ReadOnly))
+        throw std::runtime_error("MEGOLM could not open store file: " +
+                                 this->file.errorString().toStdString());
+
+    QByteArray line;
+
+    if (this->file.seek(record->offset))
+        line = this->file.readLine();
+
+    this->file.close();
+
+    QByteArray pickled = QJsonDocument::fromJson(line)
+                             .object()
+                             .value("pickle")
+                             .toString()
+                             .toUtf8();
+
+    OlmInboundGroupSession *session = newSession();
+
+    if (olm_unpickle_inbound_group_session(session,
+                                           this->key.c_str(),
+                                           this->key.length(),
+                                           pickled.data(),
+                                           pickled.size()) == olm_error()) {
+        qCritical() << "MEGOLM could not unpickle session" << id.sessionId
+                    << "(" << olm_inbound_group_session_last_error(session)
+                    << ")";
+        InboundSession owner(session);
+        return nullptr;
+    }
+
+    this->m_cache.setMaxCost(this->cacheSize);
+    this->m_cache.insert(id, new InboundSession(session));
+    return session;
+}
+
+void GroupSessionStore::loadIndex() {
+    if (this->m_indexLoaded)
+        return;
+
+    if (this->file.fileName().isEmpty())
+        throw std::runtime_error("MEGOLM please set a file name");
+
+    this->m_indexLoaded = true;
+
+    if (!this->file.exists())
+        return;
+
+    if (!this->file.open(QFile::ReadOnly))
+        throw std::runtime_error("MEGOLM could not open store file: " +
+                                 this->file.errorString().toStdString());
+
+    qint64 offset = 0;
+
+    while (!this->file.atEnd()) {
+        QByteArray line = this->file.readLine();
+
+        // Last record was not completely written
+        if (!line.endsWith('\n'))
+            break;
+
+        const QJsonObject record = QJsonDocument::fromJson(line).object();
+        GroupSessionId    id     = {record.value("room_id").toString(),
+                             record.value("sender_key").toString(),
+                             record.value("session_id").toString()};
+
+        // Later records supersede earlier ones
+        if (!id.sessionId.isEmpty())
+            this->m_index.insert(
+                id,
+                {offset, (quint32) record.value("first_known_index").toInt()});
+
+        offset += line.size();
+    }
+
+    qint64 size = this->file.size();
+    this->file.close();
+
+    // Drop a torn record, else next append would be glued to it
+    if (offset < size) {
+        qWarning() << "MEGOLM dropping incomplete record at" << offset;
+        this->file.resize(offset);
+    }
+}
+
+void GroupSessionStore::append(const GroupSessionId &  id,
+                               OlmInboundGroupSession *session,
+                               quint32                 firstKnownIndex) {
+    QByteArray pickled(olm_pickle_inbound_group_session_length(session),
+                       Qt::Uninitialized);
+
+    if (olm_pickle_inbound_group_session(session,
+                                         this->key.c_str(),
+                                         this->key.length(),
+                                         pickled.data(),
+                                         pickled.size()) == olm_error())
+        throw std::runtime_error("MEGOLM could not pickle session " +
+                                 id.sessionId.toUtf8().toStdString());
+
+    QJsonObject record;
+
+    record["room_id"]           = id.roomId.toString();
+    record["sender_key"]        = id.senderKey.toString();
+    record["session_id"]        = id.sessionId.toString();
+    record["first_known_index"] = (qint64) firstKnownIndex;
+    record["pickle"]            = QString::fromUtf8(pickled);
+
+    QByteArray line = QJsonDocument(record).toJson(QJsonDocument::Compact);
+
+    if (!this->file.open(QFile::Append))
+        throw std::runtime_error("MEGOLM could not open store file: " +
+                                 this->file.errorString().toStdString());
+
+    qint64 offset = this->file.pos();
+
+    if (this->file.write(line + "\n") < 0 ||
+        !Utils::syncToDisk(this->file)) {
+        this->file.close();
+        throw std::runtime_error("MEGOLM failed to update store file");
+    }
+
+    this->file.close();
+    this->m_index.insert(id, {offset, firstKnownIndex});
+}
+
+OlmInboundGroupSession *GroupSessionStore::newSession() {
+    return olm_inbound_group_session(
+        malloc(olm_inbound_group_session_size()));
+}
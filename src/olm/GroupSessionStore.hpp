@@ -0,0 +1,177 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file GroupSessionStore.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares GroupSessionStore, which stores inbound megolm sessions
+ * @version 0.1
+ * @date 2021-03-14
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QCache>
+#include <QFile>
+#include <QHash>
+#include <QMap>
+#include <QMutex>
+#include <olm/olm.h>
+
+#include <MatrixCpp/Identifier.hpp>
+
+namespace MatrixCpp::Crypto {
+/**
+ * @brief Identifies an inbound megolm session
+ *
+ */
+struct GroupSessionId {
+    Types::Identifier roomId;    ///< Room the session encrypts events of
+    Types::Identifier senderKey; ///< curve25519 key of the sending device
+    Types::Identifier sessionId; ///< megolm session ID
+
+    bool operator==(const GroupSessionId &other) const;
+};
+
+uint qHash(const GroupSessionId &id, uint seed = 0);
+
+/**
+ * @brief Manages storage of inbound megolm sessions
+ *
+ * Sessions are pickled to an append-only file, one JSON record per line, as
+ * soon as their key is received. Unpickled sessions are kept in a cache of
+ * cacheSize entries. The last seenPerSession message indexes are tracked per
+ * session, so a replayed message is rejected. Every public method is
+ * thread-safe.
+ */
+class GroupSessionStore {
+  public:
+    /**
+     * @brief Construct a new Group Session Store object
+     *
+     * @param path
+     * @param key key used to encrypt pickled sessions
+     */
+    explicit GroupSessionStore(QString path, QString key = "");
+
+    explicit GroupSessionStore();
+
+    /**
+     * @brief Adds an inbound session from a m.room_key session key. Ignored
+       if we already have the session from an earlier or the same message
+       index
+     *
+     * @param id
+     * @param sessionKey
+     * @return true The session is known now
+     * @return false sessionKey is invalid or not for id
+     */
+    bool addInbound(const GroupSessionId &id, const QByteArray &sessionKey);
+
+    /**
+     * @brief Whether we have the specified session
+     *
+     * @param id
+     * @return true
+     * @return false
+     */
+    bool contains(const GroupSessionId &id);
+
+    /**
+     * @brief Decrypts a megolm message
+     *
+     * @param id
+     * @param ciphertext
+     * @param eventId Event the message belongs to, for replay detection
+     * @param serverTs Timestamp of that event, for replay detection
+     * @param error Set to the reason of failure, if any
+     * @return QByteArray Decrypted JSON payload or empty if failed
+     */
+    QByteArray decrypt(const GroupSessionId &id,
+                       const QByteArray &    ciphertext,
+                       const QString &       eventId,
+                       qint64                serverTs,
+                       QString *             error = nullptr);
+
+    QFile       file; ///< This is the file the store is saved to
+    std::string key;  ///< Key used to encrypt pickled sessions
+
+    /**
+     * @brief Maximum count of unpickled sessions kept in memory
+     *
+     */
+    int cacheSize = 512;
+
+    /**
+     * @brief Maximum count of message indexes tracked per session. The lowest
+       index is forgotten first, as messages mostly arrive in order
+     *
+     */
+    int seenPerSession = 1024;
+
+  private:
+    /**
+     * @brief Owns an unpickled session, so QCache can free it
+     *
+     */
+    struct InboundSession {
+        explicit InboundSession(OlmInboundGroupSession *session);
+        ~InboundSession();
+
+        OlmInboundGroupSession *session;
+    };
+
+    /**
+     * @brief Where a session record is in file
+     *
+     */
+    struct Record {
+        qint64  offset;
+        quint32 firstKnownIndex;
+    };
+
+    /**
+     * @brief Get an unpickled session, from cache or from file. m_lock must be
+       held
+     *
+     * @param id
+     * @return OlmInboundGroupSession* nullptr if unknown. Valid until the
+       next cache insertion
+     */
+    OlmInboundGroupSession *session(const GroupSessionId &id);
+
+    /**
+     * @brief Indexes every record of the store file, if not done yet
+     *
+     */
+    void loadIndex();
+
+    /**
+     * @brief Pickles session and appends its record to the store file
+     *
+     * @param id
+     * @param session
+     * @param firstKnownIndex
+     */
+    void append(const GroupSessionId &  id,
+                OlmInboundGroupSession *session,
+                quint32                 firstKnownIndex);
+
+    static OlmInboundGroupSession *newSession();
+
+    QCache<GroupSessionId, InboundSession> m_cache;
+    QHash<GroupSessionId, Record>          m_index;
+    bool                                   m_indexLoaded = false;
+
+    /**
+     * @brief Event ID and timestamp of the last seenPerSession decrypted
+       message indexes, by session
+     *
+     */
+    QHash<GroupSessionId, QMap<quint32, QPair<QString, qint64>>> m_seen;
+
+    QMutex m_lock;
+};
+} // namespace MatrixCpp::Crypto
@@ -49,13 +49,28 @@ Olm::Olm(Client *client)
                                               client->deviceId + ".jsonl")));
     this->m_sessions.olm = this->m_account;
     this->m_sessions.key = client->accessToken().toStdString();
+
+    this->m_groupSessions.file.setFileName(client->storeDir.filePath(
+        "megolm_" + QUrl::toPercentEncoding(client->userId() + "_" +
+                                            client->deviceId + ".jsonl")));
+    this->m_groupSessions.key = client->accessToken().toStdString();
+
+    connect(this, &Olm::toDeviceDecrypted, client, &Client::toDeviceEvent);
 }
 
 Olm::~Olm() {
+    // Workers use the account, let them finish
+    this->m_decryptPool.waitForDone();
     olm_clear_account(this->m_account);
 }
 
+void Olm::save() {
+    QMutexLocker locker(&this->m_accountLock);
+    JsonFile::save();
+}
+
 QVariant Olm::encode() {
+    QMutexLocker locker(&this->m_accountLock);
     QVariantHash json;
 
     json["device_keys_uploaded"] = this->deviceKeysUploaded;
@@ -121,6 +136,8 @@ void Olm::load() {
 }
 
 QString Olm::deviceKeys() {
+    QMutexLocker locker(&this->m_accountLock);
+
     if (!this->m_deviceKeys.isEmpty())
         return this->m_deviceKeys;
 
@@ -140,6 +157,8 @@ QString Olm::deviceKeys() {
 }
 
 QString Olm::sign(QString message) {
+    QMutexLocker locker(&this->m_accountLock);
+
     int         signSize = olm_account_signature_length(this->m_account);
     char *      sign     = (char *) malloc(signSize);
     std::string msg      = message.toStdString();
@@ -183,10 +202,12 @@ ResponseFuture *Olm::sendKeys() {
         if (uploadingDeviceKeys)
             // Fisrt time sending device keys
             this->deviceKeysUploaded = true;
-        else
+        else {
             // Else we are uploading one time keys. Mark them as published,
             // because upload was successful
+            QMutexLocker locker(&this->m_accountLock);
             olm_account_mark_keys_as_published(this->m_account);
+        }
 
         this->save();
     });
@@ -194,6 +215,16 @@ ResponseFuture *Olm::sendKeys() {
     return future;
 }
 
+void Olm::sendKeysIfNeeded() {
+    if (this->m_sendingKeys ||
+        (this->deviceKeysUploaded && !this->shouldUploadOneTimeKeys()))
+        return;
+
+    this->m_sendingKeys = true;
+    this->sendKeys()->always(
+        [=](Response) { this->m_sendingKeys = false; });
+}
+
 bool Olm::shouldUploadOneTimeKeys() {
     return this->oneTimeKeysToUploadCount() > 0;
 }
@@ -205,15 +236,16 @@ QByteArray Olm::decrypt(QString ciphertext,
     QList<OlmSession *> sessions;
 
     if (this->m_sessions[senderKey].isEmpty()) {
-        OlmSession *session =
-            this->m_sessions.createInbound(ciphertext, senderKey);
+        OlmSession *session = this->createInbound(ciphertext, senderKey);
 
         if (!session) {
             qWarning() << "OLM could not decrypt";
             return "";
         }
 
-        this->save();
+        // Its one time key is used up, so decrypt with it rather than
+        // creating another
+        sessions.append(session);
     } else if (!sessionId.isEmpty() &&
                this->m_sessions[senderKey].contains(sessionId))
         sessions.append(this->m_sessions[senderKey][sessionId]);
@@ -231,32 +263,32 @@ QByteArray Olm::decrypt(QString ciphertext,
         buf         = (char *) malloc(ciphertext.length());
         memcpy(buf, ciphertext.toStdString().c_str(), ciphertext.length());
 
-        if (olm_decrypt(
-                session, type, buf, ciphertext.length(), plain, plainSize) ==
-            olm_error()) {
+        size_t plainLength = olm_decrypt(
+            session, type, buf, ciphertext.length(), plain, plainSize);
+
+        if (plainLength == olm_error()) {
             // Free stuff and try again
             free(plain);
             continue;
         }
 
-        // If we are here, decryption was successful
-        QByteArray decrypted(plain, plainSize);
+        // If we are here, decryption was successful. Ratchet advanced, so
+        // persist session
+        QByteArray decrypted(plain, plainLength);
         free(plain);
+        this->m_sessions.update(senderKey);
         return decrypted;
     }
 
     // If not decrypted and type == 0, try creating a new session
     if (type == 0) {
-        OlmSession *session =
-            this->m_sessions.createInbound(ciphertext, senderKey);
+        OlmSession *session = this->createInbound(ciphertext, senderKey);
 
         if (!session) {
             qWarning() << "OLM could not decrypt";
             return "";
         }
 
-        this->save();
-
         // XXX: repeated code
 
         char *buf = (char *) malloc(ciphertext.length());
@@ -269,15 +301,17 @@ QByteArray Olm::decrypt(QString ciphertext,
         buf         = (char *) malloc(ciphertext.length());
         memcpy(buf, ciphertext.toStdString().c_str(), ciphertext.length());
 
-        if (olm_decrypt(
-                session, type, buf, ciphertext.length(), plain, plainSize) ==
-            olm_error())
+        size_t plainLength = olm_decrypt(
+            session, type, buf, ciphertext.length(), plain, plainSize);
+
+        if (plainLength == olm_error())
             // Free stuff and try again
             free(plain);
         else {
             // If we are here, decryption was successful
-            QByteArray decrypted(plain, plainSize);
+            QByteArray decrypted(plain, plainLength);
             free(plain);
+            this->m_sessions.update(senderKey);
             return decrypted;
         }
     }
@@ -288,6 +322,8 @@ QByteArray Olm::decrypt(QString ciphertext,
 }
 
 QString Olm::curve25519() {
+    QMutexLocker locker(&this->m_accountLock);
+
     if (!this->m_curve25519.isEmpty())
         return this->m_curve25519;
 
@@ -298,7 +334,22 @@ QString Olm::curve25519() {
     return this->m_curve25519;
 }
 
+QString Olm::ed25519() {
+    QMutexLocker locker(&this->m_accountLock);
+
+    if (!this->m_ed25519.isEmpty())
+        return this->m_ed25519;
+
+    this->m_ed25519 =
+        QJsonDocument::fromJson(this->deviceKeys().toUtf8())["ed25519"]
+            .toString();
+
+    return this->m_ed25519;
+}
+
 int Olm::maxOneTimeKeys() {
+    QMutexLocker locker(&this->m_accountLock);
+
     if (this->m_maxOneTimeKeys > 0)
         return this->m_maxOneTimeKeys;
 
@@ -322,7 +373,7 @@ QVariantMap Olm::serializeDeviceKeys() {
     deviceKeys["user_id"]   = userId;
     deviceKeys["device_id"] = deviceId;
     deviceKeys["algorithms"] =
-        QStringList({"m.olm.curve25519-aes-sha256", "m.megolm.v1.aes-sha"});
+        QStringList({OLM_ALGORITHM, MEGOLM_ALGORITHM});
     deviceKeys["keys"] = keys;
 
     selfSignature["ed25519:" + deviceId] =
@@ -337,6 +388,8 @@ QVariantMap Olm::serializeDeviceKeys() {
 QVariantMap Olm::serializeOneTimeKeys(int count) {
     assert(count > 0);
 
+    QMutexLocker locker(&this->m_accountLock);
+
     int randomSize = olm_account_generate_one_time_keys_random_length(
         this->m_account, count);
     uint8_t *randomBytes = Utils::randomBytes(randomSize);
@@ -379,9 +432,283 @@ QVariantMap Olm::serializeOneTimeKeys(int count) {
     return data;
 }
 
+void Olm::decryptToDevice(const QList<Types::ToDeviceEvent> &events) {
+    QMutexLocker locker(&this->m_queueLock);
+
+    for (const Types::ToDeviceEvent &event : events) {
+        if (event.content.value("algorithm").toString() != OLM_ALGORITHM) {
+            qWarning() << "OLM unsupported to-device algorithm"
+                       << event.content.value("algorithm").toString();
+            continue;
+        }
+
+        this->m_toDeviceQueue[event.senderKey].append(event);
+
+        // A worker is already draining this sender's queue
+        if (this->m_decrypting.contains(event.senderKey))
+            continue;
+
+        Types::Identifier senderKey = event.senderKey;
+        this->m_decrypting.insert(senderKey);
+        this->m_decryptPool.start([=]() { this->decryptQueue(senderKey); });
+    }
+}
+
+bool Olm::decryptRoomEvent(const Types::Identifier &roomId,
+                           Types::RoomEvent &       event,
+                           bool *                   held) {
+    *held = false;
+
+    if (event.content.value("algorithm").toString() != MEGOLM_ALGORITHM) {
+        qWarning() << "MEGOLM unsupported algorithm"
+                   << event.content.value("algorithm").toString();
+        return true;
+    }
+
+    GroupSessionId id = {roomId,
+                         event.content.value("sender_key").toString(),
+                         event.content.value("session_id").toString()};
+
+    if (!this->m_groupSessions.contains(id)) {
+        qDebug() << "MEGOLM holding" << event.eventId << "until session"
+                 << id.sessionId << "arrives";
+
+        QMutexLocker locker(&this->m_pendingLock);
+
+        // Keys may never come, so keep only the newest events
+        if (this->m_pendingRoomEvents.value(id).size() >=
+            qMax(1, this->maxPendingPerSession))
+            this->dropPending(id);
+
+        if (this->m_pendingOrder.size() >= qMax(1, this->maxPending))
+            this->dropPending(this->m_pendingOrder.first());
+
+        this->m_pendingRoomEvents[id].append(event);
+        this->m_pendingOrder.append(id);
+
+        *held = true;
+        return true;
+    }
+
+    return this->decryptMegolm(id, event);
+}
+
 int Olm::oneTimeKeysToUploadCount() {
     if (this->uploadedOneTimeKeys < 0)
         return -1;
 
     return this->maxOneTimeKeys() / 2 - this->uploadedOneTimeKeys;
 }
+
+OlmSession *Olm::createInbound(QString ciphertext, QString senderKey) {
+    QMutexLocker locker(&this->m_accountLock);
+
+    OlmSession *session = this->m_sessions.createInbound(ciphertext, senderKey);
+
+    // One time key used by this session was removed from the account
+    if (session)
+        this->save();
+
+    return session;
+}
+
+void Olm::decryptQueue(const Types::Identifier &senderKey) {
+    forever {
+        Types::ToDeviceEvent event;
+
+        {
+            QMutexLocker locker(&this->m_queueLock);
+            QList<Types::ToDeviceEvent> &queue =
+                this->m_toDeviceQueue[senderKey];
+
+            if (queue.isEmpty()) {
+                this->m_toDeviceQueue.remove(senderKey);
+                this->m_decrypting.remove(senderKey);
+                return;
+            }
+
+            event = queue.takeFirst();
+        }
+
+        Types::ToDeviceEvent decrypted = this->decryptEvent(event);
+
+        if (decrypted.isBroken())
+            continue;
+
+        // Queued calls from this thread run in order, so do events of a sender
+        QMetaObject::invokeMethod(
+            this,
+            [=]() {
+                if (decrypted.type == Types::Event::M_ROOM_KEY)
+                    this->onRoomKey(decrypted);
+
+                emit this->toDeviceDecrypted(decrypted);
+            },
+            Qt::QueuedConnection);
+    }
+}
+
+Types::ToDeviceEvent Olm::decryptEvent(const Types::ToDeviceEvent &event) {
+    const QJsonObject ciphertext = event.content.value("ciphertext")
+                                       .toObject()
+                                       .value(this->curve25519())
+                                       .toObject();
+
+    if (ciphertext.isEmpty()) {
+        qWarning() << "OLM to-device event from" << event.sender
+                   << "not encrypted for this device";
+        return Types::ToDeviceEvent();
+    }
+
+    QByteArray plain = this->decrypt(ciphertext.value("body").toString(),
+                                     event.senderKey.toString(),
+                                     ciphertext.value("type").toInt());
+
+    if (plain.isEmpty())
+        return Types::ToDeviceEvent();
+
+    Types::ToDeviceEvent decrypted(plain);
+
+    if (decrypted.isBroken()) {
+        qWarning() << "OLM broken payload from" << event.sender;
+        return decrypted;
+    }
+
+    // Payload must claim the same sender the server delivered it from
+    if (decrypted.sender != event.sender) {
+        qWarning() << "OLM payload sender" << decrypted.sender
+                   << "does not match" << event.sender;
+        return Types::ToDeviceEvent();
+    }
+
+    const QJsonObject payload = QJsonDocument::fromJson(plain).object();
+
+    // And be meant for this user and device
+    if (payload.value("recipient").toString() != this->m_client->userId()) {
+        qWarning() << "OLM payload from" << event.sender
+                   << "is for another user";
+        return Types::ToDeviceEvent();
+    }
+
+    if (payload.value("recipient_keys")
+            .toObject()
+            .value("ed25519")
+            .toString() != this->ed25519()) {
+        qWarning() << "OLM payload from" << event.sender
+                   << "is for another device";
+        return Types::ToDeviceEvent();
+    }
+
+    QString senderEd25519 =
+        payload.value("keys").toObject().value("ed25519").toString();
+
+    if (senderEd25519.isEmpty()) {
+        qWarning() << "OLM payload from" << event.sender
+                   << "has no sender ed25519 key";
+        return Types::ToDeviceEvent();
+    }
+
+    {
+        QMutexLocker locker(&this->m_senderLock);
+        QString &    pinned = this->m_senderEd25519[event.senderKey];
+
+        if (pinned.isEmpty())
+            pinned = senderEd25519;
+        else if (pinned != senderEd25519) {
+            qWarning() << "OLM payload from" << event.sender
+                       << "claims ed25519 key" << senderEd25519 << "not"
+                       << pinned;
+            return Types::ToDeviceEvent();
+        }
+    }
+
+    decrypted.senderKey = event.senderKey;
+    decrypted.decrypted = true;
+    return decrypted;
+}
+
+void Olm::onRoomKey(const Types::ToDeviceEvent &event) {
+    // Room keys sent in the clear could come from anyone
+    if (!event.decrypted ||
+        event.content.value("algorithm").toString() != MEGOLM_ALGORITHM)
+        return;
+
+    GroupSessionId id = {event.content.value("room_id").toString(),
+                         event.senderKey,
+                         event.content.value("session_id").toString()};
+
+    if (!this->m_groupSessions.addInbound(
+            id, event.content.value("session_key").toString().toUtf8()))
+        return;
+
+    QList<Types::RoomEvent> pending;
+
+    {
+        QMutexLocker locker(&this->m_pendingLock);
+        pending = this->m_pendingRoomEvents.take(id);
+
+        if (!pending.isEmpty())
+            this->m_pendingOrder.removeAll(id);
+    }
+
+    // Those failing were logged, and are dropped
+    for (Types::RoomEvent roomEvent : pending)
+        if (this->decryptMegolm(id, roomEvent))
+            emit this->roomEventDecrypted(id.roomId.toString(), roomEvent);
+}
+
+bool Olm::decryptMegolm(const GroupSessionId &id, Types::RoomEvent &event) {
+    QString    error;
+    QByteArray plain = this->m_groupSessions.decrypt(
+        id,
+        event.content.value("ciphertext").toString().toUtf8(),
+        event.eventId,
+        event.serverTs,
+        &error);
+
+    if (plain.isEmpty()) {
+        qWarning() << "MEGOLM could not decrypt" << event.eventId << "("
+                   << error << ")";
+        return false;
+    }
+
+    const QJsonObject payload = QJsonDocument::fromJson(plain).object();
+
+    // Payload must be meant for the room the server delivered it to
+    if (Types::Identifier(payload.value("room_id").toString()) != id.roomId) {
+        qWarning() << "MEGOLM payload of" << event.eventId
+                   << "is for another room";
+        return false;
+    }
+
+    // Keep event_id, sender, origin_server_ts and unsigned of the outer event
+    QJsonObject merged = event.data.toObject();
+    merged.insert("type", payload.value("type"));
+    merged.insert("content", payload.value("content"));
+
+    Types::RoomEvent decrypted = QJsonValue(merged);
+
+    if (decrypted.isBroken()) {
+        qWarning() << "MEGOLM broken payload in" << event.eventId;
+        return false;
+    }
+
+    event = decrypted;
+    return true;
+}
+
+void Olm::dropPending(const GroupSessionId &id) {
+    QList<Types::RoomEvent> &events = this->m_pendingRoomEvents[id];
+
+    if (!events.isEmpty()) {
+        qWarning() << "MEGOLM dropping" << events.first().eventId
+                   << "held for session" << id.sessionId;
+        events.removeFirst();
+    }
+
+    if (events.isEmpty())
+        this->m_pendingRoomEvents.remove(id);
+
+    // Its first entry is its oldest event
+    this->m_pendingOrder.removeOne(id);
+}
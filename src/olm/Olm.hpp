@@ -14,13 +14,21 @@
 #pragma once
 
 #include <QDir>
+#include <QHash>
+#include <QMutex>
+#include <QSet>
+#include <QThreadPool>
 #include <olm/olm.h>
 
 #include <MatrixCpp/Client.hpp>
 
+#include "GroupSessionStore.hpp"
 #include "SessionStore.hpp"
 #include "src/Utils.hpp"
 
+#define OLM_ALGORITHM    "m.olm.v1.curve25519-aes-sha2"
+#define MEGOLM_ALGORITHM "m.megolm.v1.aes-sha2"
+
 #define olm_check_error(function, msg) \
     if (function == olm_error())       \
         throw std::runtime_error(      \
@@ -34,6 +42,8 @@ namespace MatrixCpp::Crypto {
  * This class offers:
  *   - Saving OlmAccount to a JSON file
  *   - Encrypting/decrypting events
+ *
+ * The account is guarded by a lock, so decrypt() can run on worker threads.
  */
 class Olm : public QObject, public JsonFile {
     Q_OBJECT
@@ -52,6 +62,12 @@ class Olm : public QObject, public JsonFile {
      */
     ~Olm();
 
+    /**
+     * @brief Saves the account to file. Thread-safe
+     *
+     */
+    void save() override;
+
     /**
      * @brief Create or get deivce keys
      *
@@ -66,6 +82,13 @@ class Olm : public QObject, public JsonFile {
      */
     Responses::ResponseFuture *sendKeys();
 
+    /**
+     * @brief Send identity or one time keys if there are any to send and no
+       upload is already ongoing. Does not block
+     *
+     */
+    void sendKeysIfNeeded();
+
     /**
      * @brief Max one time keys this account can handle
      *
@@ -103,6 +126,33 @@ class Olm : public QObject, public JsonFile {
                        int     type,
                        QString sessionId = "");
 
+    /**
+     * @brief Queues olm encrypted to-device events for decryption. Events are
+       grouped by sender key: groups are decrypted in parallel on a thread
+       pool, while events of one sender are decrypted in order, one at a time.
+       Each decrypted event is emitted by toDeviceDecrypted() on the thread
+       this object lives in. Does not block
+     *
+     * @param events m.room.encrypted to-device events
+     */
+    void decryptToDevice(const QList<Types::ToDeviceEvent> &events);
+
+    /**
+     * @brief Decrypts a megolm encrypted room event in place. If we do not
+       have its room key yet, the event is held until the key arrives and is
+       then emitted by roomEventDecrypted(). Thread-safe
+     *
+     * @param roomId Room the event was received in
+     * @param event m.room.encrypted event, replaced by the decrypted one
+     * @param held Set to whether event was held
+     * @return true event was decrypted, held, or is of an algorithm we do not
+       support and is left as is
+     * @return false event could not be decrypted and must be dropped
+     */
+    bool decryptRoomEvent(const Types::Identifier &roomId,
+                          Types::RoomEvent &       event,
+                          bool *                   held);
+
     /**
      * @brief Get curve25519 device key
      *
@@ -110,6 +160,27 @@ class Olm : public QObject, public JsonFile {
      */
     QString curve25519();
 
+    /**
+     * @brief Get ed25519 device key
+     *
+     * @return QString
+     */
+    QString ed25519();
+
+    /**
+     * @brief Maximum count of room events held per megolm session until its
+       room key arrives. The oldest one is dropped first
+     *
+     */
+    int maxPendingPerSession = 100;
+
+    /**
+     * @brief Maximum count of room events held in all, across sessions. The
+       oldest one is dropped first
+     *
+     */
+    int maxPending = 1000;
+
     bool deviceKeysUploaded = false; ///< Whether keys have been uploaded or not
     int  uploadedOneTimeKeys =
         -1; ///< Total uploaded one time keys we have track of
@@ -117,6 +188,23 @@ class Olm : public QObject, public JsonFile {
   signals:
     void olmError(QString error);
 
+    /**
+     * @brief Emitted for every to-device event decrypted by decryptToDevice()
+     *
+     * @param event The decrypted payload
+     */
+    void toDeviceDecrypted(Types::ToDeviceEvent event);
+
+    /**
+     * @brief Emitted for every event held by decryptRoomEvent(), once its room
+       key arrived
+     *
+     * @param roomId
+     * @param event The decrypted event, or the encrypted one if decryption
+       failed
+     */
+    void roomEventDecrypted(QString roomId, Types::RoomEvent event);
+
   protected:
     QVariant encode() override;
 
@@ -137,13 +225,92 @@ class Olm : public QObject, public JsonFile {
     QVariantMap serializeOneTimeKeys(int count);
     int         oneTimeKeysToUploadCount();
 
+    /**
+     * @brief Creates an inbound session from a pre-key message and saves the
+       account, whose one time keys changed
+     *
+     * @param ciphertext
+     * @param senderKey
+     * @return OlmSession* nullptr on failure
+     */
+    OlmSession *createInbound(QString ciphertext, QString senderKey);
+
+    /**
+     * @brief Decrypts queued to-device events of senderKey until there are
+       none left. Runs on m_decryptPool
+     *
+     * @param senderKey
+     */
+    void decryptQueue(const Types::Identifier &senderKey);
+
+    /**
+     * @brief Decrypts one to-device event
+     *
+     * @param event
+     * @return Types::ToDeviceEvent Broken if decryption failed
+     */
+    Types::ToDeviceEvent decryptEvent(const Types::ToDeviceEvent &event);
+
+    /**
+     * @brief Stores the session of a decrypted m.room_key event and releases
+       events held for it
+     *
+     * @param event
+     */
+    void onRoomKey(const Types::ToDeviceEvent &event);
+
+    /**
+     * @brief Decrypts a megolm event in place. Left untouched if it fails
+     *
+     * @param id
+     * @param event
+     * @return true
+     * @return false it failed, which is logged
+     */
+    bool decryptMegolm(const GroupSessionId &id, Types::RoomEvent &event);
+
+    /**
+     * @brief Drops the oldest event held for id. m_pendingLock must be held
+     *
+     * @param id
+     */
+    void dropPending(const GroupSessionId &id);
+
     OlmAccount *m_account = nullptr;
     QString     m_deviceKeys;
     Client *    m_client         = nullptr;
     int         m_maxOneTimeKeys = -1;
+    bool        m_sendingKeys    = false;
     std::string m_key;
     QString     m_curve25519;
+    QString     m_ed25519;
+
+    SessionStore      m_sessions;
+    GroupSessionStore m_groupSessions;
+
+    /**
+     * @brief Room events waiting for their room key
+     *
+     */
+    QHash<GroupSessionId, QList<Types::RoomEvent>> m_pendingRoomEvents;
+    QList<GroupSessionId> m_pendingOrder; ///< Session of every held event
+    QMutex m_pendingLock; ///< Rooms may be decrypted concurrently
+
+    /**
+     * @brief Sender curve25519 key to the ed25519 key its first olm payload
+       claimed. We do not query device keys, so later payloads of the device
+       must claim the same one
+     *
+     */
+    QHash<Types::Identifier, QString> m_senderEd25519;
+    QMutex m_senderLock; ///< Senders are decrypted concurrently
+
+    QRecursiveMutex m_accountLock; ///< Guards m_account and the account file
 
-    SessionStore m_sessions;
+    // To-device decryption
+    QThreadPool                                 m_decryptPool;
+    QMutex                                      m_queueLock;
+    QHash<Types::Identifier, QList<Types::ToDeviceEvent>> m_toDeviceQueue;
+    QSet<Types::Identifier> m_decrypting; ///< Sender keys
 };
 } // namespace MatrixCpp::Crypto
@@ -11,7 +11,12 @@
  *
  */
 
+#include <QDataStream>
+#include <QFileInfo>
 #include <QJsonDocument>
+#include <QJsonObject>
+#include <QSaveFile>
+#include <QUuid>
 #include <olm/olm.h>
 
 #include "SessionStore.hpp"
@@ -19,140 +24,49 @@
 
 using namespace MatrixCpp::Crypto;
 
+static const quint32 INDEX_MAGIC   = 0x4d435349; // "MCSI"
+static const quint32 INDEX_VERSION = 2;
+
 SessionStore::SessionStore(QString path, OlmAccount *olm, QString key)
     : key(key.toStdString()), olm(olm) {
     this->file.setFileName(path);
+    this->m_compactor.setMaxThreadCount(1);
 }
 
 SessionStore::SessionStore() {
+    this->m_compactor.setMaxThreadCount(1);
 }
 
 SessionStore::~SessionStore() {
+    this->m_compactor.waitForDone();
+
     for (auto sessions : this->m_devices)
         for (OlmSession *session : sessions)
             olm_clear_session(session);
 }
 
 QMap<QString, OlmSession *> SessionStore::operator[](QString deviceKey) {
-    if (this->file.fileName().isEmpty())
-        throw std::runtime_error("SESSION please set a file name");
-
-    // Try to find cached
-    if (!this->m_devices[deviceKey].isEmpty())
-        return this->m_devices[deviceKey];
-
-    // Else try to load from file
-    if (!this->file.open(QFile::ReadOnly)) {
-        if (!this->file.exists()) {
-            // We cannot throw error when file does not exist, so cache empty
-            // map and return it
-            this->m_devices[deviceKey] = {};
-            return {};
-        } else
-            throw std::runtime_error("SESSION could not open store file: " +
-                                     this->file.errorString().toStdString());
-    }
-
-    int        lineNumber = 0;
-    QByteArray line;
-
-    while ((line = this->file.readLine()) != "") {
-        lineNumber++;
-
-        QJsonParseError error;
-        QVariantMap     parsed =
-            QJsonDocument::fromJson(line, &error).toVariant().toMap();
-
-        if (error.error != QJsonParseError::NoError) {
-            qCritical() << "SESSION failed to parse line" << lineNumber << "("
-                        << error.errorString() << ")";
-            continue;
-        }
-
-        if (!parsed[deviceKey].isNull()) {
-            // Then we found the stored session. Unpickle it, cache and
-            // return
-            this->file.close();
-            return this->unpickleAndCache(deviceKey, parsed[deviceKey].toMap());
-        }
-    }
-    this->file.close();
-
-    // Then we have not found any sessions. Return empty map
-    // Also cache empty map so we do not read the file again
-    this->m_devices[deviceKey] = {};
-    return {};
+    QMutexLocker locker(&this->m_lock);
+    return this->sessions(deviceKey);
 }
 
 void SessionStore::save() {
+    QMutexLocker locker(&this->m_lock);
+
     if (this->file.fileName().isEmpty())
         throw std::runtime_error("SESSION please set a file name");
 
     qDebug() << "SESSION saving";
 
-    QFile newFile(this->file.fileName() + ".new");
-
-    // Open in ReadWrite mode because the file could not exist yet
-    if (!(this->file.open(QFile::ReadWrite) &&
-          newFile.open(QFile::WriteOnly))) {
-        this->file.close(); // Can be opened, so close just to make sure
-        throw std::runtime_error("SESSION could not open store file");
-    }
-
-    QStringList newDevices = this->m_devices.keys();
-    int         lineNumber = 0;
-    QByteArray  line;
-
-    while ((line = this->file.readLine()) != "") {
-        lineNumber++;
-
-        QJsonParseError error;
-        QVariantMap     parsed =
-            QJsonDocument::fromJson(line, &error).toVariant().toMap();
-
-        if (error.error != QJsonParseError::NoError) {
-            qCritical() << "SESSION failed to parse line" << lineNumber << "("
-                        << error.errorString() << ")";
-            continue;
-        }
-
-        QString deviceKey(parsed.keys().first());
-
-        if (this->m_devices.contains(deviceKey) &&
-            !this->m_devices[deviceKey].isEmpty()) {
-            // Then update record
-            line =
-                this->serializeSessions(deviceKey, this->m_devices[deviceKey]) +
-                "\n";
-            newDevices.removeAll(deviceKey);
-        }
-
-        if (newFile.write(line) < 0) {
-            this->file.close();
-            newFile.close();
-            throw std::runtime_error("SESSION failed to update store file");
-        }
-    }
-
-    // Add new devices
-    for (QString deviceKey : newDevices) {
-        QByteArray line(
-            this->serializeSessions(deviceKey, this->m_devices[deviceKey]));
-
-        if (newFile.write(line) < 0) {
-            this->file.close();
-            newFile.close();
-            throw std::runtime_error("SESSION failed to update store file");
-        }
-    }
-
-    this->file.close();
-    newFile.close();
+    for (const Types::Identifier &deviceKey : this->m_devices.keys())
+        this->append(deviceKey.toString());
+}
 
-    if (!this->file.remove())
-        throw std::runtime_error("SESSION could not update store file");
+void SessionStore::update(QString deviceKey) {
+    QMutexLocker locker(&this->m_lock);
 
-    newFile.rename(this->file.fileName());
+    if (this->m_devices.contains(deviceKey))
+        this->append(deviceKey);
 }
 
 OlmSession *SessionStore::createInbound(QString message, QString deviceKey) {
@@ -160,8 +74,13 @@ OlmSession *SessionStore::createInbound(QString message, QString deviceKey) {
         throw std::runtime_error(
             "SESSION please set a file name and/or an olm account");
 
+    QMutexLocker locker(&this->m_lock);
+
     qDebug() << "Creating inbound session for" << deviceKey;
 
+    // Make sure the record we append keeps the sessions we already have
+    this->sessions(deviceKey);
+
     std::string stdMessage(message.toStdString());
     std::string stdDeviceKey(deviceKey.toStdString());
     OlmSession *session = olm_session(malloc(olm_session_size()));
@@ -209,10 +128,478 @@ OlmSession *SessionStore::createInbound(QString message, QString deviceKey) {
 
     // Load and store session
     this->m_devices[deviceKey][id] = session;
-    this->save();
+    this->append(deviceKey);
     return session;
 }
 
+QMap<QString, OlmSession *> SessionStore::sessions(const QString &deviceKey) {
+    if (this->file.fileName().isEmpty())
+        throw std::runtime_error("SESSION please set a file name");
+
+    // Try to find cached
+    if (this->m_devices.contains(deviceKey))
+        return this->m_devices[deviceKey];
+
+    this->loadIndex();
+
+    QHash<Types::Identifier, qint64>::const_iterator offset =
+        this->m_index.constFind(deviceKey);
+
+    // Then we do not have any sessions. Cache empty map so we do not look
+    // for it again
+    if (offset == this->m_index.constEnd()) {
+        this->m_devices[deviceKey] = {};
+        return {};
+    }
+
+    // Else read the only record we need
+    if (!this->file.open(QFile::ReadOnly))
+        throw std::runtime_error("SESSION could not open store file: " +
+                                 this->file.errorString().toStdString());
+
+    QByteArray line;
+
+    if (this->file.seek(offset.value()))
+        line = this->file.readLine();
+
+    this->file.close();
+
+    QJsonParseError error;
+    QVariantMap     parsed =
+        QJsonDocument::fromJson(line, &error).toVariant().toMap();
+
+    if (error.error != QJsonParseError::NoError ||
+        parsed[deviceKey].isNull()) {
+        qCritical() << "SESSION index points to a bad record for" << deviceKey
+                    << "(" << error.errorString() << ")";
+
+        // Index is out of date, rebuild it next time
+        this->m_indexLoaded        = false;
+        this->m_devices[deviceKey] = {};
+        return {};
+    }
+
+    // Then we found the stored session. Unpickle it, cache and return
+    return this->unpickleAndCache(deviceKey, parsed[deviceKey].toMap());
+}
+
+void SessionStore::loadIndex() {
+    if (this->m_indexLoaded)
+        return;
+
+    this->m_index.clear();
+    this->m_records     = 0;
+    this->m_indexLoaded = true;
+
+    if (!this->file.exists()) {
+        this->m_generation.clear();
+        return;
+    }
+
+    this->m_generation = this->storeGeneration();
+
+    // Written before the journal, so without header nor trailing newline
+    if (this->m_generation.isEmpty() && this->file.size() > 0) {
+        this->migrateLegacy();
+        this->m_generation = this->storeGeneration();
+    }
+
+    QFile  indexFile(this->file.fileName() + ".idx");
+    qint64 indexedEnd = -1;
+    bool   complete   = false;
+
+    if (indexFile.open(QFile::ReadOnly)) {
+        QDataStream stream(&indexFile);
+        quint32     magic, version;
+        QString     generation;
+
+        stream.setVersion(QDataStream::Qt_5_12);
+        stream >> magic >> version >> generation;
+
+        // Index file is only valid for the store generation it was written for
+        if (stream.status() == QDataStream::Ok && magic == INDEX_MAGIC &&
+            version == INDEX_VERSION && generation == this->m_generation) {
+            indexedEnd = 0;
+            complete   = true;
+
+            while (!stream.atEnd()) {
+                QString deviceKey;
+                qint64  offset, end;
+
+                stream >> deviceKey >> offset >> end;
+
+                // Torn write, keep what we have read so far
+                if (stream.status() != QDataStream::Ok) {
+                    complete = false;
+                    break;
+                }
+
+                this->m_index.insert(deviceKey, offset);
+                this->m_records++;
+                indexedEnd = end;
+            }
+        }
+
+        indexFile.close();
+    }
+
+    if (indexedEnd < 0 || indexedEnd > this->file.size()) {
+        qDebug() << "SESSION rebuilding index";
+
+        this->m_index.clear();
+        this->m_records = 0;
+        this->scan(0);
+        this->saveIndex();
+        return;
+    }
+
+    // Records appended after the last index entry, e.g. on crash
+    if (indexedEnd < this->file.size()) {
+        this->scan(indexedEnd);
+        complete = false;
+    }
+
+    if (!complete)
+        this->saveIndex();
+}
+
+void SessionStore::scan(qint64 offset) {
+    if (!this->file.open(QFile::ReadOnly))
+        throw std::runtime_error("SESSION could not open store file: " +
+                                 this->file.errorString().toStdString());
+
+    this->file.seek(offset);
+
+    qint64 end          = offset;
+    bool   unterminated = false;
+
+    while (!this->file.atEnd()) {
+        QByteArray line = this->file.readLine();
+
+        // Last record lacks its newline. It is whole if it parses, as no
+        // prefix of a record does, else it was not completely written
+        if (!line.endsWith('\n')) {
+            QJsonParseError error;
+            QJsonDocument::fromJson(line, &error);
+
+            if (error.error != QJsonParseError::NoError)
+                break;
+
+            unterminated = true;
+        }
+
+        QString deviceKey = recordKey(line);
+
+        if (!deviceKey.isEmpty()) {
+            this->m_index.insert(deviceKey, end);
+            this->m_records++;
+        }
+
+        end += line.size();
+    }
+
+    qint64 size = this->file.size();
+    this->file.close();
+
+    // Drop a torn record, else next append would be glued to it
+    if (end < size) {
+        qWarning() << "SESSION dropping incomplete record at" << end;
+        this->file.resize(end);
+    }
+
+    // Keep a whole record, ending it so the next append starts a line
+    if (unterminated) {
+        qWarning() << "SESSION terminating last record";
+
+        if (!this->file.open(QFile::Append) || this->file.write("\n") != 1 ||
+            !Utils::syncToDisk(this->file))
+            qWarning() << "SESSION could not terminate last record:"
+                       << this->file.errorString();
+
+        this->file.close();
+    }
+}
+
+void SessionStore::migrateLegacy() {
+    if (!this->file.open(QFile::ReadOnly))
+        throw std::runtime_error("SESSION could not open store file: " +
+                                 this->file.errorString().toStdString());
+
+    QByteArray contents = this->file.readAll();
+    this->file.close();
+
+    qDebug() << "SESSION migrating store to journal";
+
+    QString   generation = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    QSaveFile newFile(this->file.fileName());
+    int       records = 0;
+
+    if (!newFile.open(QFile::WriteOnly)) {
+        qWarning() << "SESSION could not migrate store file:"
+                   << newFile.errorString();
+        return;
+    }
+
+    newFile.write("{\"\":\"" + generation.toUtf8() + "\"}\n");
+
+    for (const QByteArray &object : splitObjects(contents)) {
+        QJsonParseError error;
+        QJsonObject     parsed =
+            QJsonDocument::fromJson(object, &error).object();
+
+        if (error.error != QJsonParseError::NoError) {
+            qCritical() << "SESSION dropping unreadable record ("
+                        << error.errorString() << ")";
+            continue;
+        }
+
+        // One record per device, whatever the object held
+        for (auto it = parsed.constBegin(); it != parsed.constEnd(); ++it) {
+            newFile.write(
+                Utils::canonicalJson({{it.key(), it.value().toVariant()}}) +
+                "\n");
+            records++;
+        }
+    }
+
+    // Contents must be on disk before the rename makes them the store
+    if (!Utils::syncToDisk(newFile) || !newFile.commit()) {
+        qWarning() << "SESSION could not migrate store file:"
+                   << newFile.errorString();
+        return;
+    }
+
+    Utils::syncDirectory(QFileInfo(this->file).absolutePath());
+
+    qDebug() << "SESSION migrated" << records << "records";
+}
+
+void SessionStore::saveIndex() {
+    if (!this->file.exists())
+        return;
+
+    QSaveFile indexFile(this->file.fileName() + ".idx");
+
+    if (!indexFile.open(QFile::WriteOnly)) {
+        qWarning() << "SESSION could not write index:"
+                   << indexFile.errorString();
+        return;
+    }
+
+    QDataStream stream(&indexFile);
+    qint64      end = this->file.size();
+
+    stream.setVersion(QDataStream::Qt_5_12);
+    stream << INDEX_MAGIC << INDEX_VERSION << this->m_generation;
+
+    // Keys stay strings on disk
+    QHash<Types::Identifier, qint64>::const_iterator it =
+        this->m_index.constBegin();
+    for (; it != this->m_index.constEnd(); ++it)
+        stream << it.key().toString() << it.value() << end;
+
+    if (!indexFile.commit())
+        qWarning() << "SESSION could not write index:"
+                   << indexFile.errorString();
+}
+
+void SessionStore::appendIndex(const QString &deviceKey,
+                               qint64         offset,
+                               qint64         end) {
+    QFile indexFile(this->file.fileName() + ".idx");
+
+    if (!indexFile.open(QFile::Append)) {
+        qWarning() << "SESSION could not write index:"
+                   << indexFile.errorString();
+        return;
+    }
+
+    QDataStream stream(&indexFile);
+    stream.setVersion(QDataStream::Qt_5_12);
+
+    if (indexFile.pos() == 0)
+        stream << INDEX_MAGIC << INDEX_VERSION << this->m_generation;
+
+    stream << deviceKey << offset << end;
+    indexFile.close();
+}
+
+void SessionStore::append(const QString &deviceKey) {
+    if (this->m_devices[deviceKey].isEmpty())
+        return;
+
+    this->loadIndex();
+
+    QByteArray line =
+        this->serializeSessions(deviceKey, this->m_devices[deviceKey]) + "\n";
+    bool newStore = !this->file.exists() || this->file.size() == 0;
+
+    if (!this->file.open(QFile::Append))
+        throw std::runtime_error("SESSION could not open store file: " +
+                                 this->file.errorString().toStdString());
+
+    if (newStore) {
+        this->m_generation = QUuid::createUuid().toString(QUuid::WithoutBraces);
+        this->file.write("{\"\":\"" + this->m_generation.toUtf8() + "\"}\n");
+    }
+
+    qint64 offset = this->file.pos();
+
+    if (this->file.write(line) < 0 || !Utils::syncToDisk(this->file)) {
+        this->file.close();
+        throw std::runtime_error("SESSION failed to update store file");
+    }
+
+    this->file.close();
+
+    this->m_index.insert(deviceKey, offset);
+    this->m_records++;
+
+    if (newStore)
+        this->saveIndex();
+    else
+        this->appendIndex(deviceKey, offset, offset + line.size());
+
+    this->maybeCompact();
+}
+
+void SessionStore::maybeCompact() {
+    int superseded = this->m_records - this->m_index.size();
+
+    if (this->m_compactionQueued || superseded < this->compactThreshold ||
+        superseded <= this->m_index.size())
+        return;
+
+    this->m_compactionQueued = true;
+    this->m_compactor.start([this]() {
+        QMutexLocker locker(&this->m_lock);
+        this->m_compactionQueued = false;
+        this->compact();
+    });
+}
+
+void SessionStore::compact() {
+    qDebug() << "SESSION compacting" << this->m_records << "records into"
+             << this->m_index.size();
+
+    QString   generation = QUuid::createUuid().toString(QUuid::WithoutBraces);
+    QSaveFile newFile(this->file.fileName());
+
+    if (!(this->file.open(QFile::ReadOnly) &&
+          newFile.open(QFile::WriteOnly))) {
+        this->file.close(); // Can be opened, so close just to make sure
+        qWarning() << "SESSION could not compact store file";
+        return;
+    }
+
+    newFile.write("{\"\":\"" + generation.toUtf8() + "\"}\n");
+
+    QHash<Types::Identifier, qint64>                 newIndex;
+    QHash<Types::Identifier, qint64>::const_iterator it =
+        this->m_index.constBegin();
+
+    for (; it != this->m_index.constEnd(); ++it) {
+        QByteArray line;
+
+        if (this->file.seek(it.value()))
+            line = this->file.readLine();
+
+        if (Types::Identifier(recordKey(line)) != it.key() ||
+            !line.endsWith('\n')) {
+            qCritical() << "SESSION index points to a bad record for"
+                        << it.key() << ", not compacting";
+            this->file.close();
+            newFile.cancelWriting();
+            this->m_indexLoaded = false;
+            return;
+        }
+
+        newIndex.insert(it.key(), newFile.pos());
+        newFile.write(line);
+    }
+
+    this->file.close();
+
+    // Contents must be on disk before the rename makes them the store
+    if (!Utils::syncToDisk(newFile) || !newFile.commit()) {
+        qWarning() << "SESSION could not compact store file:"
+                   << newFile.errorString();
+        return;
+    }
+
+    Utils::syncDirectory(QFileInfo(this->file).absolutePath());
+
+    this->m_index      = newIndex;
+    this->m_records    = newIndex.size();
+    this->m_generation = generation;
+    this->saveIndex();
+}
+
+QString SessionStore::storeGeneration() {
+    if (!this->file.open(QFile::ReadOnly))
+        return "";
+
+    QByteArray header = this->file.readLine();
+    this->file.close();
+
+    // Header record is {"":"<generation>"}, an empty device key
+    if (!header.startsWith("{\"\":\""))
+        return "";
+
+    int end = header.indexOf('"', 5);
+
+    if (end < 0)
+        return "";
+
+    return QString::fromUtf8(header.constData() + 5, end - 5);
+}
+
+QList<QByteArray> SessionStore::splitObjects(const QByteArray &contents) {
+    QList<QByteArray> objects;
+    int               depth    = 0;
+    int               start    = -1;
+    bool              inString = false;
+    bool              escaped  = false;
+
+    for (int i = 0; i < contents.size(); i++) {
+        char c = contents[i];
+
+        if (inString) {
+            if (escaped)
+                escaped = false;
+            else if (c == '\\')
+                escaped = true;
+            else if (c == '"')
+                inString = false;
+        } else if (c == '"')
+            inString = true;
+        else if (c == '{') {
+            if (depth++ == 0)
+                start = i;
+        } else if (c == '}' && depth > 0 && --depth == 0)
+            objects.append(contents.mid(start, i - start + 1));
+    }
+
+    // Unterminated object, left for the caller to reject
+    if (depth > 0)
+        objects.append(contents.mid(start));
+
+    return objects;
+}
+
+QString SessionStore::recordKey(const QByteArray &line) {
+    // Records are canonical JSON: {"<device key>":{...}}
+    if (!line.startsWith("{\""))
+        return "";
+
+    int end = line.indexOf('"', 2);
+
+    if (end < 0)
+        return "";
+
+    return QString::fromUtf8(line.constData() + 2, end - 2);
+}
+
 QMap<QString, OlmSession *>
 SessionStore::unpickleAndCache(QString deviceKey, QVariantMap pickledSessions) {
     QMap<QString, OlmSession *> sessions;
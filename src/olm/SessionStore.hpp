@@ -14,13 +14,22 @@
 #pragma once
 
 #include <QFile>
+#include <QHash>
 #include <QMap>
+#include <QMutex>
+#include <QThreadPool>
 #include <olm/olm.h>
 
+#include <MatrixCpp/Identifier.hpp>
+
 namespace MatrixCpp::Crypto {
 /**
  * @brief Manages storage of OLM sessions
  *
+ * The store file is an append-only journal with one JSON record per line. A
+ * changed device appends a new record which supersedes the older ones, and
+ * superseded records are dropped by a background compaction. Every public
+ * method is thread-safe.
  */
 class SessionStore {
   public:
@@ -43,6 +52,14 @@ class SessionStore {
      */
     void save();
 
+    /**
+     * @brief Saves sessions of specified device, e.g. after they were used to
+       decrypt a message
+     *
+     * @param deviceKey
+     */
+    void update(QString deviceKey);
+
     /**
      * @brief Get sessions for specified device
      *
@@ -65,12 +82,124 @@ class SessionStore {
     std::string key;  ///< Key used to encrypt pickled sessions
     OlmAccount *olm;  ///< Related olm account
 
+    /**
+     * @brief Compaction runs once there are at least this many superseded
+       records, and more superseded than live ones
+     *
+     */
+    int compactThreshold = 256;
+
   private:
+    /**
+     * @brief Get sessions for specified device, from cache or from file.
+       m_lock must be held
+     *
+     * @param deviceKey
+     * @return QMap<QString, OlmSession *>
+     */
+    QMap<QString, OlmSession *> sessions(const QString &deviceKey);
+
+    /**
+     * @brief Loads the device key -> record offset index from the index file,
+       then indexes records appended after it was written. Rebuilds it if it
+       belongs to another store generation
+     *
+     */
+    void loadIndex();
+
+    /**
+     * @brief Scans the store from offset, indexing every record. A last
+       record without newline is dropped if torn, else terminated
+     *
+     * @param offset Start of a record
+     */
+    void scan(qint64 offset);
+
+    /**
+     * @brief Rewrites a store saved before the journal format as a journal,
+       atomically. Such stores have no header, and records written in one
+       save were glued on one line with no trailing newline
+     *
+     */
+    void migrateLegacy();
+
+    /**
+     * @brief Rewrites the whole index file
+     *
+     */
+    void saveIndex();
+
+    /**
+     * @brief Appends one entry to the index file
+     *
+     */
+    void appendIndex(const QString &deviceKey, qint64 offset, qint64 end);
+
+    /**
+     * @brief Appends the record of a device to the store
+     *
+     * @param deviceKey
+     */
+    void append(const QString &deviceKey);
+
+    /**
+     * @brief Queues a compaction if there are enough superseded records
+     *
+     */
+    void maybeCompact();
+
+    /**
+     * @brief Rewrites the store with live records only, atomically
+     *
+     */
+    void compact();
+
+    /**
+     * @brief Reads the generation of the store from its header record
+     *
+     * @return QString Empty if the store has no header
+     */
+    QString storeGeneration();
+
+    /**
+     * @brief Reads the device key of a store line without parsing it
+     *
+     * @param line
+     * @return QString Empty if line is not a record
+     */
+    static QString recordKey(const QByteArray &line);
+
+    /**
+     * @brief Splits concatenated JSON objects, whatever whitespace is
+       between them
+     *
+     * @param contents
+     * @return QList<QByteArray> An unterminated last object included
+     */
+    static QList<QByteArray> splitObjects(const QByteArray &contents);
+
     QMap<QString, OlmSession *> unpickleAndCache(QString     deviceKey,
                                                  QVariantMap sessions);
     QByteArray                  serializeSessions(QString                     deviceKey,
                                                   QMap<QString, OlmSession *> sessions);
 
-    QMap<QString, QMap<QString, OlmSession *>> m_devices;
+    /**
+     * @brief Sessions of each device, by device key
+     *
+     */
+    QHash<Types::Identifier, QMap<QString, OlmSession *>> m_devices;
+
+    /**
+     * @brief Offset of each device record in file
+     *
+     */
+    QHash<Types::Identifier, qint64> m_index;
+    bool                             m_indexLoaded = false;
+    int                              m_records     = 0; ///< Superseded or not
+    QString                          m_generation;
+
+    QMutex      m_lock;
+    QThreadPool m_compactor;
+    bool        m_compactionQueued = false;
 };
-} // namespace MatrixCpp::Crypto
\ No newline at end of file
+} // namespace MatrixCpp::Crypto
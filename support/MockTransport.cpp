@@ -0,0 +1,397 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file MockTransport.cpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Implements MockTransport
+ * @version 0.1
+ * @date 2021-03-22
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTimer>
+#include <QUrlQuery>
+#include <cstring>
+
+#include "support/MockTransport.hpp"
+
+using namespace MatrixCpp;
+
+/**
+ * @brief A finished-on-a-timer QNetworkReply serving a scripted body
+ *
+ */
+class MockReply : public QNetworkReply {
+  public:
+    MockReply(QNetworkAccessManager::Operation operation,
+              const QNetworkRequest &          request,
+              const MockTransport::Reply &     reply,
+              int                              latency,
+              int                              chunkSize,
+              QObject *                        parent)
+        : QNetworkReply(parent), m_pending(reply.body),
+          m_chunkSize(chunkSize > 0 ? chunkSize : reply.body.size()) {
+        this->setOperation(operation);
+        this->setRequest(request);
+        this->setUrl(request.url());
+        this->setAttribute(QNetworkRequest::HttpStatusCodeAttribute,
+                           reply.status);
+        this->setHeader(QNetworkRequest::ContentTypeHeader,
+                        "application/json");
+        this->setHeader(QNetworkRequest::ContentLengthHeader,
+                        reply.body.size());
+
+        if (reply.status >= 400)
+            this->setError(reply.status >= 500 ? InternalServerError
+                           : reply.status == 404 ? ContentNotFoundError
+                                                 : UnknownContentError,
+                           QString("HTTP %1").arg(reply.status));
+
+        this->open(QIODevice::ReadOnly | QIODevice::Unbuffered);
+
+        QTimer::singleShot(
+            latency, Qt::PreciseTimer, this, [=]() { this->deliver(); });
+    }
+
+    void abort() override {
+        if (this->isFinished())
+            return;
+
+        this->m_pending.clear();
+        this->m_buffer.clear();
+        this->setError(OperationCanceledError, "Operation canceled");
+        this->setFinished(true);
+
+        emit this->finished();
+    }
+
+    qint64 bytesAvailable() const override {
+        return this->m_buffer.size() + QNetworkReply::bytesAvailable();
+    }
+
+    bool isSequential() const override {
+        return true;
+    }
+
+  protected:
+    qint64 readData(char *data, qint64 maxSize) override {
+        qint64 size = qMin<qint64>(maxSize, this->m_buffer.size());
+
+        memcpy(data, this->m_buffer.constData(), size);
+        this->m_buffer.remove(0, size);
+
+        return size;
+    }
+
+  private:
+    /**
+     * @brief Hands out the next chunk of the body, then finishes once all
+       of it was
+     *
+     */
+    void deliver() {
+        if (this->isFinished())
+            return;
+
+        if (!this->m_pending.isEmpty()) {
+            this->m_buffer += this->m_pending.left(this->m_chunkSize);
+            this->m_pending.remove(0, this->m_chunkSize);
+
+            emit this->readyRead();
+        }
+
+        // Next chunk once the reader had its turn
+        if (!this->m_pending.isEmpty()) {
+            QTimer::singleShot(0, this, [=]() { this->deliver(); });
+            return;
+        }
+
+        this->setFinished(true);
+        emit this->finished();
+    }
+
+    QByteArray m_pending; ///< Body not handed out yet
+    QByteArray m_buffer;  ///< Body handed out, not read yet
+    int        m_chunkSize;
+};
+
+/**
+ * @brief Whether path is an instance of endpoint, {name} segments matching
+   any segment
+ *
+ */
+static bool matches(const QString &endpoint, const QString &path) {
+    const QVector<QStringRef> expected = endpoint.splitRef('/');
+    const QVector<QStringRef> actual   = path.splitRef('/');
+
+    if (expected.size() != actual.size())
+        return false;
+
+    for (int i = 0; i < expected.size(); i++)
+        if (!expected[i].startsWith('{') && expected[i] != actual[i])
+            return false;
+
+    return true;
+}
+
+/**
+ * @brief Builds a state event
+ *
+ */
+static QJsonObject stateEvent(const QString &    type,
+                              const QString &    stateKey,
+                              const QString &    eventId,
+                              const QString &    sender,
+                              const QJsonObject &content) {
+    return {{"type", type},
+            {"state_key", stateKey},
+            {"event_id", eventId},
+            {"sender", sender},
+            {"origin_server_ts", 0},
+            {"content", content}};
+}
+
+static QByteArray toJson(const QJsonObject &json) {
+    return QJsonDocument(json).toJson(QJsonDocument::Compact);
+}
+
+MockTransport::MockTransport(QObject *parent) : Transport(parent) {
+    this->route("/_matrix/client/r0/login",
+                [=](const QNetworkRequest &request, const QByteArray &body) {
+                    // GET asks for the login types
+                    if (body.isEmpty())
+                        return Reply{
+                            200,
+                            R"({"flows":[{"type":"m.login.password"}]})"};
+
+                    return this->login(request);
+                });
+
+    this->route("/_matrix/client/r0/sync",
+                [=](const QNetworkRequest &, const QByteArray &) {
+                    return this->sync();
+                });
+
+    this->route("/_matrix/client/r0/keys/upload",
+                [=](const QNetworkRequest &, const QByteArray &body) {
+                    return this->uploadKeys(body);
+                });
+
+    this->route("/_matrix/client/r0/rooms/{roomId}/messages",
+                [=](const QNetworkRequest &request, const QByteArray &) {
+                    return this->messages(request);
+                });
+
+    this->route("/_matrix/client/r0/user/{userId}/filter",
+                [=](const QNetworkRequest &, const QByteArray &body) {
+                    QByteArray id = QByteArray::number(qHash(body), 16);
+                    return Reply{200, R"({"filter_id":")" + id + R"("})"};
+                });
+
+    this->route("/_matrix/client/versions",
+                [](const QNetworkRequest &, const QByteArray &) {
+                    return Reply{200, R"({"versions":["r0.6.1"]})"};
+                });
+}
+
+QNetworkReply *MockTransport::get(const QNetworkRequest &request) {
+    return this->reply(QNetworkAccessManager::GetOperation, request, "");
+}
+
+QNetworkReply *MockTransport::post(const QNetworkRequest &request,
+                                   const QByteArray &     body) {
+    return this->reply(QNetworkAccessManager::PostOperation, request, body);
+}
+
+void MockTransport::route(const QString &endpoint, Handler handler) {
+    for (QPair<QString, Handler> &route : this->m_routes)
+        if (route.first == endpoint) {
+            route.second = handler;
+            return;
+        }
+
+    // Routes added later are more specific, e.g. those of a test
+    this->m_routes.prepend({endpoint, handler});
+}
+
+void MockTransport::enqueue(const QString &endpoint, const Reply &reply) {
+    this->m_queued[endpoint].enqueue(reply);
+}
+
+QStringList MockTransport::requests() const {
+    return this->m_requests;
+}
+
+int MockTransport::requestCount(const QString &endpoint) const {
+    return this->m_counts.value(endpoint);
+}
+
+// Private
+
+QNetworkReply *MockTransport::reply(QNetworkAccessManager::Operation operation,
+                                    const QNetworkRequest &          request,
+                                    const QByteArray &               body) {
+    const QString path     = request.url().path();
+    const QString endpoint = this->endpoint(path);
+
+    this->m_requests.append(
+        (operation == QNetworkAccessManager::PostOperation ? "POST " : "GET ") +
+        path);
+    this->m_counts[endpoint.isEmpty() ? path : endpoint]++;
+
+    Reply reply = {
+        404, R"({"errcode":"M_UNRECOGNIZED","error":"Unrecognized request"})"};
+
+    QHash<QString, QQueue<Reply>>::iterator queued =
+        this->m_queued.find(endpoint);
+
+    if (queued != this->m_queued.end() && !queued->isEmpty())
+        reply = queued->dequeue();
+    else
+        for (const QPair<QString, Handler> &route : this->m_routes)
+            if (route.first == endpoint) {
+                reply = route.second(request, body);
+                break;
+            }
+
+    return new MockReply(
+        operation, request, reply, this->latency, this->chunkSize, this);
+}
+
+QString MockTransport::endpoint(const QString &path) const {
+    for (const QPair<QString, Handler> &route : this->m_routes)
+        if (matches(route.first, path))
+            return route.first;
+
+    for (const QString &endpoint : this->m_queued.keys())
+        if (matches(endpoint, path))
+            return endpoint;
+
+    return "";
+}
+
+MockTransport::Reply MockTransport::login(const QNetworkRequest &request) {
+    QUrl base = request.url().adjusted(QUrl::RemovePath | QUrl::RemoveQuery);
+
+    QJsonObject wellKnown{
+        {"m.homeserver", QJsonObject{{"base_url", base.toString()}}}};
+
+    return {200,
+            toJson({{"user_id", this->userId},
+                    {"access_token", "mock_access_token"},
+                    {"device_id", this->deviceId},
+                    {"well_known", wellKnown}})};
+}
+
+MockTransport::Reply MockTransport::sync() {
+    int         batch = ++this->m_syncs;
+    QJsonObject join;
+
+    for (int r = 0; r < this->syncRooms; r++) {
+        QString    roomId = QString("!room%1:localhost").arg(r);
+        QString    suffix = "." + roomId.mid(1);
+        QJsonArray state, events;
+
+        // First sync carries the state, as an initial sync does
+        if (batch == 1) {
+            state.append(stateEvent("m.room.create",
+                                    "",
+                                    "$create" + suffix,
+                                    this->userId,
+                                    {{"creator", this->userId}}));
+
+            for (int m = 0; m < this->syncMembers; m++) {
+                QString member = m == 0
+                                     ? this->userId
+                                     : QString("@user%1:localhost").arg(m);
+
+                state.append(stateEvent(
+                    "m.room.member",
+                    member,
+                    QString("$m%1").arg(m) + suffix,
+                    member,
+                    {{"membership", "join"},
+                     {"displayname", QString("User %1").arg(m)}}));
+            }
+        }
+
+        for (int e = 0; e < this->syncEvents; e++)
+            events.append(this->message(
+                QString("$s%1_%2").arg(batch).arg(e) + suffix,
+                // After all of the history
+                this->historyEvents + (qint64) batch * this->syncEvents + e));
+
+        QJsonObject timeline{{"events", events},
+                             {"limited", false},
+                             {"prev_batch", QString("t%1").arg(batch)}};
+
+        join.insert(roomId,
+                    QJsonObject{{"state", QJsonObject{{"events", state}}},
+                                {"timeline", timeline}});
+    }
+
+    QJsonObject oneTimeKeys{{"signed_curve25519", this->m_oneTimeKeys}};
+
+    return {200,
+            toJson({{"next_batch", QString("s%1").arg(batch)},
+                    {"rooms", QJsonObject{{"join", join}}},
+                    {"device_one_time_keys_count", oneTimeKeys}})};
+}
+
+MockTransport::Reply MockTransport::uploadKeys(const QByteArray &body) {
+    QJsonObject keys = QJsonDocument::fromJson(body)
+                           .object()
+                           .value("one_time_keys")
+                           .toObject();
+
+    this->m_oneTimeKeys += keys.size();
+
+    QJsonObject oneTimeKeys{{"signed_curve25519", this->m_oneTimeKeys}};
+    return {200, toJson({{"one_time_key_counts", oneTimeKeys}})};
+}
+
+MockTransport::Reply MockTransport::messages(const QNetworkRequest &request) {
+    QUrlQuery   query(request.url());
+    QStringList segments = request.url().path().split('/');
+    QString     roomId   = segments.value(segments.size() - 2);
+    QString     from     = query.queryItemValue("from");
+
+    // Tokens of timelines are right after the newest history event
+    int remaining = from.startsWith('h') ? from.mid(1).toInt()
+                                         : this->historyEvents;
+    int limit     = query.hasQueryItem("limit")
+                        ? query.queryItemValue("limit").toInt()
+                        : 10;
+    int count     = qBound(0, limit, remaining);
+
+    QJsonArray chunk;
+
+    // Newest first, as paginating back
+    for (int i = 0; i < count; i++)
+        chunk.append(this->message(
+            QString("$h%1.").arg(remaining - i) + roomId.mid(1),
+            remaining - i));
+
+    QJsonObject json{{"start", from}, {"chunk", chunk}};
+
+    if (remaining > count)
+        json.insert("end", QString("h%1").arg(remaining - count));
+
+    return {200, toJson(json)};
+}
+
+QJsonObject MockTransport::message(const QString &eventId,
+                                   qint64         serverTs) const {
+    QJsonObject content{{"msgtype", "m.text"},
+                        {"body", QString(this->eventSize, 'a')}};
+
+    return {{"type", "m.room.message"},
+            {"event_id", eventId},
+            {"sender", this->userId},
+            {"origin_server_ts", serverTs},
+            {"content", content}};
+}
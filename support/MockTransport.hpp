@@ -0,0 +1,147 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+/**
+ * @file MockTransport.hpp
+ * @author vslg (slgf@protonmail.ch)
+ * @brief Declares MockTransport, an in-process homeserver
+ * @version 0.1
+ * @date 2021-03-22
+ *
+ * Copyright (c) 2021 vslg
+ *
+ */
+
+#pragma once
+
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QPair>
+#include <QQueue>
+#include <QStringList>
+#include <functional>
+
+#include <MatrixCpp/Transport.hpp>
+
+namespace MatrixCpp {
+/**
+ * @brief A Transport answering requests in process, as a scripted
+   homeserver would, for tests and benchmarks
+ *
+ * Replies are looked up by endpoint, a path in which segments written as
+ * {name} match any segment, e.g. /_matrix/client/r0/rooms/{roomId}/messages.
+ * Replies queued with enqueue() are served first, in order, then the handler
+ * set with route(). Default handlers answer /login, /sync, /keys/upload,
+ * /messages, filter uploads and /versions with generated data whose size is
+ * set by the public fields below. Anything else gets a 404 M_UNRECOGNIZED.
+ *
+ * Replies finish after latency milliseconds, on the thread of the Transport,
+ * so they behave as network replies for the Client.
+ */
+class MockTransport : public Transport {
+    Q_OBJECT
+
+  public:
+    /**
+     * @brief A scripted reply
+     *
+     */
+    struct Reply {
+        int        status = 200; ///< HTTP status code
+        QByteArray body;         ///< JSON body
+    };
+
+    /**
+     * @brief Answers a request, given the request and its body
+     *
+     */
+    using Handler =
+        std::function<Reply(const QNetworkRequest &, const QByteArray &)>;
+
+    explicit MockTransport(QObject *parent = nullptr);
+
+    QNetworkReply *get(const QNetworkRequest &request) override;
+    QNetworkReply *post(const QNetworkRequest &request,
+                        const QByteArray &     body) override;
+
+    /**
+     * @brief Answers every request to endpoint with handler, replacing the
+       default handler if any
+     *
+     * @param endpoint
+     * @param handler
+     */
+    void route(const QString &endpoint, Handler handler);
+
+    /**
+     * @brief Answers the next request to endpoint with reply, once
+     *
+     * @param endpoint
+     * @param reply
+     */
+    void enqueue(const QString &endpoint, const Reply &reply);
+
+    /**
+     * @brief Get every request received so far, as "METHOD path"
+     *
+     * @return QStringList
+     */
+    QStringList requests() const;
+
+    /**
+     * @brief Get the number of requests received so far to endpoint
+     *
+     * @param endpoint
+     * @return int
+     */
+    int requestCount(const QString &endpoint) const;
+
+    int latency   = 0; ///< Delay before replies finish, in milliseconds
+    int chunkSize = 0; ///< Bytes per readyRead of a reply, 0 for all at once
+
+    int syncRooms     = 1;    ///< Joined rooms of every /sync
+    int syncMembers   = 1;    ///< Member state events of every joined room
+    int syncEvents    = 10;   ///< Timeline events of every joined room
+    int eventSize     = 64;   ///< Body length of generated messages
+    int historyEvents = 1000; ///< Events /messages has before each timeline
+
+    QString userId   = "@mock:localhost"; ///< User logged in by /login
+    QString deviceId = "MOCKDEVICE";      ///< Device logged in by /login
+
+  private:
+    /**
+     * @brief Builds the reply of a request
+     *
+     */
+    QNetworkReply *reply(QNetworkAccessManager::Operation operation,
+                         const QNetworkRequest &          request,
+                         const QByteArray &               body);
+
+    /**
+     * @brief Finds the endpoint of a path among the routes
+     *
+     * @return QString Empty if no route matches
+     */
+    QString endpoint(const QString &path) const;
+
+    // Default handlers
+    Reply login(const QNetworkRequest &request);
+    Reply sync();
+    Reply uploadKeys(const QByteArray &body);
+    Reply messages(const QNetworkRequest &request);
+
+    /**
+     * @brief Builds an m.room.message event
+     *
+     */
+    QJsonObject message(const QString &eventId, qint64 serverTs) const;
+
+    QList<QPair<QString, Handler>> m_routes; ///< In lookup order
+    QHash<QString, QQueue<Reply>>  m_queued; ///< By endpoint
+    QStringList                    m_requests;
+    QHash<QString, int>            m_counts; ///< By endpoint
+
+    int m_syncs       = 0; ///< /sync requests answered
+    int m_oneTimeKeys = 0; ///< Uploaded one-time keys
+};
+} // namespace MatrixCpp
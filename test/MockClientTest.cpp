@@ -0,0 +1,307 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QtTest/QtTest>
+
+#include <MatrixCpp/Client.hpp>
+#include <MatrixCpp/Responses.hpp>
+#include <MatrixCpp/SyncReplay.hpp>
+
+#include "support/MockTransport.hpp"
+
+using namespace MatrixCpp;
+using namespace MatrixCpp::Responses;
+using namespace MatrixCpp::Types;
+
+class MockClientTest : public QObject {
+    Q_OBJECT
+
+  private slots:
+    void initTestCase() {
+        QVERIFY(storeDir.isValid());
+
+        server = new MockTransport;
+        server->syncRooms   = 3;
+        server->syncMembers = 5;
+        server->syncEvents  = 20;
+
+        client = new Client(QUrl("http://localhost"), false, this);
+        client->storeDir    = QDir(storeDir.path());
+        client->persistSync = false;
+        client->setTransport(server);
+
+        QCOMPARE(client->transport(), server);
+        QCOMPARE(server->parent(), client);
+    }
+
+    void passwordLogin() {
+        LoginResponse response =
+            client->login("@mock:localhost", "<secret>")->result();
+
+        QVERIFY(!response.isError() && !response.isBroken());
+        QCOMPARE(client->userId(), server->userId);
+        QCOMPARE(client->deviceId, server->deviceId);
+        QVERIFY(!client->accessToken().isEmpty());
+        QCOMPARE(client->homeserverUrl, QUrl("http://localhost"));
+    }
+
+    void sync() {
+        SyncResponse response = client->sync()->result();
+
+        QVERIFY(!response.isError() && !response.isBroken());
+        QCOMPARE(client->nextBatch(), QString("s1"));
+        QCOMPARE(client->rooms.size(), server->syncRooms);
+
+        for (Room *room : qAsConst(client->rooms)) {
+            QCOMPARE(room->memberCount(), server->syncMembers);
+            QCOMPARE(room->timeline().size(), server->syncEvents);
+            QCOMPARE(room->timeline().prevBatch(), QString("t1"));
+        }
+    }
+
+    void paginateBack() {
+        Room *     room = client->rooms.value(QString("!room0:localhost"));
+        QSignalSpy loaded(room, &Room::historyLoaded);
+
+        QVERIFY(room);
+
+        // Coalesced into one request
+        room->paginateBack(15);
+        room->paginateBack(15);
+        QVERIFY(room->paginating());
+        QVERIFY(loaded.wait());
+
+        Timeline timeline = room->timeline();
+
+        QCOMPARE(loaded.size(), 1);
+        QCOMPARE(loaded[0][0].toInt(), 15);
+        QCOMPARE(timeline.size(), server->syncEvents + 15);
+        QCOMPARE(server->requestCount(
+                     "/_matrix/client/r0/rooms/{roomId}/messages"),
+                 1);
+
+        // Oldest first, newest history event right before the sync ones
+        QVERIFY(timeline.at(0).serverTs < timeline.at(14).serverTs);
+        QCOMPARE(timeline.at(14).eventId,
+                 QString("$h%1.room0:localhost").arg(server->historyEvents));
+        QCOMPARE(timeline.prevBatch(),
+                 QString("h%1").arg(server->historyEvents - 15));
+    }
+
+    void paginateToStart() {
+        Room *     room = client->rooms.value(QString("!room1:localhost"));
+        QSignalSpy loaded(room, &Room::historyLoaded);
+
+        server->historyEvents = 30;
+        room->paginateBack(100);
+
+        while (room->paginating())
+            QVERIFY(loaded.wait());
+
+        QVERIFY(room->atStart());
+        QCOMPARE(room->timeline().size(), server->syncEvents + 30);
+        server->historyEvents = 1000;
+    }
+
+    void scriptedError() {
+        server->enqueue(
+            "/_matrix/client/r0/sync",
+            {502, R"({"errcode":"M_UNKNOWN","error":"Bad gateway"})"});
+
+        SyncResponse failed = client->sync()->result();
+        QVERIFY(failed.isError());
+        QCOMPARE(client->nextBatch(), QString("s1"));
+
+        // Queue is drained, so the default handler answers again
+        SyncResponse response = client->sync()->result();
+        QVERIFY(!response.isError());
+        QCOMPARE(client->nextBatch(), QString("s2"));
+    }
+
+    void uploadKeys() {
+        QVariantMap keys{{"signed_curve25519:A", "a"},
+                         {"signed_curve25519:B", "b"}};
+
+        Response response = client
+                                ->send("/_matrix/client/r0/keys/upload",
+                                       {{"one_time_keys", keys}})
+                                ->result();
+
+        QCOMPARE(response.data.toObject()
+                     .value("one_time_key_counts")
+                     .toObject()
+                     .value("signed_curve25519")
+                     .toInt(),
+                 2);
+    }
+
+    void latency() {
+        QElapsedTimer timer;
+
+        server->latency = 50;
+        timer.start();
+
+        QVERIFY(!client->getServerVersion()->result().isBroken());
+        QVERIFY(timer.elapsed() >= 50);
+
+        server->latency = 0;
+    }
+
+    void streamedChunks() {
+        client->streamSync = true;
+        server->chunkSize  = 256;
+
+        SyncResponse response = client->sync()->result();
+
+        QVERIFY(!response.isError() && !response.isBroken());
+        QCOMPARE(client->nextBatch(), QString("s3"));
+
+        client->streamSync = false;
+        server->chunkSize  = 0;
+    }
+
+    void streamedError() {
+        QString nextBatch = client->nextBatch();
+
+        client->streamSync = true;
+        server->enqueue("/_matrix/client/r0/sync",
+                        {502,
+                         R"({"errcode":"M_UNKNOWN","next_batch":"s9",)"
+                         R"("rooms":{"join":{"!ghost:localhost":{}}}})"});
+
+        QVERIFY(client->sync()->result().isError());
+        QCOMPARE(client->nextBatch(), nextBatch);
+        QVERIFY(!client->rooms.contains("!ghost:localhost"));
+
+        client->streamSync = false;
+    }
+
+    void streamedRetry() {
+        QByteArray body =
+            R"({"next_batch":"s9","rooms":{"join":{"!retry:localhost":)"
+            R"({"timeline":{"limited":true,"prev_batch":"r1","events":[)"
+            R"({"event_id":"$r1","sender":"@mock:localhost",)"
+            R"("type":"m.room.message","origin_server_ts":1,)"
+            R"("content":{"body":"r"}}]}}}}})";
+
+        client->streamSync = true;
+
+        // As a retry of a sync which failed once its rooms were applied
+        server->enqueue("/_matrix/client/r0/sync", {200, body});
+        server->enqueue("/_matrix/client/r0/sync", {200, body});
+        QVERIFY(!client->sync()->result().isError());
+        QVERIFY(!client->sync()->result().isError());
+
+        Room *room = client->rooms.value(QString("!retry:localhost"));
+
+        QVERIFY(room);
+        QCOMPARE(room->timeline().size(), 1);
+        QCOMPARE(room->timeline().prevBatch(), QString("r1"));
+
+        client->streamSync = false;
+    }
+
+    void recordAndReplay() {
+        QString path = storeDir.filePath("sync.capture");
+
+        QVERIFY(client->startRecording(path));
+        QVERIFY(!client->sync()->result().isError());
+
+        // Streamed bodies are recorded whole too
+        client->streamSync = true;
+        server->chunkSize  = 256;
+        QVERIFY(!client->sync()->result().isError());
+        client->streamSync = false;
+        server->chunkSize  = 0;
+
+        client->stopRecording();
+        QVERIFY(!client->isRecording());
+
+        // Replays save no snapshot, even with persistSync set
+        QTemporaryDir replayDir;
+        Client        replayed(QUrl("http://localhost"), false);
+
+        replayed.storeDir     = QDir(replayDir.path());
+        replayed.persistDelay = 0;
+
+        SyncReplay replay(&replayed);
+
+        QVERIFY(replay.load(path));
+        QCOMPARE(replay.size(), 2);
+        QCOMPARE(replay.replayAll(), 2);
+        QCOMPARE(replayed.rooms.size(), server->syncRooms);
+
+        // Tokens never reach the capture
+        QVERIFY(replayed.nextBatch().startsWith("redacted_"));
+
+        for (Room *room : qAsConst(replayed.rooms)) {
+            QCOMPARE(room->timeline().size(), 2 * server->syncEvents);
+            QVERIFY(room->timeline().prevBatch().startsWith("redacted_"));
+        }
+
+        QSignalSpy finished(&replay, &SyncReplay::finished);
+
+        replay.rewind();
+        replay.start(SyncReplay::PACE_REAL_TIME);
+
+        QVERIFY(replay.isRunning());
+        QVERIFY(finished.wait());
+        QCOMPARE(replay.position(), 2);
+        QVERIFY(QDir(replayDir.path()).isEmpty());
+    }
+
+    void unknownEndpoint() {
+        Response response = client->get("/_matrix/client/r0/nowhere")->result();
+
+        QVERIFY(response.isError());
+        QCOMPARE(server->requests().last(),
+                 QString("GET /_matrix/client/r0/nowhere"));
+    }
+
+    void requestStats() {
+        Filter filter;
+
+        filter.timeline.limit = 10;
+        client->resetRequestStats();
+
+        QVERIFY(!client->uploadFilter(filter)->result().isError());
+        QVERIFY(!client->getServerVersion()->result().isError());
+        QVERIFY(client->get("/_matrix/client/r0/nowhere")->result().isError());
+
+        QList<EndpointStats> stats = client->requestStats();
+
+        QCOMPARE(stats.size(), 3);
+        QCOMPARE(stats[0].endpoint, QString("/_matrix/client/r0/nowhere"));
+        QCOMPARE(stats[0].statuses.value(404), (quint64) 1);
+        QCOMPARE(stats[1].method, QString("POST"));
+        QCOMPARE(stats[1].endpoint,
+                 QString("/_matrix/client/r0/user/{userId}/filter"));
+        QCOMPARE(stats[1].requests, (quint64) 1);
+        QVERIFY(stats[1].requestBytes > 0 && stats[1].responseBytes > 0);
+        QCOMPARE(stats[1].ttfb.samples, (quint64) 1);
+        QCOMPARE(stats[1].total.samples, (quint64) 1);
+        QCOMPARE(stats[2].statuses.value(200), (quint64) 1);
+
+        QByteArray metrics = client->prometheusMetrics();
+
+        QVERIFY(metrics.contains(
+            R"(matrixcpp_responses_total{method="GET",)"
+            R"(endpoint="/_matrix/client/r0/nowhere",status="404"} 1)"));
+        QVERIFY(metrics.contains(
+            R"(matrixcpp_request_duration_seconds_count{method="POST",)"
+            R"(endpoint="/_matrix/client/r0/user/{userId}/filter"} 1)"));
+    }
+
+    void cleanupTestCase() {
+        delete client;
+    }
+
+  private:
+    QTemporaryDir  storeDir;
+    MockTransport *server = nullptr;
+    Client *       client = nullptr;
+};
+
+QTEST_MAIN(MockClientTest)
+#include "MockClientTest.moc"
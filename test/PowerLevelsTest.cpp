@@ -0,0 +1,120 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QtTest/QtTest>
+
+#include <MatrixCpp/Types.hpp>
+
+using namespace MatrixCpp::Types;
+
+class PowerLevelsTest : public QObject {
+    Q_OBJECT
+
+  private slots:
+    void parse() {
+        PowerLevelsContent levels(QJsonValue(QJsonObject{
+            {"users_default", 5},
+            {"state_default", 40},
+            {"kick", 60},
+            {"users", QJsonObject{{"@admin:localhost", 100}}},
+            {"events", QJsonObject{{"m.room.name", 70}}}}));
+
+        QVERIFY(!levels.isBroken());
+        QCOMPARE(levels.userLevel(QString("@admin:localhost")), 100);
+        QCOMPARE(levels.userLevel(QString("@other:localhost")), 5);
+        QCOMPARE(levels.eventLevel("m.room.name", true), 70);
+        QCOMPARE(levels.eventLevel("m.room.topic", true), 40);
+        QCOMPARE(levels.eventLevel("m.room.message"), 0);
+        QCOMPARE(levels.kick, 60);
+
+        // Left out ones keep the defaults of the spec
+        QCOMPARE(levels.ban, 50);
+        QCOMPARE(levels.redact, 50);
+        QCOMPARE(levels.invite, 0);
+    }
+
+    void parseStrings() {
+        PowerLevelsContent levels(QJsonValue(QJsonObject{
+            {"users_default", "10"},
+            {"ban", "75"},
+            {"redact", "not a level"},
+            {"users",
+             QJsonObject{{"@admin:localhost", "100"},
+                         {"@odd:localhost", "many"}}},
+            {"events", QJsonObject{{"m.room.name", "60"}}}}));
+
+        QCOMPARE(levels.usersDefault, 10);
+        QCOMPARE(levels.ban, 75);
+        QCOMPARE(levels.redact, 50);
+        QCOMPARE(levels.userLevel(QString("@admin:localhost")), 100);
+        QCOMPARE(levels.userLevel(QString("@odd:localhost")), 10);
+        QCOMPARE(levels.eventLevel("m.room.name", true), 60);
+    }
+
+    void targets() {
+        Room room(QString("!power:localhost"));
+
+        room.onEvent(state("m.room.create",
+                           QJsonObject{{"creator", "@admin:localhost"}}));
+        room.onEvent(state(
+            "m.room.power_levels",
+            QJsonObject{{"users",
+                         QJsonObject{{"@admin:localhost", 100},
+                                     {"@mod:localhost", 50},
+                                     {"@peer:localhost", 50}}}}));
+
+        QVERIFY(room.canKick(QString("@mod:localhost")));
+        QVERIFY(room.canKick(QString("@mod:localhost"),
+                             QString("@user:localhost")));
+        QVERIFY(!room.canKick(QString("@mod:localhost"),
+                              QString("@peer:localhost")));
+        QVERIFY(!room.canBan(QString("@mod:localhost"),
+                             QString("@admin:localhost")));
+        QVERIFY(room.canBan(QString("@admin:localhost"),
+                            QString("@mod:localhost")));
+
+        // Their own events need no redact level
+        QVERIFY(room.canRedact(QString("@user:localhost"),
+                               QString("@user:localhost")));
+        QVERIFY(!room.canRedact(QString("@user:localhost"),
+                                QString("@mod:localhost")));
+        QVERIFY(!room.canRedact(QString("@mod:localhost"),
+                                QString("@peer:localhost")));
+        QVERIFY(room.canRedact(QString("@mod:localhost"),
+                               QString("@user:localhost")));
+    }
+
+    void emptyLevels() {
+        Room room(QString("!empty:localhost"));
+
+        room.onEvent(state("m.room.create",
+                           QJsonObject{{"creator", "@admin:localhost"}}));
+
+        // No power levels: only the creator is privileged
+        QCOMPARE(room.powerLevel(QString("@admin:localhost")), 100);
+        QVERIFY(room.canSend(QString("@user:localhost"), "m.room.name", true));
+
+        room.onEvent(state("m.room.power_levels", QJsonObject()));
+
+        // Empty ones: nobody is, and the spec defaults apply
+        QCOMPARE(room.powerLevel(QString("@admin:localhost")), 0);
+        QVERIFY(
+            !room.canSend(QString("@admin:localhost"), "m.room.name", true));
+        QVERIFY(room.canSend(QString("@admin:localhost"), "m.room.message"));
+    }
+
+  private:
+    RoomEvent state(const QString &type, const QJsonObject &content) {
+        return QJsonValue(QJsonObject{
+            {"event_id", QString("$s%1").arg(++events)},
+            {"sender", "@admin:localhost"},
+            {"origin_server_ts", 1000 + events},
+            {"type", type},
+            {"state_key", ""},
+            {"content", content}});
+    }
+
+    int events = 0;
+};
+
+QTEST_MAIN(PowerLevelsTest)
+#include "PowerLevelsTest.moc"
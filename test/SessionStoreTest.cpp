@@ -0,0 +1,188 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QtTest/QtTest>
+#include <olm/olm.h>
+
+#include "src/Utils.hpp"
+#include "src/olm/SessionStore.hpp"
+
+using namespace MatrixCpp;
+using namespace MatrixCpp::Crypto;
+
+static const QString PICKLE_KEY = "test";
+
+class SessionStoreTest : public QObject {
+    Q_OBJECT
+
+  private slots:
+    void initTestCase() {
+        QVERIFY(dir.isValid());
+
+        // Real sessions, so the store can unpickle them
+        OlmAccount *ours = newAccount();
+        OlmAccount *peer = newAccount();
+
+        QByteArray identity(olm_account_identity_keys_length(peer), 0);
+        olm_account_identity_keys(peer, identity.data(), identity.size());
+
+        QByteArray peerKey = QJsonDocument::fromJson(identity)
+                                 .object()
+                                 .value("curve25519")
+                                 .toString()
+                                 .toUtf8();
+
+        for (const QString &device : {"devA", "devB", "devC"}) {
+            QByteArray  oneTimeKey = this->oneTimeKey(peer);
+            OlmSession *session    = olm_session(malloc(olm_session_size()));
+            size_t      randomSize =
+                olm_create_outbound_session_random_length(session);
+            uint8_t *random = Utils::randomBytes(randomSize);
+
+            QVERIFY(olm_create_outbound_session(session,
+                                                ours,
+                                                peerKey.constData(),
+                                                peerKey.size(),
+                                                oneTimeKey.constData(),
+                                                oneTimeKey.size(),
+                                                random,
+                                                randomSize) != olm_error());
+            free(random);
+
+            QByteArray id(olm_session_id_length(session), 0);
+            QByteArray pickled(olm_pickle_session_length(session), 0);
+
+            olm_session_id(session, id.data(), id.size());
+            olm_pickle_session(session,
+                               PICKLE_KEY.toUtf8().constData(),
+                               PICKLE_KEY.size(),
+                               pickled.data(),
+                               pickled.size());
+
+            records[device] = Utils::canonicalJson(
+                {{device, QVariantMap{{QString(id), QString(pickled)}}}});
+
+            olm_clear_session(session);
+            free(session);
+        }
+
+        olm_clear_account(ours);
+        olm_clear_account(peer);
+        free(ours);
+        free(peer);
+    }
+
+    void legacyStore() {
+        // As saved before the journal: no header, a rewritten record ended
+        // by a newline, then new records glued together without one
+        QString path = this->write("legacy",
+                                   records["devA"] + "\n" + records["devB"] +
+                                       records["devC"]);
+
+        {
+            SessionStore store(path, nullptr, PICKLE_KEY);
+
+            QCOMPARE(store["devA"].size(), 1);
+            QCOMPARE(store["devB"].size(), 1);
+            QCOMPARE(store["devC"].size(), 1);
+        }
+
+        QList<QByteArray> lines = this->read(path).split('\n');
+
+        // Header, one line per record, nothing after the last newline
+        QCOMPARE(lines.size(), 5);
+        QVERIFY(lines[0].startsWith("{\"\":\""));
+        QVERIFY(lines[4].isEmpty());
+
+        // Loaded again through the index written by the migration
+        SessionStore store(path, nullptr, PICKLE_KEY);
+
+        QCOMPARE(store["devB"].size(), 1);
+        QCOMPARE(store["devC"].size(), 1);
+    }
+
+    void tornTail() {
+        QByteArray kept = "{\"\":\"torn\"}\n" + records["devA"] + "\n";
+        QString    path = this->write("torn", kept + records["devB"].left(32));
+
+        {
+            SessionStore store(path, nullptr, PICKLE_KEY);
+
+            QCOMPARE(store["devA"].size(), 1);
+            QCOMPARE(store["devB"].size(), 0);
+        }
+
+        QCOMPARE(this->read(path), kept);
+    }
+
+    void unterminatedTail() {
+        QByteArray contents =
+            "{\"\":\"whole\"}\n" + records["devA"] + "\n" + records["devB"];
+        QString path = this->write("whole", contents);
+
+        {
+            SessionStore store(path, nullptr, PICKLE_KEY);
+
+            QCOMPARE(store["devA"].size(), 1);
+            QCOMPARE(store["devB"].size(), 1);
+        }
+
+        QCOMPARE(this->read(path), contents + "\n");
+    }
+
+  private:
+    static OlmAccount *newAccount() {
+        OlmAccount *account    = olm_account(malloc(olm_account_size()));
+        size_t      randomSize = olm_create_account_random_length(account);
+        uint8_t *   random     = Utils::randomBytes(randomSize);
+
+        olm_create_account(account, random, randomSize);
+        free(random);
+
+        return account;
+    }
+
+    QByteArray oneTimeKey(OlmAccount *account) {
+        size_t randomSize =
+            olm_account_generate_one_time_keys_random_length(account, 1);
+        uint8_t *random = Utils::randomBytes(randomSize);
+
+        olm_account_generate_one_time_keys(account, 1, random, randomSize);
+        free(random);
+
+        QByteArray keys(olm_account_one_time_keys_length(account), 0);
+        olm_account_one_time_keys(account, keys.data(), keys.size());
+        olm_account_mark_keys_as_published(account);
+
+        QJsonObject curve25519 = QJsonDocument::fromJson(keys)
+                                     .object()
+                                     .value("curve25519")
+                                     .toObject();
+
+        return curve25519.begin().value().toString().toUtf8();
+    }
+
+    QString write(const QString &name, const QByteArray &contents) {
+        QFile file(dir.filePath(name));
+
+        file.open(QFile::WriteOnly);
+        file.write(contents);
+
+        return file.fileName();
+    }
+
+    QByteArray read(const QString &path) {
+        QFile file(path);
+
+        file.open(QFile::ReadOnly);
+        return file.readAll();
+    }
+
+    QTemporaryDir             dir;
+    QMap<QString, QByteArray> records; ///< Device key to its store record
+};
+
+QTEST_MAIN(SessionStoreTest)
+#include "SessionStoreTest.moc"
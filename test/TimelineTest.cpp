@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QtTest/QtTest>
+
+#include <MatrixCpp/Types.hpp>
+
+using namespace MatrixCpp::Types;
+
+class TimelineTest : public QObject {
+    Q_OBJECT
+
+  private slots:
+    void evictByCount() {
+        Timeline timeline(5);
+
+        timeline.append(batch(0, 3), false, "a");
+        timeline.append(batch(3, 3), false, "b");
+
+        // $e0 no longer fits, and the rest of its batch goes with it
+        QCOMPARE(timeline.size(), 3);
+        QCOMPARE(timeline.at(0).eventId, QString("$e3"));
+        QCOMPARE(timeline.prevBatch(), QString("b"));
+    }
+
+    void evictByBytes() {
+        Timeline unbounded(100, 1 << 30);
+        Timeline second(100, 1 << 30);
+
+        unbounded.append(batch(0, 3), false, "a");
+        unbounded.append(batch(3, 3), false, "b");
+        second.append(batch(3, 3), false, "b");
+
+        Timeline timeline(100, unbounded.bytes() - 1);
+
+        timeline.append(batch(0, 3), false, "a");
+        timeline.append(batch(3, 3), false, "b");
+
+        QCOMPARE(timeline.size(), 3);
+        QCOMPARE(timeline.at(0).eventId, QString("$e3"));
+        QCOMPARE(timeline.prevBatch(), QString("b"));
+        QCOMPARE(timeline.bytes(), second.bytes());
+    }
+
+    void cutOnlyBatch() {
+        Timeline timeline(2);
+
+        timeline.append(batch(0, 3), false, "a");
+
+        // No later batch to stop at, so the oldest one is cut
+        QCOMPARE(timeline.size(), 2);
+        QCOMPARE(timeline.at(0).eventId, QString("$e1"));
+        QVERIFY(timeline.prevBatch().isEmpty());
+    }
+
+    void gaps() {
+        Timeline timeline;
+
+        timeline.append(batch(0, 2), true, "a");
+        timeline.append(batch(2, 2), false, "b");
+        timeline.append(batch(4, 2), true, "c");
+
+        // A limited first batch follows nothing, so it leaves no gap
+        QVERIFY(!timeline.gapBefore(0));
+        QVERIFY(!timeline.gapBefore(2));
+        QVERIFY(timeline.gapBefore(4));
+        QVERIFY(!timeline.gapBefore(5));
+
+        QCOMPARE(timeline.prevBatch(2), QString("b"));
+        QCOMPARE(timeline.prevBatch(4), QString("c"));
+        QVERIFY(timeline.prevBatch(5).isEmpty());
+    }
+
+    void replace() {
+        Timeline timeline;
+
+        timeline.append(batch(0, 3), false, "a");
+
+        Timeline snapshot = timeline;
+        qint64   bytes    = timeline.bytes();
+
+        QVERIFY(timeline.replace(event(1, "a much longer body than before")));
+        QVERIFY(!timeline.replace(event(7)));
+
+        QCOMPARE(timeline.size(), 3);
+        QCOMPARE(timeline.at(1).content.value("body").toString(),
+                 QString("a much longer body than before"));
+        QVERIFY(timeline.bytes() > bytes);
+
+        // Snapshots keep the event they were taken with
+        QCOMPARE(snapshot.at(1).content.value("body").toString(),
+                 QString("m1"));
+        QCOMPARE(snapshot.bytes(), bytes);
+    }
+
+    void shrink() {
+        Timeline timeline(100);
+
+        timeline.append(batch(0, 3), false, "a");
+        timeline.append(batch(3, 3), false, "b");
+        timeline.append(batch(6, 3), false, "c");
+        timeline.setLimits(5, 1 << 20);
+
+        QCOMPARE(timeline.maxEvents(), 5);
+        QCOMPARE(timeline.size(), 3);
+        QCOMPARE(timeline.at(0).eventId, QString("$e6"));
+        QCOMPARE(timeline.prevBatch(), QString("c"));
+
+        // Grows again up to the new limit only
+        timeline.append(batch(9, 3), false, "d");
+
+        QCOMPARE(timeline.size(), 3);
+        QCOMPARE(timeline.at(0).eventId, QString("$e9"));
+        QCOMPARE(timeline.at(2).eventId, QString("$e11"));
+        QCOMPARE(timeline.prevBatch(), QString("d"));
+    }
+
+  private:
+    static RoomEvent event(int i, const QString &body = "") {
+        return QJsonValue(QJsonObject{
+            {"event_id", QString("$e%1").arg(i)},
+            {"sender", "@timeline:localhost"},
+            {"origin_server_ts", 1000 + i},
+            {"type", "m.room.message"},
+            {"content",
+             QJsonObject{{"msgtype", "m.text"},
+                         {"body", body.isEmpty() ? QString("m%1").arg(i)
+                                                 : body}}}});
+    }
+
+    static QList<RoomEvent> batch(int first, int count) {
+        QList<RoomEvent> events;
+
+        for (int i = first; i < first + count; i++)
+            events.append(event(i));
+
+        return events;
+    }
+};
+
+QTEST_MAIN(TimelineTest)
+#include "TimelineTest.moc"
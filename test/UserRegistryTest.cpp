@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: LGPL-3.0-or-later
+
+#include <QtTest/QtTest>
+
+#include <MatrixCpp/Types.hpp>
+
+using namespace MatrixCpp::Types;
+
+class UserRegistryTest : public QObject {
+    Q_OBJECT
+
+  private slots:
+    void shared() {
+        UserRegistry registry;
+
+        // Equal strings, not shared, as when parsed from different events
+        User first  = registry.acquire(QString("@a:localhost"), "Alice");
+        User second = registry.acquire(QString("@b:localhost"), "Alice");
+
+        QCOMPARE(registry.size(), 1);
+        QVERIFY(first.displayName.constData() ==
+                second.displayName.constData());
+
+        registry.release(first);
+        QCOMPARE(registry.size(), 1);
+
+        registry.release(second);
+        QCOMPARE(registry.size(), 0);
+    }
+
+    void profileChange() {
+        QSharedPointer<UserRegistry> registry = UserRegistry::shared();
+        int                          before   = registry->size();
+
+        {
+            Room first(QString("!first:localhost"));
+            Room second(QString("!second:localhost"));
+
+            first.onEvent(member("Alice", "mxc://localhost/a"));
+            second.onEvent(member("Alice", "mxc://localhost/a"));
+            QCOMPARE(registry->size(), before + 2);
+
+            // Old name goes once no room uses it
+            first.onEvent(member("Alicia", "mxc://localhost/a"));
+            QCOMPARE(registry->size(), before + 3);
+
+            second.onEvent(member("Alicia", "mxc://localhost/a"));
+            QCOMPARE(registry->size(), before + 2);
+            QCOMPARE(second.member(QString("@alice:localhost")).displayName,
+                     QString("Alicia"));
+        }
+
+        QCOMPARE(registry->size(), before);
+    }
+
+  private:
+    RoomEvent member(const QString &displayName, const QString &avatarUrl) {
+        return QJsonValue(QJsonObject{
+            {"event_id", QString("$m%1").arg(++events)},
+            {"sender", "@alice:localhost"},
+            {"origin_server_ts", 1000 + events},
+            {"type", "m.room.member"},
+            {"state_key", "@alice:localhost"},
+            {"content",
+             QJsonObject{{"membership", "join"},
+                         {"displayname", displayName},
+                         {"avatar_url", avatarUrl}}}});
+    }
+
+    int events = 0;
+};
+
+QTEST_MAIN(UserRegistryTest)
+#include "UserRegistryTest.moc"